@@ -0,0 +1,94 @@
+#include "BufferThreadedP.h"
+#include <atomic>
+#include <cstdio>
+#include <iostream>
+#include <vector>
+
+using namespace std;
+
+/** Simulated sensor taking 20 ms per reading, counting its readings. */
+class SlowSensor {
+    int delayUs;
+
+    public:
+    std::atomic<int> calls;
+
+    SlowSensor(int delayUs) : delayUs(delayUs), calls(0) {}
+
+    int getPacket() {
+        usleep(delayUs);
+        return ++calls;
+    }
+};
+
+typedef BufferThread<int, SlowSensor> SlowBuffer;
+
+/**
+ * Arguments of one reader thread.
+ */
+struct ReaderArgs {
+    SlowBuffer* buf;
+    int reads;
+    int maxAgeMs;
+};
+
+/** Makes a number of blocking reads, one after another. */
+void* readerMain(void* arg) {
+    ReaderArgs* ra = static_cast<ReaderArgs*>(arg);
+    for (int i = 0; i < ra->reads; i++) {
+        ra->buf->getPacketBlking(ra->maxAgeMs);
+    }
+    return NULL;
+}
+
+/**
+ * Runs numThreads readers against one buffer and prints how many readings
+ * the sensor had to make for them.
+ */
+void runReaders(int numThreads, int reads, int maxAgeMs) {
+    SlowSensor sensor(20000);
+    SlowBuffer buf(&sensor);
+    buf.spawnThreads();
+    vector<pthread_t> threads(numThreads);
+    ReaderArgs ra = {&buf, reads, maxAgeMs};
+    int64_t start = monotonicNs();
+    for (int i = 0; i < numThreads; i++) {
+        pthread_create(&threads[i], NULL, &readerMain, &ra);
+    }
+    for (int i = 0; i < numThreads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    double ms = (monotonicNs() - start) / 1e6;
+    BlockingReadStats st = buf.getBlockingStats();
+    printf("%d threads x %d reads, maxAgeMs %2d: %4d sensor calls in "
+           "%6.0f ms; requests %llu = triggered %llu + joined %llu + "
+           "recent %llu\n", numThreads, reads, maxAgeMs,
+           sensor.calls.load(), ms, (unsigned long long) st.requests,
+           (unsigned long long) st.triggered,
+           (unsigned long long) st.joined,
+           (unsigned long long) st.recent);
+}
+
+/**
+ * Single-flight blocking reads: many threads asking a slow sensor at the
+ * same time share its readings instead of queueing up for their own.
+ * Finally, a buffer is destroyed while a reader is blocked on it.
+ */
+int main(int argc, char** argv) {
+    runReaders(1, 20, 0);
+    runReaders(8, 20, 0);
+    runReaders(8, 20, 50);
+
+    pthread_t t;
+    SlowSensor stuck(5000000);
+    {
+        SlowBuffer buf(&stuck);
+        buf.spawnThreads();
+        ReaderArgs ra = {&buf, 1, 0};
+        pthread_create(&t, NULL, &readerMain, &ra);
+        usleep(100000);
+    }
+    pthread_join(t, NULL);
+    cout << "Reader blocked during destruction returned" << endl;
+    return 0;
+}
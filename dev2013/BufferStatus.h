@@ -0,0 +1,121 @@
+#include <atomic>
+#include <stdint.h>
+
+// Header guards -- this file may be included more than once.
+#ifndef BUFFERSTATUS_H_
+#define BUFFERSTATUS_H_
+
+/**
+ * Lock-free update status of a buffer: a small state machine plus a version
+ * counter that is bumped every time a new packet is published.
+ *
+ * The states move through the cycle
+ *
+ *     IDLE/PUBLISHED --request()--> REQUESTED --beginUpdate()--> UPDATING
+ *     UPDATING --publish()--> PUBLISHED
+ *
+ * Continuous-mode buffers skip the request and sit in UPDATING for good.
+ * IDLE only means that nothing has been published yet.
+ *
+ * Memory ordering: publish() increments the version and then stores the new
+ * state, both with release semantics, after the packet has been stored. The
+ * read functions use acquire loads, so a reader that sees version v (or the
+ * PUBLISHED state) is guaranteed to see the packet of version v, or a newer
+ * one, when it next reads the buffer. request() uses an acquire-release
+ * compare-and-swap so that only one caller wins the transition. All read
+ * functions are single atomic loads and hence wait-free.
+ */
+class BufferStatus {
+
+    public:
+    enum State {
+        IDLE,       /**< Nothing requested or published yet */
+        REQUESTED,  /**< An update was requested, but has not started */
+        UPDATING,   /**< The updater is talking to the source */
+        PUBLISHED   /**< The latest update is done and published */
+    };
+
+    private:
+    std::atomic<int> state;
+    std::atomic<uint64_t> version;
+
+    BufferStatus(const BufferStatus&);
+    BufferStatus& operator=(const BufferStatus&);
+
+    public:
+    BufferStatus() : state(IDLE), version(0) {}
+
+    State getState() const {
+        return static_cast<State>(state.load(std::memory_order_acquire));
+    }
+
+    /**
+     * Whether an update has been requested or is in progress.
+     */
+    bool isUpdating() const {
+        int s = state.load(std::memory_order_acquire);
+        return s == REQUESTED || s == UPDATING;
+    }
+
+    /**
+     * The number of packets published so far. Zero means the buffer still
+     * holds its default-constructed packet.
+     */
+    uint64_t getVersion() const {
+        return version.load(std::memory_order_acquire);
+    }
+
+    /**
+     * Requests an update. Fails (returns false) if one is already requested
+     * or in progress, so that concurrent callers trigger only one update.
+     *
+     * @return Whether this call made the transition to REQUESTED.
+     */
+    bool request() {
+        int s = state.load(std::memory_order_relaxed);
+        while (s == IDLE || s == PUBLISHED) {
+            if (state.compare_exchange_weak(s, REQUESTED,
+                                            std::memory_order_acq_rel,
+                                            std::memory_order_relaxed)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * Called by the updater to claim a pending request.
+     *
+     * @return Whether a request was pending; if not, nothing changes.
+     */
+    bool beginUpdate() {
+        int s = REQUESTED;
+        return state.compare_exchange_strong(s, UPDATING,
+                                             std::memory_order_acq_rel,
+                                             std::memory_order_relaxed);
+    }
+
+    /**
+     * Puts the status into UPDATING unconditionally (continuous mode).
+     */
+    void setUpdating() {
+        state.store(UPDATING, std::memory_order_release);
+    }
+
+    /**
+     * Called by the updater after the new packet has been stored.
+     *
+     * @param keepUpdating Stay in UPDATING instead of moving to PUBLISHED
+     *        (continuous mode).
+     *
+     * @return The version number of the packet just published.
+     */
+    uint64_t publish(bool keepUpdating) {
+        uint64_t v = version.fetch_add(1, std::memory_order_release) + 1;
+        state.store(keepUpdating ? UPDATING : PUBLISHED,
+                    std::memory_order_release);
+        return v;
+    }
+};
+
+#endif
@@ -3,10 +3,13 @@
 #include <boost/bind.hpp>
 #include <unistd.h>
 #include <sys/time.h>
+#include <iostream>
 
 using boost::function;
 using boost::bind;
-using namespace std;
+using std::cout;
+using std::cin;
+using std::endl;
 
 /**
  * Wrapper for interfacing with C-style pthreads library (so C linkage may or
@@ -293,7 +296,7 @@ int main(int argc, char** argv) {
             tStamp = buf->getTimeStamp();
             cout << "Timestamp: " << ctime(&(tStamp.tv_sec)) << tStamp.tv_usec <<
                 " ms" << endl;
-            delete(data);
+            delete[] data;
             break;
         case 'i':
             // Inquiry, isUpdating.
@@ -1,9 +1,21 @@
 #include <pthread.h>
+#include <sched.h>
 #include <boost/function.hpp>
 #include <boost/bind.hpp>
+#include <string>
 #include <unistd.h>
 #include <sys/time.h>
 
+#include "SyncPolicy.h"
+#include "BufferStatus.h"
+#include "FutexEvent.h"
+#include "ReadyNotifier.h"
+#include "MonotonicClock.h"
+#include "PacketLease.h"
+#include "Lineage.h"
+#include "PerfCounters.h"
+#include "ThreadAccounting.h"
+
 using boost::function;
 using boost::bind;
 
@@ -19,6 +31,18 @@ using boost::bind;
  */
 extern "C" void* pthreadWrapper(void* arg);
 
+/**
+ * Counters kept by BufferThread::getPacketBlking(). Every request is counted
+ * in exactly one of the last three fields; the latter two are the requests
+ * that were coalesced with somebody else's acquisition.
+ */
+struct BlockingReadStats {
+    uint64_t requests;   /**< Blocking reads in total */
+    uint64_t triggered;  /**< Reads that started their own acquisition */
+    uint64_t joined;     /**< Reads that attached to one in flight */
+    uint64_t recent;     /**< Reads served by a recent enough acquisition */
+};
+
 /**
  * Template for supporting asynchronous sensor updating with arbitrary sensor
  * and packet classes. Provides separate threads for sensor communication, data
@@ -29,43 +53,161 @@ extern "C" void* pthreadWrapper(void* arg);
  * function with signature `Packet getPacket()` that communicates with the
  * sensor and returns the resulting data in a Packet. The Packet class must
  * have a sensible copy-constructor and operator= defined.
+ *
+ * The optional third parameter selects how the cached packet is shared
+ * between the updater thread and the readers; see SyncPolicy.h for the
+ * available policies. The default, MutexPolicy, is a plain mutex.
  */
-template <class Packet, class Interface>
+template <class Packet, class Interface, class SyncPolicy = MutexPolicy>
 class BufferThread {
 
     private:
-    pthread_mutex_t upfl_mtx;
-    pthread_mutex_t data_mtx;
-    pthread_cond_t read_cond;
+    FutexEvent trigger_evt; // readData() -> updater
+    FutexEvent publish_evt; // updater -> waitForVersion()
+    FutexEvent swap_evt;    // updater -> swapInterface()
+    std::atomic<bool> bStop;
+    bool bStarted;
     pthread_t read_thread;
 
-    Interface* source;
-    Packet pkt;
-    bool bUpdating;
+    Interface* source; // Only touched by the updater once it has started
+    // Interface swap requested by swapInterface(), under swap_mtx. The flag
+    // lets the updater check for one without taking the mutex.
+    pthread_mutex_t swap_mtx;
+    Interface* pendingSource;
+    std::atomic<bool> swapPending;
+    uint64_t swapsRequested;
+    std::atomic<uint64_t> swapsDone;
+    typename SyncPolicy::template Cell<Packet> cell;
+    BufferStatus status;
+    std::atomic<bool> restored; // Seeded by restorePacket()
+    int lineageId;
+    std::atomic<ReadyNotifier*> notifier;
+    int notifyTag;
+    // Start time of the acquisition that produced the cached packet.
+    std::atomic<int64_t> acqStartNs;
+    std::atomic<uint64_t> blkRequests;
+    std::atomic<uint64_t> blkTriggered;
+    std::atomic<uint64_t> blkJoined;
+    std::atomic<uint64_t> blkRecent;
+    // Threads inside getPacketBlking() or waitForVersion(), which the
+    // destructor has to wake and wait out.
+    std::atomic<int> waiters;
+    LeaseMeter leaseMeter;
+    std::atomic<PerfStageStats*> perfStats;
+    std::string threadName;
+    function<void(const Packet&, uint64_t)> publishHook;
     function<void*()>* tfPersistent;
 
-    public:
-    BufferThread(Interface* source) : source(source) {
-        // Multithreading construct initialization and thread spawning
-        pthread_mutex_init(&upfl_mtx, NULL);
-        pthread_mutex_init(&data_mtx, NULL);
-        pthread_cond_init(&read_cond, NULL);
+    /**
+     * Switches to the interface requested by swapInterface(), if any.
+     * Called by the updater thread only, between acquisitions.
+     */
+    void applySwap() {
+        if (!swapPending.load(std::memory_order_acquire)) {
+            return;
+        }
+        pthread_mutex_lock(&swap_mtx);
+        if (pendingSource != NULL) {
+            source = pendingSource;
+            pendingSource = NULL;
+            swapPending.store(false, std::memory_order_relaxed);
+            swapsDone.store(swapsRequested, std::memory_order_release);
+        }
+        pthread_mutex_unlock(&swap_mtx);
+        swap_evt.notifyAll();
+    }
 
-        tfPersistent = NULL;
+    /**
+     * Gets a packet from the interface, measuring the read into perfStats
+     * if it is set. Called by the updater thread only.
+     */
+    void acquire(Packet& pkl, PerfProbe& probe) {
+        PerfStageStats* ps = perfStats.load(std::memory_order_acquire);
+        if (ps == NULL) {
+            pkl = source->getPacket();
+            return;
+        }
+        probe.begin();
+        pkl = source->getPacket();
+        probe.end(ps);
+    }
+
+    /**
+     * Stores a freshly acquired packet, marks it published and wakes up
+     * everybody waiting for it. Called by the updater thread only.
+     *
+     * @param pkl The new packet; may be left in a moved-from state.
+     * @param keepUpdating Whether the updater runs in continuous mode.
+     * @param startNs When the acquisition of the packet started (see
+     *        monotonicNs()).
+     */
+    void publishPacket(Packet& pkl, bool keepUpdating, int64_t startNs) {
+        /* Keep the store as short and fast as possible. It should consist
+         * only of copying the data received from the sensor into the
+         * internal buffer variables.
+         *
+         * The reason is that other threads (like the main thread) may
+         * want to access data using the get-functions while this
+         * update is happening. If the store takes too long, that thread
+         * may be made to wait, which is not a good thing.
+         */
+        if (IsTraced<Packet>::value) {
+            lineageSource(pkl, lineageId, status.getVersion() + 1, startNs,
+                          monotonicNs());
+        }
+        if (publishHook) {
+            // Before the store, which may move the packet away.
+            publishHook(pkl, status.getVersion() + 1);
+        }
+        cell.store(pkl);
+        acqStartNs.store(startNs, std::memory_order_relaxed);
+
+        // Report that we are done updating. The release ordering in
+        // publish() keeps this from being reordered before the store.
+        status.publish(keepUpdating);
+        publish_evt.notifyAll();
 
-        bUpdating = false;
+        ReadyNotifier* n = notifier.load(std::memory_order_acquire);
+        if (n != NULL) {
+            n->markReady(notifyTag);
+        }
     }
 
-    ~BufferThread() {
-        // Stop the thread and take care of the extra pthreads destruction
-        // requirements
-        pthread_cancel(read_thread);
-        pthread_join(read_thread, NULL);
+    public:
+    BufferThread(Interface* source) : bStop(false), bStarted(false),
+                                      source(source), pendingSource(NULL),
+                                      swapPending(false), swapsRequested(0),
+                                      swapsDone(0), restored(false),
+                                      lineageId(0), notifier(NULL),
+                                      notifyTag(-1), acqStartNs(0),
+                                      blkRequests(0), blkTriggered(0),
+                                      blkJoined(0), blkRecent(0),
+                                      waiters(0),
+                                      perfStats(NULL),
+                                      threadName("buffer") {
+        pthread_mutex_init(&swap_mtx, NULL);
+        tfPersistent = NULL;
+    }
 
-        pthread_cond_destroy(&read_cond);
-        pthread_mutex_destroy(&data_mtx);
-        pthread_mutex_destroy(&upfl_mtx);
+    ~BufferThread() {
+        bStop.store(true);
+        if (bStarted) {
+            /* Futex waits are not cancellation points, so an idle updater
+             * has to be woken up to notice it should stop. Cancellation is
+             * still needed for an updater stuck inside the Interface.
+             */
+            trigger_evt.notifyAll();
+            pthread_cancel(read_thread);
+            pthread_join(read_thread, NULL);
+        }
+        // Readers blocked waiting for a version return the cached packet;
+        // wait until they have.
+        publish_evt.notifyAll();
+        while (waiters.load() > 0) {
+            sched_yield();
+        }
 
+        pthread_mutex_destroy(&swap_mtx);
         delete tfPersistent;
     }
 
@@ -87,7 +229,11 @@ class BufferThread {
     void spawnThreads() {
         function<void*()> thrFun = bind(&BufferThread::threadMeth, this);
         tfPersistent = new function<void*()>(thrFun);
+        // Under swap_mtx, so that swapInterface() sees a consistent state
+        pthread_mutex_lock(&swap_mtx);
         pthread_create(&read_thread, NULL, &pthreadWrapper, tfPersistent);
+        bStarted = true;
+        pthread_mutex_unlock(&swap_mtx);
     }
 
     /**
@@ -113,99 +259,358 @@ class BufferThread {
     void runContinuous() {
         function<void*()> thrFun = bind(&BufferThread::tmContinuous, this, 0);
         tfPersistent = new function<void*()>(thrFun);
+        // Under swap_mtx, so that swapInterface() sees a consistent state
+        pthread_mutex_lock(&swap_mtx);
         pthread_create(&read_thread, NULL, &pthreadWrapper, tfPersistent);
+        bStarted = true;
+        pthread_mutex_unlock(&swap_mtx);
     }
 
 
     Packet getPacket() {
-        /* All data-access sections must have these lock/unlock guards.
-         * They protect against access to the data while it is being modified.
+        /* All data access goes through the cell, which protects against
+         * access to the data while it is being modified.
          */
         Packet pkl;
-        pthread_mutex_lock(&data_mtx);
-        pkl = pkt; // Make a local copy to ensure correctness and safety
-        pthread_mutex_unlock(&data_mtx);
+        cell.load(pkl); // Make a local copy to ensure correctness and safety
+        if (IsTraced<Packet>::value) {
+            lineagePolled(pkl, monotonicNs());
+        }
         return pkl;
     }
 
+    /**
+     * Names the updater thread, for ThreadSampler and tools like top -H.
+     * Call before starting the threads.
+     */
+    void setThreadName(const std::string& name) {
+        threadName = name;
+    }
+
+    /**
+     * Measures every sensor read with the updater thread's performance
+     * counters (see PerfCounters.h) and adds them to stats; NULL stops
+     * measuring. The counters are opened by the updater thread at its next
+     * read. The stats must outlive the buffer, or measuring.
+     */
+    void setPerfStats(PerfStageStats* stats) {
+        perfStats.store(stats, std::memory_order_release);
+    }
+
+    /**
+     * Sets the id this buffer records in the lineage of Traced packets (see
+     * Lineage.h). Call before starting the threads.
+     */
+    void setLineageId(int id) {
+        lineageId = id;
+    }
+
+    /**
+     * Whether an update has been requested and is not yet published. This is
+     * a single atomic load (see BufferStatus for the memory ordering), so it
+     * is cheap to call on every buffer in every cycle.
+     */
     bool isUpdating() {
-        /* This silly dance helps ensure thread safety.
-         *
-         * Yes, this is just a read of a boolean variable, but without the
-         * locks there is no guarantee that this read instruction won't be
-         * reordered by an aggressively optimizing compiler to some place that
-         * makes the program's semantics invalid.
-         *
-         * Trust me, multi-threading is tricky business.
-         */
-        bool retval;
-        pthread_mutex_lock(&upfl_mtx);
-        retval = bUpdating;
-        pthread_mutex_unlock(&upfl_mtx);
-        return retval;
+        return status.isUpdating();
     }
 
-    void readData() {
-        pthread_mutex_lock(&upfl_mtx);
-        if (bUpdating) {
-            // Will not initiate an update while another is in progress.
-            pthread_mutex_unlock(&upfl_mtx);
-            return;
+    /**
+     * The current state of the update state machine.
+     */
+    BufferStatus::State getState() {
+        return status.getState();
+    }
+
+    /**
+     * The number of packets published so far. Callers can compare it with a
+     * remembered value to find out whether getPacket() has anything new.
+     */
+    uint64_t getVersion() {
+        return status.getVersion();
+    }
+
+    /**
+     * Blocking ("Blking", see SensorInterface.md) read with single-flight
+     * coalescing: however many threads ask at the same time, the sensor sees
+     * at most one acquisition.
+     *
+     * If the cached packet comes from an acquisition that started at most
+     * maxAgeMs milliseconds ago, it is returned right away. Otherwise the
+     * caller attaches to the acquisition currently in flight, or starts one
+     * if there is none, and waits for its result; every caller attached to
+     * the same acquisition gets the same packet.
+     *
+     * The updater thread must be running (see spawnThreads()). In continuous
+     * mode an acquisition is always in flight, so this simply waits for the
+     * next packet unless the cached one is recent enough.
+     *
+     * @param maxAgeMs How old an acquisition may be and still count as
+     *        fresh. Zero means only an acquisition in flight (or a new one)
+     *        will do.
+     *
+     * @return A packet from, in this order of preference: an acquisition
+     *         that started no more than maxAgeMs before the call; the
+     *         acquisition this call started; or, if one was already under
+     *         way, the first acquisition to finish after the call, which
+     *         may have started before it. While the buffer is being
+     *         destroyed, the cached packet.
+     */
+    Packet getPacketBlking(int maxAgeMs = 0) {
+        waiters.fetch_add(1);
+        blkRequests.fetch_add(1, std::memory_order_relaxed);
+        int64_t callNs = monotonicNs();
+        uint64_t version = status.getVersion();
+        if (version > 0 && maxAgeMs > 0 &&
+                callNs - acqStartNs.load(std::memory_order_acquire) <=
+                maxAgeMs * 1000000LL) {
+            blkRecent.fetch_add(1, std::memory_order_relaxed);
         } else {
-            bUpdating = true;
-            pthread_mutex_unlock(&upfl_mtx);
-            pthread_cond_signal(&read_cond);
+            int64_t requestNs = monotonicNs();
+            if (status.request()) {
+                blkTriggered.fetch_add(1, std::memory_order_relaxed);
+                trigger_evt.notifyOne();
+                /* A packet of an older acquisition may have been published
+                 * between reading the version and the request; skip it and
+                 * wait for ours, which starts after the request.
+                 */
+                version = waitForVersion(version);
+                while (acqStartNs.load(std::memory_order_acquire) <
+                       requestNs && !bStop.load()) {
+                    version = waitForVersion(version);
+                }
+            } else {
+                blkJoined.fetch_add(1, std::memory_order_relaxed);
+                waitForVersion(version);
+            }
         }
+        Packet pkl = getPacket();
+        waiters.fetch_sub(1);
+        return pkl;
     }
 
     /**
-     * The updater thread function. This function is not meant to return; it
-     * simply runs until the thread is canceled.
+     * A snapshot of the getPacketBlking() counters.
+     */
+    BlockingReadStats getBlockingStats() {
+        BlockingReadStats st;
+        st.requests = blkRequests.load(std::memory_order_relaxed);
+        st.triggered = blkTriggered.load(std::memory_order_relaxed);
+        st.joined = blkJoined.load(std::memory_order_relaxed);
+        st.recent = blkRecent.load(std::memory_order_relaxed);
+        return st;
+    }
+
+    /**
+     * Grants a read lease on the current packet: a consistent view of all
+     * its fields for as long as the lease is in scope, while the updater
+     * goes on publishing. See PacketLease.
+     *
+     * Only with RcuPolicy does the lease pin the published packet itself,
+     * at the cost of a reference count. With every other policy, the
+     * default MutexPolicy included, it is a heap copy of the packet
+     * (make_shared), costing about as much as getPacket().
+     */
+    PacketLease<Packet> lease() {
+        return PacketLease<Packet>(cell.pin(), &leaseMeter);
+    }
+
+    /**
+     * Statistics on how many leases were taken and how long they were held.
+     */
+    LeaseStats getLeaseStats() {
+        return leaseMeter.getStats();
+    }
+
+    /**
+     * Makes the notifier's descriptor readable whenever this buffer
+     * publishes a new packet, for use with an external event loop. Several
+     * buffers may share one notifier. A buffer can only be attached to one
+     * notifier, once, preferably before its threads are started.
+     *
+     * The notifier must outlive the buffer.
+     *
+     * @return The tag that identifies this buffer in ReadyNotifier::drain(),
+     *         or -1 if the notifier has no room left.
+     */
+    int attachNotifier(ReadyNotifier* rn) {
+        int tag = rn->addSource();
+        if (tag >= 0) {
+            notifyTag = tag;
+            notifier.store(rn, std::memory_order_release);
+        }
+        return tag;
+    }
+
+    /**
+     * Installs a function that the updater thread calls with every packet
+     * it is about to publish, and the version the packet will have (see
+     * getVersion()); e.g. DeltaTracker::record(). The hook runs on the
+     * updater thread before readers can see the packet, so it should be
+     * quick. Install it once, before the threads are started.
+     */
+    void setPublishHook(function<void(const Packet&, uint64_t)> hook) {
+        publishHook = hook;
+    }
+
+    /**
+     * Replaces the sensor interface without stopping the updater thread, e.g.
+     * to reconnect a sensor or switch drivers. The cached packet, the version
+     * count and everything attached to the buffer are kept.
+     *
+     * The swap takes effect at the next acquisition boundary: immediately if
+     * the updater is idle, otherwise as soon as the acquisition in flight on
+     * the old interface returns (its packet is still published). The call
+     * waits for that at most timeoutMs milliseconds. If the old interface is
+     * stuck, the swap stays pending and happens whenever it comes back; a
+     * later swap request replaces a pending one.
+     *
+     * The old interface must stay valid until the swap has taken effect.
+     *
+     * @return Whether the swap has taken effect; false, with nothing
+     *         changed, if newSource is NULL.
+     */
+    bool swapInterface(Interface* newSource, int timeoutMs = 1000) {
+        if (newSource == NULL) {
+            return false;
+        }
+        pthread_mutex_lock(&swap_mtx);
+        if (!bStarted) {
+            source = newSource;
+            swapsDone.store(++swapsRequested);
+            pthread_mutex_unlock(&swap_mtx);
+            return true;
+        }
+        pendingSource = newSource;
+        uint64_t ticket = ++swapsRequested;
+        swapPending.store(true, std::memory_order_release);
+        pthread_mutex_unlock(&swap_mtx);
+        // An idle updater swaps as soon as it wakes up.
+        trigger_evt.notifyAll();
+
+        int64_t deadline = monotonicNs() + timeoutMs * 1000000LL;
+        while (true) {
+            uint32_t key = swap_evt.prepareWait();
+            if (swapsDone.load(std::memory_order_acquire) >= ticket) {
+                return true;
+            }
+            int64_t left = deadline - monotonicNs();
+            if (left <= 0) {
+                return false;
+            }
+            swap_evt.waitFor(key, left);
+        }
+    }
+
+    /**
+     * Seeds the buffer with a packet kept from an earlier run (see
+     * PacketSnapshot.h), so that readers have something to act on before
+     * the first acquisition completes. The version stays 0, and isRestored()
+     * tells readers that the packet is stale. Call before starting the
+     * threads.
+     */
+    void restorePacket(const Packet& pkt) {
+        Packet seed(pkt);
+        cell.store(seed);
+        restored.store(true, std::memory_order_release);
+    }
+
+    /**
+     * Whether the cached packet is one restored by restorePacket(), i.e. no
+     * fresh packet has been published yet.
+     */
+    bool isRestored() {
+        return restored.load(std::memory_order_acquire) &&
+            status.getVersion() == 0;
+    }
+
+    /**
+     * Whether a swapInterface() request has yet to take effect.
+     */
+    bool isSwapPending() {
+        return swapPending.load(std::memory_order_acquire);
+    }
+
+    void readData() {
+        // Will not initiate an update while another is in progress.
+        if (status.request()) {
+            // Costs no system call unless the updater is actually asleep.
+            trigger_evt.notifyOne();
+        }
+    }
+
+    /**
+     * Blocks until a packet newer than the given version has been published.
+     *
+     * @param version The version the caller already has (see getVersion()).
+     *
+     * @return The current version, which is greater than the one passed in
+     *         unless the buffer is being destroyed.
+     */
+    uint64_t waitForVersion(uint64_t version) {
+        waiters.fetch_add(1);
+        while (true) {
+            uint32_t key = publish_evt.prepareWait();
+            uint64_t current = status.getVersion();
+            if (current > version || bStop.load()) {
+                waiters.fetch_sub(1);
+                return current;
+            }
+            publish_evt.wait(key);
+        }
+    }
+
+    /**
+     * Like waitForVersion(), but gives up after timeoutMs milliseconds.
+     *
+     * @return The current version; compare with the one passed in to find
+     *         out whether the wait timed out.
+     */
+    uint64_t waitForVersion(uint64_t version, int timeoutMs) {
+        waiters.fetch_add(1);
+        uint32_t key = publish_evt.prepareWait();
+        uint64_t current = status.getVersion();
+        if (current <= version && !bStop.load()) {
+            publish_evt.waitFor(key, timeoutMs * 1000000LL);
+            current = status.getVersion();
+        }
+        waiters.fetch_sub(1);
+        return current;
+    }
+
+    /**
+     * The updater thread function. This function runs until the buffer is
+     * destroyed.
      *
      * It is called from an external wrapper function.
      */
     void* threadMeth() {
-        bool bUpl; // Thread-local updating flag
+        ThreadRegistration reg(threadName);
         Packet pkl; // Thread-local packet
+        PerfProbe probe;
         while (true) {
-            pthread_mutex_lock(&upfl_mtx);
-            pthread_cond_wait(&read_cond, &upfl_mtx);
-            /* Keep the critical section as short as possible (we don't want
-             * to block callers of isUpdating() ).
-             */
-            bUpl = bUpdating;
-            pthread_mutex_unlock(&upfl_mtx);
+            while (true) {
+                uint32_t key = trigger_evt.prepareWait();
+                if (bStop.load()) {
+                    return NULL;
+                }
+                applySwap();
+                if (status.getState() == BufferStatus::REQUESTED) {
+                    break;
+                }
+                trigger_evt.wait(key);
+            }
 
-            if (bUpl) { // Is it OK to proceed?
+            if (status.beginUpdate()) { // Is it OK to proceed?
                 /* This is the actual bulk of the update functionality.
                  * It can (and should) be delegated to separate functions.
                  */
 
                 // Communicate with the sensor
-                pkl = source->getPacket();
-
-                /* Keep the section in between the lock guards (i.e. the
-                 * "critical section") as short and fast as possible. It should
-                 * consist only of copying the data received from the sensor
-                 * into the internal buffer variables.
-                 *
-                 * The reason is that other threads (like the main thread) may
-                 * want to access data using the get-functions while this
-                 * update is happening. If the locked section takes too long,
-                 * that thread will be made to wait, which is not a good thing.
-                 */
-                pthread_mutex_lock(&data_mtx);
-                // Update cached data
-                pkt = pkl;
-                pthread_mutex_unlock(&data_mtx);
-
-                // Pthreads should ensure that these two code blocks are not
-                // reordered with respect to each other.
-
-                // Report that we are done updating.
-                pthread_mutex_lock(&upfl_mtx);
-                bUpdating = false;
-                pthread_mutex_unlock(&upfl_mtx);
+                int64_t startNs = monotonicNs();
+                acquire(pkl, probe);
+
+                // Update cached data and report that we are done updating.
+                publishPacket(pkl, false, startNs);
             }
         }
         // We'll never get here, but whatever keeps the compiler happy.
@@ -214,8 +619,7 @@ class BufferThread {
 
     /**
      * The updater thread function for continuous operation. Again, this
-     * function is not meant to return; it simply runs until the thread
-     * is canceled.
+     * function runs until the buffer is destroyed.
      *
      * \param intervalMs The minimum time between updates. If zero, the updates
      *        will immediately follow one another.
@@ -226,37 +630,27 @@ class BufferThread {
      */
     void* tmContinuous(int intervalMs) {
         // Basically the same as above, only we don't wait for readData.
+        ThreadRegistration reg(threadName);
         Packet pkl; // Thread-local packet
-        // We're constantly updating, so this flag just stays true.
-        pthread_mutex_lock(&upfl_mtx);
-        bUpdating = true;
-        pthread_mutex_unlock(&upfl_mtx);
+        PerfProbe probe;
+        // We're constantly updating, so the status just stays UPDATING.
+        status.setUpdating();
 
-        while (true) {
+        while (!bStop.load(std::memory_order_relaxed)) {
+            applySwap();
 
             // Communicate with the sensor
-            pkl = source->getPacket();
+            int64_t startNs = monotonicNs();
+            acquire(pkl, probe);
 
-            /* Keep the section in between the lock guards (i.e. the
-             * "critical section") as short and fast as possible. It should
-             * consist only of copying the data received from the sensor
-             * into the internal buffer variables.
-             *
-             * The reason is that other threads (like the main thread) may
-             * want to access data using the get-functions while this
-             * update is happening. If the locked section takes too long,
-             * that thread will be made to wait, which is not a good thing.
-             */
-            pthread_mutex_lock(&data_mtx);
             // Update cached data
-            pkt = pkl;
-            pthread_mutex_unlock(&data_mtx);
+            publishPacket(pkl, true, startNs);
 
             // Cancellation point, just to be sure
             // TODO add timed loop capability
             sleep(0);
         }
-        // We'll never get here, but whatever keeps the compiler happy.
+        // Stopped by the destructor.
         return NULL;
     }
 };
@@ -0,0 +1,402 @@
+#include <pthread.h>
+#include <boost/function.hpp>
+#include <boost/bind.hpp>
+#include <atomic>
+#include <cstdio>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <time.h>
+
+#include "BufferThreadedP.h"
+#include "MonotonicClock.h"
+#include "ThreadAccounting.h"
+
+// Header guards -- this file may be included more than once.
+#ifndef CONTROLLOOP_H_
+#define CONTROLLOOP_H_
+
+/**
+ * The phases of a control-loop cycle, in the order they run.
+ */
+enum LoopPhase {
+    PHASE_TRIGGER, /**< Ask the buffers for new data (readData()) */
+    PHASE_GATHER,  /**< Take the packets the cycle will work on */
+    PHASE_COMPUTE, /**< Estimation, planning, control */
+    PHASE_EMIT,    /**< Send the commands */
+    NUM_LOOP_PHASES
+};
+
+/**
+ * What ControlLoop does after a cycle overran its period.
+ */
+enum OverrunPolicy {
+    /** Run the late cycles back to back until the loop is on time again. */
+    OVERRUN_CATCH_UP,
+    /** Drop the periods already missed and carry on with the next one. */
+    OVERRUN_SKIP
+};
+
+/** Buckets of the jitter histogram: [0, 1), [1, 2), [2, 4) ... us. */
+const int NUM_JITTER_BUCKETS = 16;
+
+/**
+ * Timing of a ControlLoop, as returned by ControlLoop::getStats(). Times
+ * are in nanoseconds.
+ */
+struct LoopStats {
+    uint64_t cycles;
+    uint64_t misses;         /**< Cycles that ended after their deadline */
+    uint64_t skipped;        /**< Periods dropped by OVERRUN_SKIP */
+    uint64_t shed;           /**< Optional steps not run while degraded */
+    bool degraded;
+    uint64_t phaseRuns[NUM_LOOP_PHASES];
+    uint64_t phaseTotalNs[NUM_LOOP_PHASES];
+    uint64_t phaseMaxNs[NUM_LOOP_PHASES];
+    uint64_t phaseOverruns[NUM_LOOP_PHASES]; /**< Over their budget */
+    int64_t maxJitterNs;     /**< Latest wake-up after the scheduled start */
+    /** Wake-up lateness; bucket i counts [2^(i-1), 2^i) us, 0 below 1. */
+    uint64_t jitter[NUM_JITTER_BUCKETS];
+};
+
+/**
+ * A fixed-rate executive for the main loop, in place of a hand-written
+ * `while (true)` calling readData() and getPacket() on every buffer:
+ *
+ *     ControlLoop loop(10000000); // 100 Hz
+ *     loop.addTrigger(&imuBuf);
+ *     loop.addStep(PHASE_GATHER, "gather", bind(&Robot::gather, &robot));
+ *     loop.addStep(PHASE_COMPUTE, "control", bind(&Robot::control, &robot));
+ *     loop.addStep(PHASE_EMIT, "motors", bind(&Robot::emit, &robot));
+ *     loop.addStep(PHASE_EMIT, "log", bind(&Robot::log, &robot), true);
+ *     loop.setBudget(PHASE_COMPUTE, 6000000);
+ *     loop.run(); // Until stop()
+ *
+ * Cycles start at absolute deadlines (start + k * period, on the monotonic
+ * clock), so the rate does not drift with the time the cycles take. Each
+ * cycle runs the steps of every phase in order. Steps of a phase run in
+ * the order they were added.
+ *
+ * Overruns: a phase taking longer than its budget is counted against the
+ * phase; a cycle ending after the next cycle's start is a deadline miss,
+ * after which the overrun policy decides whether to catch up or skip
+ * periods. After missesToDegrade consecutive misses the loop is degraded:
+ * optional steps are shed until recoverCycles consecutive cycles have met
+ * their deadline. The degradation handler, if any, is told of both
+ * transitions, e.g. to lower the robot's speed.
+ *
+ * The wake-up jitter of every cycle (how late it started) goes into a
+ * histogram; see report().
+ */
+class ControlLoop {
+
+    public:
+    typedef boost::function<void()> StepFunc;
+    /** Called with true when the loop degrades, false when it recovers. */
+    typedef boost::function<void(bool)> DegradeFunc;
+
+    private:
+    struct Step {
+        std::string name;
+        StepFunc fn;
+        bool optional;
+    };
+
+    int64_t periodNs;
+    std::vector<Step> steps[NUM_LOOP_PHASES];
+    int64_t budgetNs[NUM_LOOP_PHASES];
+    OverrunPolicy policy;
+    int missesToDegrade;
+    int recoverCycles;
+    DegradeFunc onDegrade;
+
+    pthread_mutex_t stats_mtx;
+    LoopStats stats;
+    int consecutiveMisses;
+    int consecutiveMet;
+    std::atomic<bool> bStop;
+    bool bStarted;
+    pthread_t loop_thread;
+    boost::function<void*()>* tfPersistent;
+
+    ControlLoop(const ControlLoop&);
+    ControlLoop& operator=(const ControlLoop&);
+
+    static void sleepUntil(int64_t ns) {
+        timespec ts;
+        ts.tv_sec = ns / 1000000000;
+        ts.tv_nsec = ns % 1000000000;
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL)
+               != 0) {}
+    }
+
+    static int jitterBucket(int64_t ns) {
+        int64_t us = ns / 1000;
+        int b = 0;
+        while (us > 0 && b < NUM_JITTER_BUCKETS - 1) {
+            us >>= 1;
+            ++b;
+        }
+        return b;
+    }
+
+    /**
+     * Runs one cycle whose scheduled start was scheduledNs.
+     *
+     * @return Whether it met its deadline.
+     */
+    bool runCycle(int64_t scheduledNs, bool degraded) {
+        int64_t startNs = monotonicNs();
+        int64_t phaseNs[NUM_LOOP_PHASES];
+        uint64_t shedNow = 0;
+        for (int p = 0; p < NUM_LOOP_PHASES; p++) {
+            int64_t t0 = monotonicNs();
+            for (size_t s = 0; s < steps[p].size(); s++) {
+                if (degraded && steps[p][s].optional) {
+                    ++shedNow;
+                    continue;
+                }
+                steps[p][s].fn();
+            }
+            phaseNs[p] = monotonicNs() - t0;
+        }
+        int64_t endNs = monotonicNs();
+        bool met = endNs <= scheduledNs + periodNs;
+
+        pthread_mutex_lock(&stats_mtx);
+        ++stats.cycles;
+        stats.shed += shedNow;
+        if (!met) {
+            ++stats.misses;
+        }
+        for (int p = 0; p < NUM_LOOP_PHASES; p++) {
+            if (steps[p].empty()) {
+                continue;
+            }
+            ++stats.phaseRuns[p];
+            stats.phaseTotalNs[p] += phaseNs[p];
+            if ((uint64_t) phaseNs[p] > stats.phaseMaxNs[p]) {
+                stats.phaseMaxNs[p] = phaseNs[p];
+            }
+            if (budgetNs[p] > 0 && phaseNs[p] > budgetNs[p]) {
+                ++stats.phaseOverruns[p];
+            }
+        }
+        int64_t jitter = startNs - scheduledNs;
+        if (jitter < 0) {
+            jitter = 0;
+        }
+        ++stats.jitter[jitterBucket(jitter)];
+        if (jitter > stats.maxJitterNs) {
+            stats.maxJitterNs = jitter;
+        }
+        pthread_mutex_unlock(&stats_mtx);
+        return met;
+    }
+
+    void setDegraded(bool degraded) {
+        pthread_mutex_lock(&stats_mtx);
+        stats.degraded = degraded;
+        pthread_mutex_unlock(&stats_mtx);
+        if (onDegrade) {
+            onDegrade(degraded);
+        }
+    }
+
+    /**
+     * The loop thread function, for start().
+     *
+     * It is called from an external wrapper function.
+     */
+    void* loopMeth() {
+        ThreadRegistration reg("control-loop");
+        run();
+        return NULL;
+    }
+
+    public:
+    /**
+     * @param periodNs The cycle period.
+     * @param policy What to do after a deadline miss.
+     * @param missesToDegrade Consecutive misses after which optional steps
+     *        are shed; 0 never to degrade.
+     * @param recoverCycles Consecutive cycles on time after which they run
+     *        again.
+     */
+    ControlLoop(int64_t periodNs, OverrunPolicy policy = OVERRUN_SKIP,
+                int missesToDegrade = 3, int recoverCycles = 50) :
+                periodNs(periodNs), policy(policy),
+                missesToDegrade(missesToDegrade),
+                recoverCycles(recoverCycles), stats(), consecutiveMisses(0),
+                consecutiveMet(0), bStop(false), bStarted(false),
+                tfPersistent(NULL) {
+        pthread_mutex_init(&stats_mtx, NULL);
+        for (int p = 0; p < NUM_LOOP_PHASES; p++) {
+            budgetNs[p] = 0;
+        }
+    }
+
+    ~ControlLoop() {
+        stop();
+        pthread_mutex_destroy(&stats_mtx);
+        delete tfPersistent;
+    }
+
+    /**
+     * Adds a step to a phase. Call before run().
+     *
+     * @param optional Whether the step is shed while the loop is degraded.
+     */
+    void addStep(LoopPhase phase, const std::string& name, StepFunc fn,
+                 bool optional = false) {
+        Step s = {name, fn, optional};
+        steps[phase].push_back(s);
+    }
+
+    /**
+     * Adds a trigger-phase step calling readData() on a buffer.
+     */
+    template <class Buffer>
+    void addTrigger(Buffer* buf, const std::string& name = "readData") {
+        addStep(PHASE_TRIGGER, name, bind(&Buffer::readData, buf));
+    }
+
+    /**
+     * Sets the time a phase may take; 0 (the default) for no budget.
+     */
+    void setBudget(LoopPhase phase, int64_t ns) {
+        budgetNs[phase] = ns;
+    }
+
+    /**
+     * Sets the function told of degradation and recovery.
+     */
+    void setDegradeHandler(DegradeFunc fn) {
+        onDegrade = fn;
+    }
+
+    /**
+     * Runs cycles on the calling thread until stop() is called (from a step
+     * or from another thread).
+     */
+    void run() {
+        int64_t next = monotonicNs();
+        bool degraded = false;
+        while (!bStop.load(std::memory_order_relaxed)) {
+            sleepUntil(next);
+            bool met = runCycle(next, degraded);
+            next += periodNs;
+
+            if (met) {
+                consecutiveMisses = 0;
+                ++consecutiveMet;
+            } else {
+                consecutiveMet = 0;
+                ++consecutiveMisses;
+                if (policy == OVERRUN_SKIP) {
+                    int64_t now = monotonicNs();
+                    if (now > next) {
+                        int64_t behind = (now - next) / periodNs + 1;
+                        next += behind * periodNs;
+                        pthread_mutex_lock(&stats_mtx);
+                        stats.skipped += behind;
+                        pthread_mutex_unlock(&stats_mtx);
+                    }
+                }
+            }
+            if (!degraded && missesToDegrade > 0 &&
+                    consecutiveMisses >= missesToDegrade) {
+                degraded = true;
+                setDegraded(true);
+            } else if (degraded && consecutiveMet >= recoverCycles) {
+                degraded = false;
+                setDegraded(false);
+            }
+        }
+    }
+
+    /**
+     * Runs the loop on a thread of its own. Call only once.
+     */
+    void start() {
+        boost::function<void*()> thrFun = bind(&ControlLoop::loopMeth, this);
+        tfPersistent = new boost::function<void*()>(thrFun);
+        pthread_create(&loop_thread, NULL, &pthreadWrapper, tfPersistent);
+        bStarted = true;
+    }
+
+    /**
+     * Makes run() return after the current cycle. If the loop was started
+     * with start(), also waits for its thread to finish, unless called from
+     * a step of the loop itself.
+     */
+    void stop() {
+        bStop.store(true);
+        if (bStarted && !pthread_equal(pthread_self(), loop_thread)) {
+            pthread_join(loop_thread, NULL);
+            bStarted = false;
+        }
+    }
+
+    LoopStats getStats() {
+        pthread_mutex_lock(&stats_mtx);
+        LoopStats st = stats;
+        pthread_mutex_unlock(&stats_mtx);
+        return st;
+    }
+
+    /**
+     * Prints the cycle counts, the phase timings and the jitter histogram.
+     */
+    void report(std::ostream& os) {
+        static const char* phaseNames[] = {"trigger", "gather", "compute",
+                                           "emit"};
+        LoopStats st = getStats();
+        char line[160];
+        snprintf(line, sizeof(line), "%llu cycles of %.1f ms: %llu missed, "
+                 "%llu periods skipped, %llu steps shed%s",
+                 (unsigned long long) st.cycles, periodNs / 1e6,
+                 (unsigned long long) st.misses,
+                 (unsigned long long) st.skipped,
+                 (unsigned long long) st.shed,
+                 st.degraded ? " (degraded)" : "");
+        os << line << std::endl;
+        os << "phase      mean(us)   max(us) budget(us)  overruns"
+           << std::endl;
+        for (int p = 0; p < NUM_LOOP_PHASES; p++) {
+            if (st.phaseRuns[p] == 0) {
+                continue;
+            }
+            snprintf(line, sizeof(line), "%-8s %10.1f %9.1f %10.1f %9llu",
+                     phaseNames[p],
+                     st.phaseTotalNs[p] / 1000.0 / st.phaseRuns[p],
+                     st.phaseMaxNs[p] / 1000.0, budgetNs[p] / 1000.0,
+                     (unsigned long long) st.phaseOverruns[p]);
+            os << line << std::endl;
+        }
+        snprintf(line, sizeof(line), "wake-up jitter (max %.1f us):",
+                 st.maxJitterNs / 1000.0);
+        os << line << std::endl;
+        int last = NUM_JITTER_BUCKETS - 1;
+        while (last > 0 && st.jitter[last] == 0) {
+            --last;
+        }
+        for (int b = 0; b <= last; b++) {
+            char range[32];
+            if (b == 0) {
+                snprintf(range, sizeof(range), "< 1 us");
+            } else if (b == NUM_JITTER_BUCKETS - 1) {
+                snprintf(range, sizeof(range), ">= %d us", 1 << (b - 1));
+            } else {
+                snprintf(range, sizeof(range), "%d-%d us", 1 << (b - 1),
+                         1 << b);
+            }
+            snprintf(line, sizeof(line), "  %-14s %8llu", range,
+                     (unsigned long long) st.jitter[b]);
+            os << line << std::endl;
+        }
+    }
+};
+
+#endif
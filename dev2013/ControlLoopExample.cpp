@@ -0,0 +1,90 @@
+#include "BufferThreadedP.h"
+#include "ControlLoop.h"
+#include <iostream>
+
+using namespace std;
+
+/** Simulated IMU: a new reading every 2 ms. */
+class ImuSensor {
+    int n;
+
+    public:
+    ImuSensor() : n(0) {}
+
+    int getPacket() {
+        usleep(2000);
+        return ++n;
+    }
+};
+
+/**
+ * A controller whose planning every 100th cycle takes longer than the
+ * period, as a replanning step might.
+ */
+class Controller {
+    BufferThread<int, ImuSensor>* imu;
+    int latest;
+    long command;
+    int cycle;
+
+    static void spin(int64_t ns) {
+        int64_t until = monotonicNs() + ns;
+        while (monotonicNs() < until) {}
+    }
+
+    public:
+    Controller(BufferThread<int, ImuSensor>* imu) : imu(imu), latest(0),
+                                                    command(0), cycle(0) {}
+
+    void gather() {
+        latest = imu->getPacket();
+    }
+
+    void compute() {
+        ++cycle;
+        spin(cycle % 100 >= 95 ? 14000000 : 1000000);
+        command = latest * 3;
+    }
+
+    void emit() {
+        spin(200000);
+    }
+
+    void log() {
+        spin(1500000);
+    }
+
+    void degraded(bool on) {
+        cout << (on ? "Degraded" : "Recovered") << " at cycle " << cycle
+             << endl;
+    }
+};
+
+/**
+ * Runs a 100 Hz loop for three seconds with periodic compute overruns and
+ * prints its timing.
+ */
+int main(int argc, char** argv) {
+    ImuSensor sensor;
+    BufferThread<int, ImuSensor> imuBuf(&sensor);
+    imuBuf.setThreadName("imu");
+    imuBuf.spawnThreads();
+    Controller ctl(&imuBuf);
+
+    ControlLoop loop(10000000, OVERRUN_SKIP, 3, 20);
+    loop.addTrigger(&imuBuf);
+    loop.addStep(PHASE_GATHER, "gather", bind(&Controller::gather, &ctl));
+    loop.addStep(PHASE_COMPUTE, "control", bind(&Controller::compute, &ctl));
+    loop.addStep(PHASE_EMIT, "motors", bind(&Controller::emit, &ctl));
+    loop.addStep(PHASE_EMIT, "log", bind(&Controller::log, &ctl), true);
+    loop.setBudget(PHASE_GATHER, 3000000);
+    loop.setBudget(PHASE_COMPUTE, 5000000);
+    loop.setBudget(PHASE_EMIT, 2000000);
+    loop.setDegradeHandler(bind(&Controller::degraded, &ctl, _1));
+
+    loop.start();
+    usleep(3000000);
+    loop.stop();
+    loop.report(cout);
+    return 0;
+}
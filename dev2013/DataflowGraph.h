@@ -0,0 +1,682 @@
+#include <pthread.h>
+#include <boost/function.hpp>
+#include <boost/bind.hpp>
+#include <atomic>
+#include <cstdio>
+#include <map>
+#include <ostream>
+#include <string>
+#include <typeinfo>
+#include <vector>
+#include <stdint.h>
+
+#include "BufferThreadedP.h"
+#include "ThreadAccounting.h"
+
+using boost::function;
+using boost::bind;
+
+// Header guards -- this file may be included more than once.
+#ifndef DATAFLOWGRAPH_H_
+#define DATAFLOWGRAPH_H_
+
+/**
+ * How an edge queues packets for its consumer.
+ */
+enum EdgePolicy {
+    AUTO_POLICY, /**< Let the graph choose, from the consumer's cost */
+    LATEST,      /**< Keep only the newest packet (conflate) */
+    FIFO         /**< Keep every packet, up to a capacity */
+};
+
+/**
+ * How expensive a processing stage is; decides its thread assignment.
+ */
+enum NodeCost {
+    CHEAP, /**< Shares one thread with the other cheap stages */
+    HEAVY  /**< Gets a thread of its own */
+};
+
+/**
+ * Throughput and latency of one edge of a DataflowGraph.
+ */
+struct EdgeStats {
+    std::string from;
+    std::string to;
+    EdgePolicy policy;
+    uint64_t pushed;        /**< Packets the producer put on the edge */
+    uint64_t dropped;       /**< Packets overwritten before being taken */
+    uint64_t popped;        /**< Packets the consumer took */
+    double ratePerSec;      /**< Packets taken per second since start() */
+    int64_t meanLatencyNs;  /**< Mean time from push to pop */
+    int64_t maxLatencyNs;
+};
+
+/**
+ * Untyped part of an edge.
+ */
+class EdgeBase {
+
+    protected:
+    std::atomic<uint64_t> pushed;
+    std::atomic<uint64_t> dropped;
+    std::atomic<uint64_t> popped;
+    std::atomic<int64_t> latencyNs;
+    std::atomic<int64_t> maxLatencyNs;
+
+    public:
+    std::string from;
+    std::string to;
+    EdgePolicy policy;
+
+    EdgeBase() : pushed(0), dropped(0), popped(0), latencyNs(0),
+                 maxLatencyNs(0), policy(FIFO) {}
+
+    virtual ~EdgeBase() {}
+
+    EdgeStats getStats(int64_t elapsedNs) {
+        EdgeStats st;
+        st.from = from;
+        st.to = to;
+        st.policy = policy;
+        st.pushed = pushed.load(std::memory_order_relaxed);
+        st.dropped = dropped.load(std::memory_order_relaxed);
+        st.popped = popped.load(std::memory_order_relaxed);
+        st.ratePerSec = elapsedNs > 0 ? st.popped * 1e9 / elapsedNs : 0;
+        st.meanLatencyNs = st.popped > 0 ?
+            latencyNs.load(std::memory_order_relaxed) / (int64_t) st.popped :
+            0;
+        st.maxLatencyNs = maxLatencyNs.load(std::memory_order_relaxed);
+        return st;
+    }
+};
+
+/**
+ * A typed edge: a small ring of packets between one producer and one
+ * consumer. When the ring is full the oldest packet is overwritten, so
+ * producers (sensors, mostly) are never blocked; a LATEST edge is simply a
+ * ring of one. Every push wakes up the consumer's thread.
+ */
+template <class Packet>
+class Edge : public EdgeBase {
+
+    private:
+    pthread_mutex_t mtx;
+    std::vector<Packet> ring;
+    std::vector<int64_t> stamps;
+    size_t head;
+    size_t len;
+    FutexEvent* wake;
+
+    Edge(const Edge&);
+    Edge& operator=(const Edge&);
+
+    public:
+    Edge(size_t capacity, FutexEvent* wake) :
+         ring(capacity > 0 ? capacity : 1), stamps(ring.size()), head(0),
+         len(0), wake(wake) {
+        pthread_mutex_init(&mtx, NULL);
+    }
+
+    ~Edge() {
+        pthread_mutex_destroy(&mtx);
+    }
+
+    void push(const Packet& pkt) {
+        pthread_mutex_lock(&mtx);
+        if (len == ring.size()) {
+            head = (head + 1) % ring.size();
+            --len;
+            dropped.fetch_add(1, std::memory_order_relaxed);
+        }
+        size_t pos = (head + len) % ring.size();
+        ring[pos] = pkt;
+        stamps[pos] = monotonicNs();
+        ++len;
+        pthread_mutex_unlock(&mtx);
+        pushed.fetch_add(1, std::memory_order_relaxed);
+        wake->notifyOne();
+    }
+
+    bool pop(Packet& out) {
+        pthread_mutex_lock(&mtx);
+        if (len == 0) {
+            pthread_mutex_unlock(&mtx);
+            return false;
+        }
+        out = std::move(ring[head]);
+        int64_t latency = monotonicNs() - stamps[head];
+        head = (head + 1) % ring.size();
+        --len;
+        pthread_mutex_unlock(&mtx);
+
+        popped.fetch_add(1, std::memory_order_relaxed);
+        latencyNs.fetch_add(latency, std::memory_order_relaxed);
+        if (latency > maxLatencyNs.load(std::memory_order_relaxed)) {
+            maxLatencyNs.store(latency, std::memory_order_relaxed);
+        }
+        return true;
+    }
+};
+
+/**
+ * A node of a DataflowGraph. Sources and stages differ in what they do
+ * when started and whether they have an input.
+ */
+class GraphNode {
+
+    private:
+    std::string name;
+
+    GraphNode(const GraphNode&);
+    GraphNode& operator=(const GraphNode&);
+
+    public:
+    GraphNode(const std::string& name) : name(name) {}
+
+    virtual ~GraphNode() {}
+
+    const std::string& getName() {
+        return name;
+    }
+
+    /** Name of the node feeding this one; empty for sources. */
+    virtual std::string getInputName() {
+        return std::string();
+    }
+
+    virtual NodeCost getCost() {
+        return CHEAP;
+    }
+
+    /** Connects an edge to this node's output; false on a type mismatch. */
+    virtual bool attachOutput(EdgeBase* edge) = 0;
+
+    /** Makes this node's (typed) input edge. Stages only. */
+    virtual EdgeBase* makeInputEdge(size_t capacity, FutexEvent* wake) {
+        return NULL;
+    }
+
+    /** Processes one input packet, if there is one. Stages only. */
+    virtual bool step() {
+        return false;
+    }
+
+    /** Starts the node's own threads, if it has any. */
+    virtual void start() {}
+
+    /** Stops the node's own threads, if it has any. */
+    virtual void stop() {}
+};
+
+/**
+ * A node producing packets of type Out: fans them out to its edges and keeps
+ * the latest one for direct readers.
+ */
+template <class Out>
+class OutputNode : public GraphNode {
+
+    private:
+    std::vector<Edge<Out>*> outputs;
+    MutexPolicy::Cell<Out> latest;
+    std::atomic<uint64_t> version;
+
+    public:
+    OutputNode(const std::string& name) : GraphNode(name), version(0) {}
+
+    bool attachOutput(EdgeBase* edge) {
+        Edge<Out>* typed = dynamic_cast<Edge<Out>*>(edge);
+        if (typed == NULL) {
+            return false;
+        }
+        outputs.push_back(typed);
+        return true;
+    }
+
+    void emit(const Out& pkt) {
+        for (size_t i = 0; i < outputs.size(); i++) {
+            outputs[i]->push(pkt);
+        }
+        Out copy(pkt);
+        latest.store(copy);
+        version.fetch_add(1, std::memory_order_release);
+    }
+
+    bool getLatest(Out& out) {
+        if (version.load(std::memory_order_acquire) == 0) {
+            return false;
+        }
+        latest.load(out);
+        return true;
+    }
+};
+
+/**
+ * A sensor: a BufferThread in continuous mode whose publications are fanned
+ * out to the edges.
+ */
+template <class Packet, class Interface>
+class SourceNode : public OutputNode<Packet> {
+
+    private:
+    BufferThread<Packet, Interface>* buffer;
+    Interface* source;
+
+    void published(const Packet& pkt, uint64_t) {
+        this->emit(pkt);
+    }
+
+    public:
+    SourceNode(const std::string& name, Interface* source) :
+               OutputNode<Packet>(name), buffer(NULL), source(source) {}
+
+    ~SourceNode() {
+        stop();
+    }
+
+    void start() {
+        buffer = new BufferThread<Packet, Interface>(source);
+        buffer->setPublishHook(bind(&SourceNode::published, this, _1, _2));
+        buffer->setThreadName(this->getName());
+        buffer->runContinuous();
+    }
+
+    void stop() {
+        delete buffer;
+        buffer = NULL;
+    }
+};
+
+/**
+ * A processing stage: takes packets from its input edge, runs them through
+ * `Out Stage::runProcess(In&)` (the same interface IOBuffer uses) on the
+ * thread the graph assigned it, and emits the results.
+ */
+template <class In, class Out, class Stage>
+class StageNode : public OutputNode<Out> {
+
+    private:
+    Stage* stage;
+    std::string inputName;
+    NodeCost cost;
+    Edge<In>* input;
+    In ipkt;
+
+    public:
+    StageNode(const std::string& name, Stage* stage,
+              const std::string& inputName, NodeCost cost) :
+              OutputNode<Out>(name), stage(stage), inputName(inputName),
+              cost(cost), input(NULL), ipkt() {}
+
+    ~StageNode() {
+        delete input;
+    }
+
+    std::string getInputName() {
+        return inputName;
+    }
+
+    NodeCost getCost() {
+        return cost;
+    }
+
+    EdgeBase* makeInputEdge(size_t capacity, FutexEvent* wake) {
+        input = new Edge<In>(capacity, wake);
+        return input;
+    }
+
+    bool step() {
+        if (input == NULL || !input->pop(ipkt)) {
+            return false;
+        }
+        this->emit(stage->runProcess(ipkt));
+        return true;
+    }
+};
+
+/**
+ * A runtime-wired dataflow graph of sensors and processing stages.
+ *
+ * The graph is described by name: sources are sensor interfaces (anything
+ * with `Packet getPacket()`), stages are processing steps (anything with
+ * `Out runProcess(In&)`) that name the node they take their input from.
+ * start() then checks the description, wires it up and runs it:
+ *
+ *   - every source becomes a BufferThread in continuous mode;
+ *   - every stage gets a typed input edge from the node it names; the packet
+ *     types must match (checked at start(), since the wiring is by name);
+ *   - HEAVY stages get a thread each, so they run in parallel; all CHEAP
+ *     stages share one thread, which saves the context switches;
+ *   - edges into HEAVY stages keep only the latest packet, so a slow stage
+ *     always works on fresh data instead of a growing backlog; edges into
+ *     CHEAP stages are FIFOs, so they see every packet. Either can be
+ *     overridden per stage;
+ *   - nodes are started in topological order, producers before consumers.
+ *
+ * A node can feed any number of stages. Per-edge throughput and latency are
+ * available from getEdgeStats() and report(). The graph cannot be changed
+ * once started; it stops when destroyed. Interfaces and stages must outlive
+ * the graph.
+ *
+ * Usage:
+ *
+ *     DataflowGraph g;
+ *     g.addSource<ImuPacket>("imu", &imuIface);
+ *     g.addStage<ImuPacket, Pose>("ekf", &ekf, "imu", HEAVY);
+ *     g.addStage<Pose, Command>("control", &controller, "ekf");
+ *     if (!g.start()) {
+ *         cerr << g.getError() << endl;
+ *     }
+ *     g.report(cout);
+ */
+class DataflowGraph {
+
+    private:
+    /**
+     * A thread running one or more stages.
+     */
+    struct Worker {
+        std::string name;
+        std::vector<GraphNode*> stages;
+        FutexEvent evt;
+        pthread_t thread;
+        function<void*()>* tfPersistent;
+    };
+
+    /**
+     * How a stage wants its input edge.
+     */
+    struct EdgeSpec {
+        EdgePolicy policy;
+        size_t capacity;
+    };
+
+    std::vector<GraphNode*> nodes; // In order of declaration
+    std::map<std::string, GraphNode*> byName;
+    std::map<std::string, EdgeSpec> edgeSpecs;
+    std::vector<GraphNode*> startOrder;
+    std::vector<EdgeBase*> edges;
+    std::vector<Worker*> workers;
+    std::atomic<bool> bStop;
+    bool bStarted;
+    int64_t startNs;
+    std::string error;
+
+    DataflowGraph(const DataflowGraph&);
+    DataflowGraph& operator=(const DataflowGraph&);
+
+    void addNode(GraphNode* node) {
+        if (byName.count(node->getName()) != 0) {
+            error = "duplicate node " + node->getName();
+        }
+        nodes.push_back(node);
+        byName[node->getName()] = node;
+    }
+
+    /**
+     * Orders the nodes so that every node comes after its input (Kahn's
+     * algorithm). Fails on unknown inputs and cycles.
+     */
+    bool sortNodes() {
+        std::map<std::string, int> pending;
+        std::map<std::string, std::vector<GraphNode*> > consumers;
+        std::vector<GraphNode*> ready;
+        for (size_t i = 0; i < nodes.size(); i++) {
+            std::string in = nodes[i]->getInputName();
+            if (in.empty()) {
+                ready.push_back(nodes[i]);
+            } else if (byName.count(in) == 0) {
+                error = nodes[i]->getName() + ": unknown input " + in;
+                return false;
+            } else {
+                consumers[in].push_back(nodes[i]);
+            }
+        }
+        for (size_t i = 0; i < ready.size(); i++) {
+            startOrder.push_back(ready[i]);
+            std::vector<GraphNode*>& next = consumers[ready[i]->getName()];
+            ready.insert(ready.end(), next.begin(), next.end());
+        }
+        if (startOrder.size() != nodes.size()) {
+            error = "the graph has a cycle";
+            startOrder.clear();
+            return false;
+        }
+        return true;
+    }
+
+    void startWorker(Worker* w) {
+        function<void*()> thrFun = bind(&DataflowGraph::workerMeth, this, w);
+        w->tfPersistent = new function<void*()>(thrFun);
+        pthread_create(&w->thread, NULL, &pthreadWrapper, w->tfPersistent);
+    }
+
+    public:
+    DataflowGraph() : bStop(false), bStarted(false), startNs(0) {}
+
+    ~DataflowGraph() {
+        // Sources first, so that nothing is pushed any more.
+        for (size_t i = 0; i < startOrder.size(); i++) {
+            startOrder[i]->stop();
+        }
+        bStop.store(true);
+        for (size_t i = 0; i < workers.size(); i++) {
+            workers[i]->evt.notifyAll();
+            pthread_join(workers[i]->thread, NULL);
+            delete workers[i]->tfPersistent;
+            delete workers[i];
+        }
+        for (size_t i = 0; i < nodes.size(); i++) {
+            delete nodes[i];
+        }
+    }
+
+    /**
+     * Declares a sensor.
+     *
+     * @param name Unique node name.
+     * @param source The interface; provides `Packet getPacket()`.
+     */
+    template <class Packet, class Interface>
+    void addSource(const std::string& name, Interface* source) {
+        addNode(new SourceNode<Packet, Interface>(name, source));
+    }
+
+    /**
+     * Declares a processing stage.
+     *
+     * @param name Unique node name.
+     * @param stage The stage; provides `Out runProcess(In&)`.
+     * @param input Name of the node whose packets (of type In) it takes.
+     * @param cost Decides the thread assignment and, by default, the edge
+     *        policy.
+     * @param policy Overrides the edge policy.
+     * @param capacity Capacity of a FIFO input edge.
+     */
+    template <class In, class Out, class Stage>
+    void addStage(const std::string& name, Stage* stage,
+                  const std::string& input, NodeCost cost = CHEAP,
+                  EdgePolicy policy = AUTO_POLICY, size_t capacity = 16) {
+        addNode(new StageNode<In, Out, Stage>(name, stage, input, cost));
+        EdgeSpec spec = {policy, capacity};
+        edgeSpecs[name] = spec;
+    }
+
+    /**
+     * Checks and wires up the graph, then starts it. Call only once.
+     *
+     * @return False, with nothing started, if the description is wrong;
+     *         getError() tells why.
+     */
+    bool start() {
+        if (bStarted || !error.empty() || !sortNodes()) {
+            return false;
+        }
+
+        // Thread assignment.
+        Worker* shared = NULL;
+        std::map<GraphNode*, Worker*> workerOf;
+        for (size_t i = 0; i < startOrder.size(); i++) {
+            GraphNode* n = startOrder[i];
+            if (n->getInputName().empty()) {
+                continue;
+            }
+            Worker* w;
+            if (n->getCost() == HEAVY) {
+                w = new Worker();
+                w->name = "graph:" + n->getName();
+                workers.push_back(w);
+            } else {
+                if (shared == NULL) {
+                    shared = new Worker();
+                    shared->name = "graph:cheap";
+                    workers.push_back(shared);
+                }
+                w = shared;
+            }
+            w->stages.push_back(n);
+            workerOf[n] = w;
+        }
+
+        // Edges.
+        for (size_t i = 0; i < startOrder.size(); i++) {
+            GraphNode* n = startOrder[i];
+            std::string in = n->getInputName();
+            if (in.empty()) {
+                continue;
+            }
+            EdgeSpec spec = edgeSpecs[n->getName()];
+            if (spec.policy == AUTO_POLICY) {
+                spec.policy = n->getCost() == HEAVY ? LATEST : FIFO;
+            }
+            EdgeBase* e = n->makeInputEdge(
+                spec.policy == LATEST ? 1 : spec.capacity,
+                &workerOf[n]->evt);
+            e->from = in;
+            e->to = n->getName();
+            e->policy = spec.policy;
+            edges.push_back(e);
+            if (!byName[in]->attachOutput(e)) {
+                error = n->getName() + ": packet type does not match the "
+                    "output of " + in;
+                for (size_t j = 0; j < workers.size(); j++) {
+                    delete workers[j];
+                }
+                workers.clear();
+                return false;
+            }
+        }
+
+        startNs = monotonicNs();
+        bStarted = true;
+        for (size_t i = 0; i < workers.size(); i++) {
+            startWorker(workers[i]);
+        }
+        for (size_t i = 0; i < startOrder.size(); i++) {
+            startOrder[i]->start();
+        }
+        return true;
+    }
+
+    /**
+     * Why start() failed.
+     */
+    const std::string& getError() {
+        return error;
+    }
+
+    /**
+     * The node names in the order they were started.
+     */
+    std::vector<std::string> getStartOrder() {
+        std::vector<std::string> names;
+        for (size_t i = 0; i < startOrder.size(); i++) {
+            names.push_back(startOrder[i]->getName());
+        }
+        return names;
+    }
+
+    /**
+     * The number of threads running stages (sources have one each on top).
+     */
+    int getNumWorkers() {
+        return workers.size();
+    }
+
+    /**
+     * Reads the latest packet a node produced.
+     *
+     * @return False if there is no such node, it produces another packet
+     *         type, or it has not produced anything yet.
+     */
+    template <class Packet>
+    bool getLatest(const std::string& name, Packet* out) {
+        std::map<std::string, GraphNode*>::iterator it = byName.find(name);
+        if (it == byName.end()) {
+            return false;
+        }
+        OutputNode<Packet>* n = dynamic_cast<OutputNode<Packet>*>(it->second);
+        return n != NULL && n->getLatest(*out);
+    }
+
+    /**
+     * Throughput and latency of every edge.
+     */
+    std::vector<EdgeStats> getEdgeStats() {
+        std::vector<EdgeStats> st;
+        int64_t elapsed = bStarted ? monotonicNs() - startNs : 0;
+        for (size_t i = 0; i < edges.size(); i++) {
+            st.push_back(edges[i]->getStats(elapsed));
+        }
+        return st;
+    }
+
+    /**
+     * Prints the edge statistics as a table.
+     */
+    void report(std::ostream& os) {
+        std::vector<EdgeStats> st = getEdgeStats();
+        os << "edge                      policy    pushed   dropped    rate/s"
+            "   mean(us)    max(us)" << std::endl;
+        for (size_t i = 0; i < st.size(); i++) {
+            std::string name = st[i].from + " -> " + st[i].to;
+            name.resize(24, ' ');
+            char line[128];
+            snprintf(line, sizeof(line), "%s  %-6s %9llu %9llu %9.1f %10.1f "
+                     "%10.1f", name.c_str(),
+                     st[i].policy == LATEST ? "latest" : "fifo",
+                     (unsigned long long) st[i].pushed,
+                     (unsigned long long) st[i].dropped, st[i].ratePerSec,
+                     st[i].meanLatencyNs / 1000.0,
+                     st[i].maxLatencyNs / 1000.0);
+            os << line << std::endl;
+        }
+    }
+
+    /**
+     * The stage thread function: runs the thread's stages until none has
+     * input left, then sleeps until an edge is pushed to.
+     *
+     * It is called from an external wrapper function.
+     */
+    void* workerMeth(Worker* w) {
+        ThreadRegistration reg(w->name);
+        while (true) {
+            uint32_t key = w->evt.prepareWait();
+            if (bStop.load()) {
+                return NULL;
+            }
+            bool worked = false;
+            for (size_t i = 0; i < w->stages.size(); i++) {
+                while (w->stages[i]->step()) {
+                    worked = true;
+                }
+            }
+            if (!worked) {
+                w->evt.wait(key);
+            }
+        }
+    }
+};
+
+#endif
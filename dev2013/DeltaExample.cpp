@@ -0,0 +1,104 @@
+#include "BufferThreadedP.h"
+#include "DeltaTracker.h"
+#include <cstdlib>
+#include <iostream>
+#include <time.h>
+
+using namespace std;
+
+typedef vector<float> Scan;
+
+/**
+ * Simulated laser scanner looking at a mostly static scene: each scan
+ * differs from the previous one in a few beams only.
+ */
+class ScanInterface {
+    Scan scan;
+    unsigned int seed;
+
+    public:
+    ScanInterface(size_t numBeams) : scan(numBeams, 10.0f), seed(1) {}
+
+    Scan getPacket() {
+        usleep(2000);
+        size_t start = rand_r(&seed) % scan.size();
+        size_t len = 1 + rand_r(&seed) % 12;
+        for (size_t i = start; i < start + len && i < scan.size(); i++) {
+            scan[i] = 0.5f + (rand_r(&seed) % 1000) / 100.0f;
+        }
+        return scan;
+    }
+};
+
+/**
+ * An incremental consumer keeping a mirror of a 1080-beam scan up to date
+ * through DeltaTracker, compared with copying the whole scan every time.
+ */
+int main() {
+    const size_t numBeams = 1080;
+    ScanInterface iface(numBeams);
+    BufferThread<Scan, ScanInterface> buf(&iface);
+    DeltaTracker<Scan> delta;
+    buf.setPublishHook(bind(&DeltaTracker<Scan>::record, &delta, _1, _2));
+    buf.runContinuous();
+
+    Scan mirror;
+    buf.waitForVersion(0);
+    uint64_t held = delta.getSnapshot(mirror);
+    long updates = 0;
+    long elements = 0;
+    long fullDeltas = 0;
+    PacketDelta<float> d;
+    int64_t end = monotonicNs() + 1000000000LL;
+    while (monotonicNs() < end) {
+        buf.waitForVersion(held, 100);
+        delta.getChangesSince(held, d);
+        if (d.toVersion == held) {
+            continue;
+        }
+        held = DeltaTracker<Scan>::apply(mirror, d);
+        ++updates;
+        elements += d.numElements();
+        if (d.full) {
+            ++fullDeltas;
+        }
+    }
+
+    // Catch up once more and compare with the latest scan.
+    Scan latest;
+    uint64_t latestVersion;
+    do {
+        delta.getChangesSince(held, d);
+        held = DeltaTracker<Scan>::apply(mirror, d);
+        latestVersion = delta.getSnapshot(latest);
+    } while (latestVersion != held);
+
+    cout << updates << " updates, " << fullDeltas << " full" << endl;
+    cout << "elements copied: " << elements << " with deltas, " <<
+        updates * (long) numBeams << " with full copies" << endl;
+    cout << "mirror " << (mirror == latest ? "matches" : "DOES NOT match") <<
+        " version " << held << endl;
+
+    // Marks reaching past the end of the scan, lying entirely beyond it or
+    // inverted must only ever yield the part that is really in the scan.
+    DeltaTracker<Scan> marks;
+    Scan scan(numBeams, 1.0f);
+    marks.record(scan, 1);
+    Scan marked;
+    marks.getSnapshot(marked);
+    for (size_t i = numBeams - 5; i < numBeams; i++) {
+        scan[i] = 2.0f;
+    }
+    marks.markDirty(numBeams - 5, numBeams + 100);
+    marks.markDirty(numBeams + 10, numBeams + 20);
+    marks.markDirty(20, 10);
+    marks.record(scan, 2);
+    marks.getChangesSince(1, d);
+    DeltaTracker<Scan>::apply(marked, d);
+    bool marksOk = d.ranges.size() == 1 && d.numElements() == 5 &&
+                   marked == scan;
+    cout << "out-of-range marks: " << d.ranges.size() << " range(s), " <<
+        d.numElements() << " elements, " << (marksOk ? "ok" : "WRONG") <<
+        endl;
+    return mirror == latest && marksOk ? 0 : 1;
+}
@@ -0,0 +1,371 @@
+#include <pthread.h>
+#include <algorithm>
+#include <utility>
+#include <vector>
+#include <stdint.h>
+
+// Header guards -- this file may be included more than once.
+#ifndef DELTATRACKER_H_
+#define DELTATRACKER_H_
+
+/**
+ * Describes how to view a packet as an array of elements, for DeltaTracker.
+ * Specialize it for packets that are (or contain) an array, such as a scan
+ * of range readings or an occupancy grid:
+ *
+ *     template <> struct PacketArrayTraits<LidarPacket> {
+ *         typedef float Element;
+ *         static size_t size(const LidarPacket& p) { return p.numBeams(); }
+ *         static const float* data(const LidarPacket& p) {
+ *             return p.ranges();
+ *         }
+ *         static float* data(LidarPacket& p) { return p.ranges(); }
+ *         static void resize(LidarPacket& p, size_t n) { p.setNumBeams(n); }
+ *     };
+ *
+ * Elements must be copyable and comparable with ==. A specialization for
+ * std::vector is provided.
+ */
+template <class Packet>
+struct PacketArrayTraits;
+
+template <class T>
+struct PacketArrayTraits<std::vector<T> > {
+    typedef T Element;
+
+    static size_t size(const std::vector<T>& p) {
+        return p.size();
+    }
+
+    static const T* data(const std::vector<T>& p) {
+        return p.data();
+    }
+
+    static T* data(std::vector<T>& p) {
+        return p.data();
+    }
+
+    static void resize(std::vector<T>& p, size_t n) {
+        p.resize(n);
+    }
+};
+
+/**
+ * A run of changed elements, [begin, begin + values.size()).
+ */
+template <class Element>
+struct DeltaRange {
+    size_t begin;
+    std::vector<Element> values;
+};
+
+/**
+ * The changes between two versions of an array packet, as returned by
+ * DeltaTracker::getChangesSince().
+ */
+template <class Element>
+struct PacketDelta {
+    uint64_t fromVersion; /**< The version the changes apply to */
+    uint64_t toVersion;   /**< The version they bring it up to */
+    bool full;            /**< Whether the delta is the whole array */
+    size_t size;          /**< Number of elements at toVersion */
+    std::vector<DeltaRange<Element> > ranges;
+
+    /** Number of elements carried by the delta. */
+    size_t numElements() const {
+        size_t n = 0;
+        for (size_t i = 0; i < ranges.size(); i++) {
+            n += ranges[i].values.size();
+        }
+        return n;
+    }
+};
+
+/**
+ * Records which ranges of an array packet changed in each published version,
+ * so that incremental consumers (and remote mirrors) can ask for only the
+ * elements that changed since the version they already have, instead of
+ * copying the whole packet every time.
+ *
+ * The tracker is fed by the buffer's updater thread through the publish hook
+ * (see BufferThread::setPublishHook()):
+ *
+ *     DeltaTracker<Scan> delta;
+ *     buf.setPublishHook(bind(&DeltaTracker<Scan>::record, &delta, _1, _2));
+ *     ...
+ *     Scan mirror;
+ *     uint64_t v = delta.getSnapshot(mirror);
+ *     ...
+ *     PacketDelta<float> d;
+ *     delta.getChangesSince(v, d);
+ *     v = DeltaTracker<Scan>::apply(mirror, d);
+ *
+ * By default record() finds the changed ranges by comparing each packet with
+ * the previous one. A writer that knows what it changed can say so with
+ * markDirty() before publishing, which skips the comparison.
+ *
+ * The ranges of the last historyDepth versions are kept. A reader further
+ * behind than that, or whose version saw a size change, gets the whole
+ * array (PacketDelta::full). Runs of changes separated by fewer than
+ * mergeGap unchanged elements are sent as one range, and a version with
+ * more than maxRanges ranges is recorded as a full change.
+ *
+ * Readers and the writer share one mutex. Readers hold it while copying the
+ * changed elements, so the writer waits at most for the largest delta being
+ * copied, never for the consumers' processing.
+ */
+template <class Packet, class Traits = PacketArrayTraits<Packet> >
+class DeltaTracker {
+
+    public:
+    typedef typename Traits::Element Element;
+
+    private:
+    /**
+     * The dirty ranges of one version, as [begin, end) pairs.
+     */
+    struct VersionRanges {
+        uint64_t version;
+        bool full;
+        std::vector<std::pair<size_t, size_t> > ranges;
+    };
+
+    pthread_mutex_t mtx;
+    std::vector<Element> current;  // The array at the latest version
+    uint64_t version;
+    std::vector<VersionRanges> history; // Ring, indexed by version % depth
+    size_t mergeGap;
+    size_t maxRanges;
+    std::vector<std::pair<size_t, size_t> > marked; // From markDirty()
+    pthread_mutex_t mark_mtx;
+
+    DeltaTracker(const DeltaTracker&);
+    DeltaTracker& operator=(const DeltaTracker&);
+
+    /**
+     * Appends [begin, end) to a sorted list of ranges, merging it with the
+     * last range if the gap between them is small.
+     */
+    void addRange(std::vector<std::pair<size_t, size_t> >& ranges,
+                  size_t begin, size_t end) {
+        if (!ranges.empty() && begin <= ranges.back().second + mergeGap) {
+            ranges.back().second = std::max(ranges.back().second, end);
+        } else {
+            ranges.push_back(std::make_pair(begin, end));
+        }
+    }
+
+    /** Sorts and merges a list of ranges in place. */
+    void normalize(std::vector<std::pair<size_t, size_t> >& ranges) {
+        std::sort(ranges.begin(), ranges.end());
+        std::vector<std::pair<size_t, size_t> > merged;
+        for (size_t i = 0; i < ranges.size(); i++) {
+            addRange(merged, ranges[i].first, ranges[i].second);
+        }
+        ranges.swap(merged);
+    }
+
+    public:
+    /**
+     * @param historyDepth Number of versions whose ranges are kept.
+     * @param mergeGap Unchanged elements that may be sent along to join two
+     *        neighbouring ranges.
+     * @param maxRanges Ranges per version beyond which the version counts
+     *        as a full change.
+     */
+    DeltaTracker(size_t historyDepth = 64, size_t mergeGap = 8,
+                 size_t maxRanges = 256) :
+                 version(0), history(historyDepth > 0 ? historyDepth : 1),
+                 mergeGap(mergeGap), maxRanges(maxRanges) {
+        pthread_mutex_init(&mtx, NULL);
+        pthread_mutex_init(&mark_mtx, NULL);
+        for (size_t i = 0; i < history.size(); i++) {
+            history[i].version = 0;
+            history[i].full = true;
+        }
+    }
+
+    ~DeltaTracker() {
+        pthread_mutex_destroy(&mtx);
+        pthread_mutex_destroy(&mark_mtx);
+    }
+
+    /**
+     * Tells the tracker that elements [begin, end) will change in the next
+     * recorded version. If any range is marked, record() trusts the marks
+     * and does not compare the packet with the previous one. Empty or
+     * inverted ranges are ignored; ranges reaching past the end of the
+     * packet are cut off at record().
+     */
+    void markDirty(size_t begin, size_t end) {
+        if (begin >= end) {
+            return;
+        }
+        pthread_mutex_lock(&mark_mtx);
+        marked.push_back(std::make_pair(begin, end));
+        pthread_mutex_unlock(&mark_mtx);
+    }
+
+    /**
+     * Records a newly published packet. Meant to be the buffer's publish
+     * hook; called by the updater thread only.
+     *
+     * @param pkt The packet being published.
+     * @param ver Its version; versions must increase.
+     */
+    void record(const Packet& pkt, uint64_t ver) {
+        size_t n = Traits::size(pkt);
+        const Element* data = Traits::data(pkt);
+
+        std::vector<std::pair<size_t, size_t> > ranges;
+        pthread_mutex_lock(&mark_mtx);
+        ranges.swap(marked);
+        pthread_mutex_unlock(&mark_mtx);
+
+        pthread_mutex_lock(&mtx);
+        bool full = version == 0 || n != current.size();
+        if (full) {
+            current.assign(data, data + n);
+            ranges.clear();
+        } else if (!ranges.empty()) {
+            // Clip the marks to the packet; marks past its end change
+            // nothing.
+            std::vector<std::pair<size_t, size_t> > clipped;
+            for (size_t r = 0; r < ranges.size(); r++) {
+                size_t begin = std::min(ranges[r].first, n);
+                size_t end = std::min(ranges[r].second, n);
+                if (begin < end) {
+                    clipped.push_back(std::make_pair(begin, end));
+                }
+            }
+            ranges.swap(clipped);
+            normalize(ranges);
+            for (size_t r = 0; r < ranges.size(); r++) {
+                for (size_t i = ranges[r].first; i < ranges[r].second; i++) {
+                    current[i] = data[i];
+                }
+            }
+        } else {
+            size_t i = 0;
+            while (i < n) {
+                if (current[i] == data[i]) {
+                    ++i;
+                    continue;
+                }
+                size_t begin = i;
+                while (i < n && !(current[i] == data[i])) {
+                    current[i] = data[i];
+                    ++i;
+                }
+                addRange(ranges, begin, i);
+            }
+        }
+        if (ranges.size() > maxRanges) {
+            full = true;
+            ranges.clear();
+        }
+
+        VersionRanges& vr = history[ver % history.size()];
+        vr.version = ver;
+        vr.full = full;
+        vr.ranges.swap(ranges);
+        version = ver;
+        pthread_mutex_unlock(&mtx);
+    }
+
+    /**
+     * The latest recorded version.
+     */
+    uint64_t getVersion() {
+        pthread_mutex_lock(&mtx);
+        uint64_t v = version;
+        pthread_mutex_unlock(&mtx);
+        return v;
+    }
+
+    /**
+     * Copies the whole array at the latest recorded version, as a starting
+     * point for getChangesSince().
+     *
+     * @return The version of the copy.
+     */
+    uint64_t getSnapshot(Packet& out) {
+        pthread_mutex_lock(&mtx);
+        Traits::resize(out, current.size());
+        std::copy(current.begin(), current.end(), Traits::data(out));
+        uint64_t v = version;
+        pthread_mutex_unlock(&mtx);
+        return v;
+    }
+
+    /**
+     * Collects the elements that changed after version since, with their
+     * values at the latest recorded version.
+     *
+     * @param since The version the caller has; 0 if it has nothing.
+     * @param out Receives the changes. If out.toVersion == since, nothing
+     *        changed.
+     */
+    void getChangesSince(uint64_t since, PacketDelta<Element>& out) {
+        out.ranges.clear();
+        pthread_mutex_lock(&mtx);
+        out.fromVersion = since;
+        out.toVersion = version;
+        out.size = current.size();
+        out.full = false;
+        if (since >= version) {
+            pthread_mutex_unlock(&mtx);
+            return;
+        }
+
+        std::vector<std::pair<size_t, size_t> > ranges;
+        if (since == 0 || version - since > history.size()) {
+            out.full = true;
+        } else {
+            for (uint64_t v = since + 1; v <= version; v++) {
+                const VersionRanges& vr = history[v % history.size()];
+                if (vr.version != v || vr.full) {
+                    out.full = true;
+                    break;
+                }
+                ranges.insert(ranges.end(), vr.ranges.begin(),
+                              vr.ranges.end());
+            }
+        }
+        if (out.full) {
+            ranges.assign(1, std::make_pair(size_t(0), current.size()));
+        } else {
+            normalize(ranges);
+        }
+
+        out.ranges.resize(ranges.size());
+        for (size_t r = 0; r < ranges.size(); r++) {
+            out.ranges[r].begin = ranges[r].first;
+            out.ranges[r].values.assign(current.begin() + ranges[r].first,
+                                        current.begin() + ranges[r].second);
+        }
+        pthread_mutex_unlock(&mtx);
+    }
+
+    /**
+     * Applies a delta to a copy of the packet held by a consumer.
+     *
+     * @param mirror The consumer's copy, at version delta.fromVersion (or
+     *        anything at all, if the delta is full).
+     *
+     * @return The version the mirror is now at.
+     */
+    static uint64_t apply(Packet& mirror, const PacketDelta<Element>& delta) {
+        if (Traits::size(mirror) != delta.size) {
+            Traits::resize(mirror, delta.size);
+        }
+        Element* data = Traits::data(mirror);
+        for (size_t r = 0; r < delta.ranges.size(); r++) {
+            const DeltaRange<Element>& dr = delta.ranges[r];
+            std::copy(dr.values.begin(), dr.values.end(), data + dr.begin);
+        }
+        return delta.toVersion;
+    }
+};
+
+#endif
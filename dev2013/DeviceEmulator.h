@@ -0,0 +1,483 @@
+#include <pthread.h>
+#include <boost/function.hpp>
+#include <boost/bind.hpp>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <random>
+#include <sstream>
+#include <string>
+#include <stdint.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "BufferThreadedP.h"
+#include "MonotonicClock.h"
+#include "SerialLine.h"
+#include "ThreadAccounting.h"
+
+// Header guards -- this file may be included more than once.
+#ifndef DEVICEEMULATOR_H_
+#define DEVICEEMULATOR_H_
+
+/**
+ * How the emulated link between a device and the computer misbehaves.
+ */
+struct LinkModel {
+    /**
+     * Bits per second, 10 per byte (8N1), in both directions; 0 not to
+     * throttle at all. Like on a real line, a frame becomes readable only
+     * once its last byte has had the time to go through.
+     */
+    int baud;
+    /** Delay from a frame being produced to its first byte being sent. */
+    int64_t latencyNs;
+    /** Extra delay, uniform in [0, jitterNs]; frames stay in order. */
+    int64_t jitterNs;
+    /** Probability of one bit flipping, per byte sent. */
+    double corruptRate;
+    /** Probability of a whole frame being lost. */
+    double dropRate;
+    /**
+     * Bytes the device can have waiting to be sent (64 on an Arduino);
+     * frames that do not fit are lost. 0 for no limit.
+     */
+    size_t txBuffer;
+
+    LinkModel(int baud = 115200, int64_t latencyNs = 0,
+              int64_t jitterNs = 0, double corruptRate = 0,
+              double dropRate = 0, size_t txBuffer = 0) : baud(baud),
+              latencyNs(latencyNs), jitterNs(jitterNs),
+              corruptRate(corruptRate), dropRate(dropRate),
+              txBuffer(txBuffer) {}
+};
+
+/**
+ * Counts of a DeviceEmulator, as returned by getStats().
+ */
+struct EmulatorStats {
+    uint64_t framesSent;
+    uint64_t bytesSent;
+    uint64_t framesDropped;
+    uint64_t bytesCorrupted;
+    uint64_t linesReceived;
+    uint64_t badLinesReceived;
+};
+
+/**
+ * The far end of a serial device, on a pseudo-terminal: open getPath() as
+ * if it were /dev/ttyUSB0 and the emulator answers like the device would,
+ * over a link as slow, late and unreliable as the LinkModel says. With it a
+ * real serial Interface can be run in a BufferThread, benchmarked and
+ * regression-tested on any Linux machine, no hardware attached.
+ *
+ * What the device says is up to the Protocol, a class with the members
+ *
+ *     int64_t getPeriodNs();                  // 0: speaks only when asked
+ *     std::string produce(int64_t nowNs);     // payload sent every period
+ *     std::string reply(const std::string&);  // answer to an intact line;
+ *                                             // empty for none
+ *
+ * Payloads are framed with frameLine(); ArduinoProtocol and
+ * MotorControllerProtocol below are the two devices of the robot. The
+ * emulator runs on a thread of its own from start() to its destruction.
+ */
+template <class Protocol>
+class DeviceEmulator {
+
+    private:
+    struct Frame {
+        int64_t dueNs;
+        std::string bytes;
+    };
+
+    Protocol* proto;
+    LinkModel link;
+    int master;
+    int slave;
+    std::string path;
+    std::mt19937 rng;
+    std::deque<Frame> outQueue;
+    size_t queuedBytes;
+    int64_t lastDueNs;
+    int64_t lineFreeNs;
+    // Bytes from the computer, each chunk due when the line has carried it
+    std::deque<Frame> inQueue;
+    int64_t rxFreeNs;
+    std::string inBuf;
+
+    std::atomic<uint64_t> framesSent;
+    std::atomic<uint64_t> bytesSent;
+    std::atomic<uint64_t> framesDropped;
+    std::atomic<uint64_t> bytesCorrupted;
+    std::atomic<uint64_t> linesReceived;
+    std::atomic<uint64_t> badLinesReceived;
+
+    std::atomic<bool> bStop;
+    bool bStarted;
+    pthread_t emu_thread;
+    boost::function<void*()>* tfPersistent;
+
+    DeviceEmulator(const DeviceEmulator&);
+    DeviceEmulator& operator=(const DeviceEmulator&);
+
+    /**
+     * Queues a payload for sending, applying the loss, corruption and
+     * delay of the link.
+     */
+    void send(const std::string& payload, int64_t nowNs) {
+        std::uniform_real_distribution<double> u(0, 1);
+        Frame f;
+        f.bytes = frameLine(payload);
+        if ((link.dropRate > 0 && u(rng) < link.dropRate) ||
+                (link.txBuffer > 0 &&
+                 queuedBytes + f.bytes.size() > link.txBuffer)) {
+            framesDropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        if (link.corruptRate > 0) {
+            for (size_t i = 0; i < f.bytes.size(); i++) {
+                if (u(rng) < link.corruptRate) {
+                    f.bytes[i] ^= (char) (1 << (rng() % 8));
+                    bytesCorrupted.fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+        }
+        int64_t jitter = link.jitterNs > 0 ?
+                         (int64_t) (u(rng) * link.jitterNs) : 0;
+        f.dueNs = nowNs + link.latencyNs + jitter;
+        if (f.dueNs < lastDueNs) {
+            f.dueNs = lastDueNs;
+        }
+        lastDueNs = f.dueNs;
+        queuedBytes += f.bytes.size();
+        outQueue.push_back(f);
+    }
+
+    /** Time the line takes to carry n bytes. */
+    int64_t lineNs(size_t n) const {
+        return link.baud > 0 ?
+               (int64_t) n * 10 * 1000000000LL / link.baud : 0;
+    }
+
+    /**
+     * When the next frame to send will have gone through the line.
+     */
+    int64_t nextSentNs() const {
+        const Frame& f = outQueue.front();
+        return std::max(f.dueNs, lineFreeNs) + lineNs(f.bytes.size());
+    }
+
+    /**
+     * Writes the frames whose last byte the line has had the time to
+     * carry.
+     */
+    void flush(int64_t nowNs) {
+        while (!outQueue.empty()) {
+            Frame& f = outQueue.front();
+            int64_t doneNs = nextSentNs();
+            if (doneNs > nowNs) {
+                return;
+            }
+            ssize_t n = ::write(master, f.bytes.data(), f.bytes.size());
+            if (n < 0) {
+                if (errno != EAGAIN) {
+                    return;
+                }
+                // Nobody reading and the pty buffer full: lose the frame,
+                // like a device with nobody listening.
+                framesDropped.fetch_add(1, std::memory_order_relaxed);
+                queuedBytes -= f.bytes.size();
+                outQueue.pop_front();
+                continue;
+            }
+            bytesSent.fetch_add(n, std::memory_order_relaxed);
+            queuedBytes -= n;
+            if ((size_t) n < f.bytes.size()) {
+                // The pty took only part of the frame; the rest has already
+                // been carried, so it goes as soon as there is room.
+                f.bytes.erase(0, n);
+                lineFreeNs = doneNs - lineNs(f.bytes.size());
+                continue;
+            }
+            lineFreeNs = doneNs;
+            framesSent.fetch_add(1, std::memory_order_relaxed);
+            outQueue.pop_front();
+        }
+    }
+
+    /**
+     * Reads what the computer wrote, to be handled once the line has had
+     * the time to carry it.
+     */
+    void receive(int64_t nowNs) {
+        char buf[512];
+        ssize_t n;
+        while ((n = ::read(master, buf, sizeof(buf))) > 0) {
+            Frame f;
+            rxFreeNs = std::max(rxFreeNs, nowNs) + lineNs(n);
+            f.dueNs = rxFreeNs;
+            f.bytes.assign(buf, n);
+            inQueue.push_back(f);
+        }
+    }
+
+    /**
+     * Answers the lines that have arrived by now.
+     */
+    void handleInput(int64_t nowNs) {
+        while (!inQueue.empty() && inQueue.front().dueNs <= nowNs) {
+            inBuf += inQueue.front().bytes;
+            inQueue.pop_front();
+        }
+        size_t nl;
+        while ((nl = inBuf.find('\n')) != std::string::npos) {
+            std::string line = inBuf.substr(0, nl);
+            inBuf.erase(0, nl + 1);
+            if (!line.empty() && line[line.size() - 1] == '\r') {
+                line.erase(line.size() - 1);
+            }
+            std::string payload;
+            if (!unframeLine(line, payload)) {
+                badLinesReceived.fetch_add(1, std::memory_order_relaxed);
+                continue;
+            }
+            linesReceived.fetch_add(1, std::memory_order_relaxed);
+            std::string answer = proto->reply(payload);
+            if (!answer.empty()) {
+                send(answer, nowNs);
+            }
+        }
+    }
+
+    /**
+     * The emulator thread function.
+     *
+     * It is called from an external wrapper function.
+     */
+    void* emuMeth() {
+        ThreadRegistration reg("emu:" + path.substr(path.rfind('/') + 1));
+        int64_t period = proto->getPeriodNs();
+        int64_t nextNs = monotonicNs();
+        while (!bStop.load(std::memory_order_relaxed)) {
+            int64_t now = monotonicNs();
+            if (period > 0 && now >= nextNs) {
+                send(proto->produce(now), now);
+                nextNs += period;
+                if (nextNs < now) {
+                    nextNs = now + period;
+                }
+            }
+            handleInput(now);
+            flush(now);
+            // Sleep until the next thing to do, but at most 20 ms so that
+            // stopping is noticed.
+            int64_t wake = now + 20000000;
+            if (period > 0) {
+                wake = std::min(wake, nextNs);
+            }
+            if (!outQueue.empty()) {
+                wake = std::min(wake, nextSentNs());
+            }
+            if (!inQueue.empty()) {
+                wake = std::min(wake, inQueue.front().dueNs);
+            }
+            int timeoutMs = (int) ((wake - now + 999999) / 1000000);
+            pollfd pfd = {master, POLLIN, 0};
+            if (poll(&pfd, 1, timeoutMs < 0 ? 0 : timeoutMs) > 0 &&
+                    (pfd.revents & POLLIN)) {
+                receive(monotonicNs());
+            }
+        }
+        return NULL;
+    }
+
+    public:
+    /**
+     * Creates the pseudo-terminal; the device starts talking on start().
+     *
+     * @param proto The device; must outlive the emulator.
+     */
+    DeviceEmulator(Protocol* proto, const LinkModel& link = LinkModel()) :
+                   proto(proto), link(link), master(-1), slave(-1),
+                   rng(1), queuedBytes(0), lastDueNs(0),
+                   lineFreeNs(0), rxFreeNs(0), framesSent(0), bytesSent(0),
+                   framesDropped(0), bytesCorrupted(0), linesReceived(0),
+                   badLinesReceived(0), bStop(false), bStarted(false),
+                   tfPersistent(NULL) {
+        master = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+        if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0) {
+            return;
+        }
+        path = ptsname(master);
+        // Keep the slave open ourselves, so that the master does not see
+        // a hangup whenever the Interface closes and reopens the port.
+        slave = ::open(path.c_str(), O_RDWR | O_NOCTTY | O_CLOEXEC);
+        termios tio;
+        if (slave >= 0 && tcgetattr(slave, &tio) == 0) {
+            cfmakeraw(&tio);
+            tcsetattr(slave, TCSANOW, &tio);
+        }
+    }
+
+    ~DeviceEmulator() {
+        if (bStarted) {
+            bStop.store(true);
+            pthread_join(emu_thread, NULL);
+        }
+        if (slave >= 0) {
+            ::close(slave);
+        }
+        if (master >= 0) {
+            ::close(master);
+        }
+        delete tfPersistent;
+    }
+
+    /**
+     * Whether the pseudo-terminal could be created.
+     */
+    bool isOpen() const {
+        return slave >= 0;
+    }
+
+    /**
+     * The device path for the Interface to open, e.g. /dev/pts/3.
+     */
+    const std::string& getPath() const {
+        return path;
+    }
+
+    /**
+     * Starts the device. Call only once.
+     */
+    void start() {
+        boost::function<void*()> thrFun =
+                bind(&DeviceEmulator::emuMeth, this);
+        tfPersistent = new boost::function<void*()>(thrFun);
+        pthread_create(&emu_thread, NULL, &pthreadWrapper, tfPersistent);
+        bStarted = true;
+    }
+
+    EmulatorStats getStats() const {
+        EmulatorStats s;
+        s.framesSent = framesSent.load(std::memory_order_relaxed);
+        s.bytesSent = bytesSent.load(std::memory_order_relaxed);
+        s.framesDropped = framesDropped.load(std::memory_order_relaxed);
+        s.bytesCorrupted = bytesCorrupted.load(std::memory_order_relaxed);
+        s.linesReceived = linesReceived.load(std::memory_order_relaxed);
+        s.badLinesReceived =
+                badLinesReceived.load(std::memory_order_relaxed);
+        return s;
+    }
+};
+
+/**
+ * The sensor Arduino: streams `A,<seq>,<ns>,<ch0>,<ch1>,...` at a fixed
+ * rate, where ns is the monotonic time the reading was taken (which lets
+ * a benchmark measure the latency of the whole path) and the channels are
+ * analog readings from 0 to 1023. It answers `R` (reset) with `RST` and
+ * restarts the sequence.
+ */
+class ArduinoProtocol {
+
+    private:
+    int64_t periodNs;
+    int numChannels;
+    uint64_t seq;
+    std::mt19937 rng;
+
+    public:
+    ArduinoProtocol(double rateHz = 100, int numChannels = 6) :
+                    periodNs((int64_t) (1e9 / rateHz)),
+                    numChannels(numChannels), seq(0), rng(3) {}
+
+    int64_t getPeriodNs() {
+        return periodNs;
+    }
+
+    std::string produce(int64_t nowNs) {
+        std::ostringstream os;
+        os << "A," << ++seq << "," << nowNs;
+        for (int i = 0; i < numChannels; i++) {
+            os << "," << rng() % 1024;
+        }
+        return os.str();
+    }
+
+    std::string reply(const std::string& line) {
+        if (line == "R") {
+            seq = 0;
+            return "RST";
+        }
+        return "";
+    }
+};
+
+/**
+ * The motor controller: `M,<left>,<right>` sets the wheel speeds (-255 to
+ * 255) and is acknowledged with `OK,<left>,<right>`; `Q` is answered with
+ * `E,<ns>,<left ticks>,<right ticks>`, the encoder counts. It also streams
+ * the encoder message at a fixed rate, if given one.
+ */
+class MotorControllerProtocol {
+
+    private:
+    int64_t periodNs;
+    int left;
+    int right;
+    int64_t lastNs;
+    double ticksL;
+    double ticksR;
+
+    std::string encoders(int64_t nowNs) {
+        if (lastNs != 0) {
+            double dt = (nowNs - lastNs) / 1e9;
+            // 2000 ticks per second at full speed.
+            ticksL += left * dt * 2000 / 255;
+            ticksR += right * dt * 2000 / 255;
+        }
+        lastNs = nowNs;
+        std::ostringstream os;
+        os << "E," << nowNs << "," << (long long) ticksL << ","
+           << (long long) ticksR;
+        return os.str();
+    }
+
+    public:
+    MotorControllerProtocol(double rateHz = 0) :
+                            periodNs(rateHz > 0 ? (int64_t) (1e9 / rateHz)
+                                     : 0),
+                            left(0), right(0), lastNs(0), ticksL(0),
+                            ticksR(0) {}
+
+    int64_t getPeriodNs() {
+        return periodNs;
+    }
+
+    std::string produce(int64_t nowNs) {
+        return encoders(nowNs);
+    }
+
+    std::string reply(const std::string& line) {
+        int l, r;
+        if (sscanf(line.c_str(), "M,%d,%d", &l, &r) == 2) {
+            encoders(monotonicNs());
+            left = std::max(-255, std::min(255, l));
+            right = std::max(-255, std::min(255, r));
+            std::ostringstream os;
+            os << "OK," << left << "," << right;
+            return os.str();
+        }
+        if (line == "Q") {
+            return encoders(monotonicNs());
+        }
+        return "";
+    }
+};
+
+#endif
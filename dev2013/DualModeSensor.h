@@ -0,0 +1,153 @@
+#include "BufferThreadedP.h"
+
+// Header guards -- this file may be included more than once.
+#ifndef DUALMODESENSOR_H_
+#define DUALMODESENSOR_H_
+
+/**
+ * Access modes of a DualModeSensor, named after the function suffixes of
+ * SensorInterface.md.
+ */
+enum AccessMode {
+    BLKING, /**< Wait for data from an acquisition that is fresh enough */
+    ASYNC   /**< Return the cached data immediately */
+};
+
+/**
+ * Adapter that gives any packetized sensor interface both the blocking and
+ * the asynchronous access modes of SensorInterface.md, so that interface
+ * authors only have to write `Packet getPacket()`.
+ *
+ * Both modes are served by one BufferThread, which is the only thing that
+ * ever talks to the Interface; the Interface therefore never sees two
+ * requests at once, and every acquisition, whichever mode asked for it,
+ * refreshes the cache that the other mode reads. Blocking reads are
+ * single-flight (see BufferThread::getPacketBlking()). Everything is
+ * resolved at compile time; there are no virtual functions.
+ *
+ * Individual data items are read through the packet's own get-functions,
+ * in either mode:
+ *
+ *     DualModeSensor<ImuPacket, ImuInterface> imu(&imuIface);
+ *     double h = imu.getBlking(&ImuPacket::getHeading);
+ *     timeval t = imu.getAsync(&ImuPacket::getTimeStamp);
+ *     ImuPacket p = imu.get(BLKING); // mode chosen at runtime
+ *
+ * The template parameters are the same as BufferThread's.
+ */
+template <class Packet, class Interface, class SyncPolicy = MutexPolicy>
+class DualModeSensor {
+
+    private:
+    BufferThread<Packet, Interface, SyncPolicy> buffer;
+    int maxAgeMs;
+    bool autoRefresh;
+
+    public:
+    /**
+     * Wraps the interface and starts the acquisition thread.
+     *
+     * @param source The sensor interface; must outlive the adapter.
+     * @param maxAgeMs How old an acquisition may be and still satisfy a
+     *        blocking read. Zero (the default) makes every blocking read
+     *        wait for an acquisition that is in flight or newly started,
+     *        which is as close to a direct call as a shared interface gets.
+     * @param autoRefresh Whether asynchronous reads also request an update,
+     *        so the next read sees newer data (pipelined operation). If
+     *        false, updates have to be requested with readData().
+     */
+    DualModeSensor(Interface* source, int maxAgeMs = 0,
+                   bool autoRefresh = true) :
+                   buffer(source), maxAgeMs(maxAgeMs),
+                   autoRefresh(autoRefresh) {
+        buffer.spawnThreads();
+    }
+
+    /**
+     * Blocking read. Returns once data from a fresh enough acquisition is
+     * available.
+     */
+    Packet getPacketBlking() {
+        return buffer.getPacketBlking(maxAgeMs);
+    }
+
+    /**
+     * Asynchronous read. Returns the cached packet immediately.
+     */
+    Packet getPacketAsync() {
+        if (autoRefresh) {
+            buffer.readData();
+        }
+        return buffer.getPacket();
+    }
+
+    /**
+     * Reads a packet in the given mode.
+     */
+    Packet get(AccessMode mode) {
+        if (mode == BLKING) {
+            return getPacketBlking();
+        }
+        return getPacketAsync();
+    }
+
+    /**
+     * Reads a packet in a mode fixed at compile time, e.g. get<ASYNC>().
+     */
+    template <AccessMode Mode>
+    Packet get() {
+        return get(Mode);
+    }
+
+    /**
+     * Blocking read of a single data item, e.g.
+     * getBlking(&ImuPacket::getHeading).
+     */
+    template <class Result>
+    Result getBlking(Result (Packet::*getter)()) {
+        Packet pkt = getPacketBlking();
+        return (pkt.*getter)();
+    }
+
+    template <class Result>
+    Result getBlking(Result (Packet::*getter)() const) {
+        Packet pkt = getPacketBlking();
+        return (pkt.*getter)();
+    }
+
+    /**
+     * Asynchronous read of a single data item, e.g.
+     * getAsync(&ImuPacket::getHeading).
+     */
+    template <class Result>
+    Result getAsync(Result (Packet::*getter)()) {
+        Packet pkt = getPacketAsync();
+        return (pkt.*getter)();
+    }
+
+    template <class Result>
+    Result getAsync(Result (Packet::*getter)() const) {
+        Packet pkt = getPacketAsync();
+        return (pkt.*getter)();
+    }
+
+    /** Requests an update, as BufferThread::readData(). */
+    void readData() {
+        buffer.readData();
+    }
+
+    /** Whether an update is in progress, as BufferThread::isUpdating(). */
+    bool isUpdating() {
+        return buffer.isUpdating();
+    }
+
+    /**
+     * The underlying buffer, for the features not exposed here (leases,
+     * notifiers, statistics).
+     */
+    BufferThread<Packet, Interface, SyncPolicy>& getBuffer() {
+        return buffer;
+    }
+};
+
+#endif
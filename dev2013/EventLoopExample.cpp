@@ -0,0 +1,117 @@
+#include "BufferThreadedP.h"
+#include "IOBuffer.h"
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+#include <sys/epoll.h>
+#include <time.h>
+
+using namespace std;
+
+/**
+ * Sensor stand-in that produces a sequence number every few milliseconds.
+ */
+class TickInterface {
+    int count;
+    int periodUs;
+
+    public:
+    TickInterface(int periodUs) : count(0), periodUs(periodUs) {}
+
+    int getPacket() {
+        usleep(periodUs);
+        return ++count;
+    }
+};
+
+/**
+ * Processing stand-in that doubles its input.
+ */
+class DoubleInterface {
+    public:
+    int runProcess(int input) {
+        return 2 * input;
+    }
+};
+
+typedef BufferThread<int, TickInterface> TickBuffer;
+typedef IOBuffer<int, int, DoubleInterface> DoubleBuffer;
+
+/**
+ * Demonstrates watching many buffers from a single epoll loop through one
+ * shared ReadyNotifier. One buffer's output is also fed through an IOBuffer
+ * whose publications arrive on the same descriptor.
+ *
+ * Usage: EventLoopExample [numBuffers] [seconds]  (default 200, 3)
+ */
+int main(int argc, char** argv) {
+    int numBuffers = 200;
+    int seconds = 3;
+    if (argc > 1) {
+        numBuffers = atoi(argv[1]);
+    }
+    if (argc > 2) {
+        seconds = atoi(argv[2]);
+    }
+
+    ReadyNotifier notifier(numBuffers + 1);
+    vector<TickInterface*> ifaces;
+    vector<TickBuffer*> bufs;
+    for (int i = 0; i < numBuffers; i++) {
+        ifaces.push_back(new TickInterface(5000 + 50 * i));
+        bufs.push_back(new TickBuffer(ifaces.back()));
+        // Tags are handed out in order, so tag i is buffer i here.
+        bufs.back()->attachNotifier(&notifier);
+        bufs.back()->runContinuous();
+    }
+    DoubleInterface doubler;
+    DoubleBuffer proc(&doubler);
+    int procTag = proc.attachNotifier(&notifier);
+    proc.runContinuous();
+
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = notifier.getFd();
+    epoll_ctl(epfd, EPOLL_CTL_ADD, notifier.getFd(), &ev);
+
+    long wakeups = 0;
+    long updates = 0;
+    long processed = 0;
+    vector<int> ready;
+    time_t end = time(NULL) + seconds;
+    while (time(NULL) < end) {
+        epoll_event events[1];
+        if (epoll_wait(epfd, events, 1, 100) <= 0) {
+            continue;
+        }
+        ++wakeups;
+        ready.clear();
+        notifier.drain(ready);
+        for (size_t i = 0; i < ready.size(); i++) {
+            int out;
+            if (ready[i] == procTag) {
+                if (proc.getPacket(&out)) {
+                    ++processed;
+                }
+            } else {
+                ++updates;
+                if (ready[i] == 0) {
+                    proc.providePacket(bufs[0]->getPacket());
+                }
+            }
+        }
+    }
+
+    cout << numBuffers << " buffers, " << seconds << " s: " << wakeups <<
+        " epoll wakeups, " << updates << " buffer updates handled (" <<
+        double(updates) / wakeups << " per wakeup), " << processed <<
+        " processed outputs" << endl;
+
+    close(epfd);
+    for (int i = 0; i < numBuffers; i++) {
+        delete bufs[i];
+        delete ifaces[i];
+    }
+    return 0;
+}
@@ -0,0 +1,638 @@
+#include <pthread.h>
+#include <boost/function.hpp>
+#include <boost/bind.hpp>
+#include <atomic>
+#include <cmath>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "BufferThreadedP.h"
+#include "FutexEvent.h"
+#include "MonotonicClock.h"
+#include "ThreadAccounting.h"
+
+// Header guards -- this file may be included more than once.
+#ifndef FIELDSIM_H_
+#define FIELDSIM_H_
+
+/**
+ * Position (m) and heading (rad, counterclockwise from +x) of the robot on
+ * the field.
+ */
+struct SimPose {
+    double x;
+    double y;
+    double theta;
+};
+
+/**
+ * Converts a simulated time to the timeval that packets carry as their
+ * time stamp.
+ */
+inline timeval simTimeval(int64_t simNs) {
+    timeval tv;
+    tv.tv_sec = simNs / 1000000000;
+    tv.tv_usec = (simNs % 1000000000) / 1000;
+    return tv;
+}
+
+/**
+ * The static geometry of the field as a uniform occupancy grid, with (0, 0)
+ * at a corner. Walls and boxes are rasterized into the grid when they are
+ * added, so that a ray only ever has to look at the cells it crosses.
+ */
+class FieldMap {
+
+    private:
+    double cell;
+    int nx;
+    int ny;
+    std::vector<uint8_t> occ;
+
+    void mark(double x, double y) {
+        int ix = (int) std::floor(x / cell);
+        int iy = (int) std::floor(y / cell);
+        if (ix >= 0 && ix < nx && iy >= 0 && iy < ny) {
+            occ[iy * nx + ix] = 1;
+        }
+    }
+
+    public:
+    /**
+     * An empty field of widthM by heightM metres in cells of cellM.
+     */
+    FieldMap(double widthM, double heightM, double cellM) : cell(cellM),
+             nx((int) std::ceil(widthM / cellM)),
+             ny((int) std::ceil(heightM / cellM)), occ(nx * ny, 0) {}
+
+    double getWidth() const {
+        return nx * cell;
+    }
+
+    double getHeight() const {
+        return ny * cell;
+    }
+
+    double getCellSize() const {
+        return cell;
+    }
+
+    /**
+     * Fills the axis-aligned box between two corners.
+     */
+    void addBox(double x0, double y0, double x1, double y1) {
+        for (double y = std::min(y0, y1); y <= std::max(y0, y1);
+                y += cell / 2) {
+            for (double x = std::min(x0, x1); x <= std::max(x0, x1);
+                    x += cell / 2) {
+                mark(x, y);
+            }
+        }
+    }
+
+    /**
+     * Adds a wall one cell thick from (x0, y0) to (x1, y1).
+     */
+    void addWall(double x0, double y0, double x1, double y1) {
+        double len = std::hypot(x1 - x0, y1 - y0);
+        int n = (int) std::ceil(len / (cell / 2)) + 1;
+        for (int i = 0; i <= n; i++) {
+            double f = (double) i / n;
+            mark(x0 + f * (x1 - x0), y0 + f * (y1 - y0));
+        }
+    }
+
+    /**
+     * Walls the field in.
+     */
+    void addBorder() {
+        double w = getWidth() - cell / 2;
+        double h = getHeight() - cell / 2;
+        addWall(0, 0, w, 0);
+        addWall(w, 0, w, h);
+        addWall(w, h, 0, h);
+        addWall(0, h, 0, 0);
+    }
+
+    bool isOccupied(double x, double y) const {
+        int ix = (int) std::floor(x / cell);
+        int iy = (int) std::floor(y / cell);
+        return ix < 0 || ix >= nx || iy < 0 || iy >= ny ||
+               occ[iy * nx + ix];
+    }
+
+    /**
+     * Distance from (x, y) along the unit direction (dx, dy) to the first
+     * occupied cell, or maxRange if there is none that close. Walks the
+     * grid cell by cell (the DDA of Amanatides and Woo), so the cost is
+     * proportional to the distance, not to the amount of geometry.
+     */
+    float castRay(double x, double y, double dx, double dy,
+                  double maxRange) const {
+        int ix = (int) std::floor(x / cell);
+        int iy = (int) std::floor(y / cell);
+        if (ix < 0 || ix >= nx || iy < 0 || iy >= ny) {
+            return maxRange;
+        }
+        if (occ[iy * nx + ix]) {
+            return 0;
+        }
+        const double inf = 1e30;
+        int stepX = dx > 0 ? 1 : -1;
+        int stepY = dy > 0 ? 1 : -1;
+        double tDeltaX = dx != 0 ? cell / std::fabs(dx) : inf;
+        double tDeltaY = dy != 0 ? cell / std::fabs(dy) : inf;
+        double tMaxX = dx > 0 ? ((ix + 1) * cell - x) / dx :
+                       dx < 0 ? (x - ix * cell) / -dx : inf;
+        double tMaxY = dy > 0 ? ((iy + 1) * cell - y) / dy :
+                       dy < 0 ? (y - iy * cell) / -dy : inf;
+        double t = 0;
+        while (t < maxRange) {
+            if (tMaxX < tMaxY) {
+                t = tMaxX;
+                tMaxX += tDeltaX;
+                ix += stepX;
+                if (ix < 0 || ix >= nx) {
+                    break;
+                }
+            } else {
+                t = tMaxY;
+                tMaxY += tDeltaY;
+                iy += stepY;
+                if (iy < 0 || iy >= ny) {
+                    break;
+                }
+            }
+            if (occ[iy * nx + ix]) {
+                return t < maxRange ? t : maxRange;
+            }
+        }
+        return maxRange;
+    }
+};
+
+/**
+ * The simulated world: the field, the robot moving on it, and a clock that
+ * runs timeScale times faster than the real one. The sensor models below
+ * pace themselves by this clock, so at a time scale of 20 a 10 Hz LIDAR
+ * delivers 200 scans per real second, and everything downstream of the
+ * buffers sees time stamps as if it were running at full speed on a real
+ * field.
+ *
+ * The robot is a unicycle driven by setVelocity(); its pose is integrated
+ * exactly, on demand, up to the time a sensor asks for. It stops when it
+ * runs into something.
+ */
+class FieldSim {
+
+    private:
+    FieldMap map;
+    double timeScale;
+    int64_t startNs;
+    pthread_mutex_t pose_mtx;
+    SimPose pose;
+    double v;
+    double w;
+    int64_t poseNs;
+    uint64_t collisions;
+
+    FieldSim(const FieldSim&);
+    FieldSim& operator=(const FieldSim&);
+
+    SimPose integrate(const SimPose& p, double dt) const {
+        SimPose q = p;
+        if (std::fabs(w) < 1e-9) {
+            q.x += v * dt * std::cos(p.theta);
+            q.y += v * dt * std::sin(p.theta);
+        } else {
+            q.theta += w * dt;
+            q.x += v / w * (std::sin(q.theta) - std::sin(p.theta));
+            q.y -= v / w * (std::cos(q.theta) - std::cos(p.theta));
+        }
+        return q;
+    }
+
+    public:
+    /**
+     * @param map The field; copied.
+     * @param timeScale Simulated seconds per real second.
+     */
+    FieldSim(const FieldMap& map, double timeScale = 1.0) : map(map),
+             timeScale(timeScale), startNs(monotonicNs()), v(0), w(0),
+             poseNs(0), collisions(0) {
+        pthread_mutex_init(&pose_mtx, NULL);
+        pose.x = map.getWidth() / 2;
+        pose.y = map.getHeight() / 2;
+        pose.theta = 0;
+    }
+
+    ~FieldSim() {
+        pthread_mutex_destroy(&pose_mtx);
+    }
+
+    const FieldMap& getMap() const {
+        return map;
+    }
+
+    double getTimeScale() const {
+        return timeScale;
+    }
+
+    /**
+     * The simulated time in nanoseconds since the simulation was created.
+     */
+    int64_t now() const {
+        return (int64_t) ((monotonicNs() - startNs) * timeScale);
+    }
+
+    /**
+     * Sleeps until the simulated clock reaches simNs.
+     */
+    void sleepUntil(int64_t simNs) const {
+        int64_t real = startNs + (int64_t) (simNs / timeScale);
+        timespec ts;
+        ts.tv_sec = real / 1000000000;
+        ts.tv_nsec = real % 1000000000;
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL)
+               != 0) {}
+    }
+
+    /**
+     * Waits for the next tick of a sensor sampling every periodNs of
+     * simulated time, advancing nextNs. Ticks already missed (the sensor
+     * model being slower than the time scale allows) are dropped, as a
+     * real sensor's would be.
+     *
+     * @return The simulated time of the tick.
+     */
+    int64_t waitTick(int64_t& nextNs, int64_t periodNs) const {
+        int64_t t = now();
+        if (nextNs == 0 || nextNs + periodNs < t) {
+            nextNs = t;
+        }
+        sleepUntil(nextNs);
+        int64_t tick = nextNs;
+        nextNs += periodNs;
+        return tick;
+    }
+
+    /**
+     * Moves the robot to a pose, at rest.
+     */
+    void setPose(const SimPose& p) {
+        pthread_mutex_lock(&pose_mtx);
+        pose = p;
+        poseNs = now();
+        v = 0;
+        w = 0;
+        pthread_mutex_unlock(&pose_mtx);
+    }
+
+    /**
+     * Sets the forward (m/s) and turning (rad/s) speeds from now on.
+     */
+    void setVelocity(double forward, double turn) {
+        int64_t t = now();
+        pthread_mutex_lock(&pose_mtx);
+        if (t > poseNs) {
+            pose = integrate(pose, (t - poseNs) / 1e9);
+            poseNs = t;
+        }
+        v = forward;
+        w = turn;
+        pthread_mutex_unlock(&pose_mtx);
+    }
+
+    /**
+     * The pose of the robot at simulated time simNs; times before the last
+     * change of velocity are extrapolated backwards.
+     */
+    SimPose poseAt(int64_t simNs) {
+        pthread_mutex_lock(&pose_mtx);
+        SimPose p = integrate(pose, (simNs - poseNs) / 1e9);
+        if (simNs > poseNs) {
+            if (map.isOccupied(p.x, p.y)) {
+                // Ran into something: stay where the last query left it.
+                p = pose;
+                v = 0;
+                w = 0;
+                ++collisions;
+            } else {
+                pose = p;
+            }
+            poseNs = simNs;
+        }
+        pthread_mutex_unlock(&pose_mtx);
+        return p;
+    }
+
+    uint64_t getCollisions() {
+        pthread_mutex_lock(&pose_mtx);
+        uint64_t c = collisions;
+        pthread_mutex_unlock(&pose_mtx);
+        return c;
+    }
+};
+
+/**
+ * One LIDAR sweep: ranges (m) at evenly spaced angles, relative to the
+ * robot's heading, starting at getAngleMin().
+ */
+class LidarScan {
+
+    private:
+    timeval stamp;
+    SimPose pose;
+    float angleMin;
+    float angleInc;
+    std::vector<float> ranges;
+
+    public:
+    LidarScan() : angleMin(0), angleInc(0) {
+        stamp.tv_sec = 0;
+        stamp.tv_usec = 0;
+        pose.x = pose.y = pose.theta = 0;
+    }
+
+    LidarScan(int64_t simNs, const SimPose& pose, float angleMin,
+              float angleInc, const std::vector<float>& ranges) :
+              stamp(simTimeval(simNs)), pose(pose), angleMin(angleMin),
+              angleInc(angleInc), ranges(ranges) {}
+
+    timeval getTimeStamp() const {
+        return stamp;
+    }
+
+    /** The true pose the scan was taken from; no real LIDAR knows it. */
+    SimPose getPose() const {
+        return pose;
+    }
+
+    float getAngleMin() const {
+        return angleMin;
+    }
+
+    float getAngleIncrement() const {
+        return angleInc;
+    }
+
+    const std::vector<float>& getRanges() const {
+        return ranges;
+    }
+};
+
+/**
+ * Simulated LIDAR: an Interface whose getPacket() returns a LidarScan at
+ * the configured rate of simulated time, ready to be fed to a BufferThread
+ * in place of the real driver.
+ *
+ * The beams of a scan are split between the calling thread and a pool of
+ * raycasting threads. Every thread first turns its beams' directions into
+ * world coordinates in one pass over plain float arrays, which the compiler
+ * vectorizes, and then walks the grid for each beam.
+ */
+class SimLidar {
+
+    private:
+    FieldSim* sim;
+    int numBeams;
+    float angleMin;
+    float angleInc;
+    float maxRange;
+    float rangeNoise;
+    int64_t periodNs;
+    int64_t nextNs;
+    std::mt19937 rng;
+
+    // Beam directions in the robot's frame, and in the world frame for the
+    // scan being cast.
+    std::vector<float> cosA;
+    std::vector<float> sinA;
+    std::vector<float> dirX;
+    std::vector<float> dirY;
+    std::vector<float> ranges;
+
+    // The raycasting pool. A scan is started by bumping generation and
+    // notifying startEvt; the last thread to finish notifies doneEvt.
+    int numChunks;
+    std::vector<pthread_t> workers;
+    std::vector<boost::function<void*()>*> tfPersistent;
+    FutexEvent startEvt;
+    FutexEvent doneEvt;
+    std::atomic<uint32_t> generation;
+    std::atomic<int> pending;
+    std::atomic<bool> bStop;
+    SimPose castPose;
+
+    SimLidar(const SimLidar&);
+    SimLidar& operator=(const SimLidar&);
+
+    void castChunk(int c) {
+        int b0 = (int64_t) numBeams * c / numChunks;
+        int b1 = (int64_t) numBeams * (c + 1) / numChunks;
+        float ct = std::cos(castPose.theta);
+        float st = std::sin(castPose.theta);
+        const float* ca = &cosA[0];
+        const float* sa = &sinA[0];
+        float* dx = &dirX[0];
+        float* dy = &dirY[0];
+        for (int b = b0; b < b1; b++) {
+            dx[b] = ca[b] * ct - sa[b] * st;
+            dy[b] = sa[b] * ct + ca[b] * st;
+        }
+        const FieldMap& map = sim->getMap();
+        for (int b = b0; b < b1; b++) {
+            ranges[b] = map.castRay(castPose.x, castPose.y, dx[b], dy[b],
+                                    maxRange);
+        }
+    }
+
+    /**
+     * The function of raycasting thread i, which casts chunk i + 1.
+     *
+     * It is called from an external wrapper function.
+     */
+    void* workerMeth(int i) {
+        std::ostringstream name;
+        name << "lidar-" << i;
+        ThreadRegistration reg(name.str());
+        uint32_t seen = 0;
+        while (true) {
+            uint32_t key = startEvt.prepareWait();
+            if (bStop.load()) {
+                break;
+            }
+            uint32_t g = generation.load(std::memory_order_acquire);
+            if (g == seen) {
+                startEvt.wait(key);
+                continue;
+            }
+            seen = g;
+            castChunk(i + 1);
+            if (pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                doneEvt.notifyAll();
+            }
+        }
+        return NULL;
+    }
+
+    public:
+    /**
+     * Starts the raycasting threads.
+     *
+     * @param sim The world to scan; must outlive the LIDAR.
+     * @param numBeams Beams per scan.
+     * @param fov Field of view (rad), centred on the heading.
+     * @param maxRange Range reported when a beam hits nothing (m).
+     * @param rateHz Scans per simulated second.
+     * @param numThreads Threads casting a scan, including the caller.
+     * @param rangeNoise Standard deviation of the range noise (m).
+     */
+    SimLidar(FieldSim* sim, int numBeams = 720, double fov = 2 * M_PI,
+             double maxRange = 12, double rateHz = 10, int numThreads = 1,
+             double rangeNoise = 0) : sim(sim), numBeams(numBeams),
+             angleMin(-fov / 2), angleInc(fov / numBeams),
+             maxRange(maxRange), rangeNoise(rangeNoise),
+             periodNs((int64_t) (1e9 / rateHz)), nextNs(0), rng(1),
+             cosA(numBeams), sinA(numBeams), dirX(numBeams),
+             dirY(numBeams), ranges(numBeams),
+             numChunks(numThreads < 1 ? 1 : numThreads), generation(0),
+             pending(0), bStop(false) {
+        for (int b = 0; b < numBeams; b++) {
+            double a = angleMin + b * angleInc;
+            cosA[b] = std::cos(a);
+            sinA[b] = std::sin(a);
+        }
+        for (int i = 0; i < numChunks - 1; i++) {
+            boost::function<void*()> thrFun =
+                    bind(&SimLidar::workerMeth, this, i);
+            tfPersistent.push_back(new boost::function<void*()>(thrFun));
+            pthread_t t;
+            pthread_create(&t, NULL, &pthreadWrapper, tfPersistent.back());
+            workers.push_back(t);
+        }
+    }
+
+    ~SimLidar() {
+        bStop.store(true);
+        startEvt.notifyAll();
+        for (size_t i = 0; i < workers.size(); i++) {
+            pthread_join(workers[i], NULL);
+            delete tfPersistent[i];
+        }
+    }
+
+    /**
+     * Casts a scan from a given pose, unpaced; for benchmarks and offline
+     * use. Not to be called concurrently with itself or getPacket().
+     */
+    LidarScan scanFrom(const SimPose& pose, int64_t simNs) {
+        castPose = pose;
+        pending.store(numChunks - 1, std::memory_order_relaxed);
+        generation.fetch_add(1, std::memory_order_release);
+        startEvt.notifyAll();
+        castChunk(0);
+        while (true) {
+            uint32_t key = doneEvt.prepareWait();
+            if (pending.load(std::memory_order_acquire) == 0) {
+                break;
+            }
+            doneEvt.wait(key);
+        }
+        if (rangeNoise > 0) {
+            std::normal_distribution<float> noise(0, rangeNoise);
+            for (int b = 0; b < numBeams; b++) {
+                if (ranges[b] < maxRange) {
+                    ranges[b] = std::max(0.0f, ranges[b] + noise(rng));
+                }
+            }
+        }
+        return LidarScan(simNs, pose, angleMin, angleInc, ranges);
+    }
+
+    /**
+     * Waits for the next scan time and casts the scan from the robot's
+     * pose at that time.
+     */
+    LidarScan getPacket() {
+        int64_t t = sim->waitTick(nextNs, periodNs);
+        return scanFrom(sim->poseAt(t), t);
+    }
+};
+
+/**
+ * Odometry reading: the robot's pose as dead reckoning has it.
+ */
+class OdomPacket {
+
+    private:
+    timeval stamp;
+    SimPose pose;
+
+    public:
+    OdomPacket() {
+        stamp.tv_sec = 0;
+        stamp.tv_usec = 0;
+        pose.x = pose.y = pose.theta = 0;
+    }
+
+    OdomPacket(int64_t simNs, const SimPose& pose) :
+               stamp(simTimeval(simNs)), pose(pose) {}
+
+    timeval getTimeStamp() const {
+        return stamp;
+    }
+
+    SimPose getPose() const {
+        return pose;
+    }
+};
+
+/**
+ * Simulated wheel odometry: an Interface returning the true pose plus a
+ * random-walk drift, at the configured rate of simulated time.
+ */
+class SimOdometry {
+
+    private:
+    FieldSim* sim;
+    int64_t periodNs;
+    int64_t nextNs;
+    double drift;
+    SimPose error;
+    std::mt19937 rng;
+
+    public:
+    /**
+     * @param drift Standard deviation of the drift added per reading, in
+     *        metres (and radians for the heading).
+     */
+    SimOdometry(FieldSim* sim, double rateHz = 100, double drift = 0) :
+                sim(sim), periodNs((int64_t) (1e9 / rateHz)), nextNs(0),
+                drift(drift), rng(2) {
+        error.x = error.y = error.theta = 0;
+    }
+
+    OdomPacket getPacket() {
+        int64_t t = sim->waitTick(nextNs, periodNs);
+        SimPose p = sim->poseAt(t);
+        if (drift > 0) {
+            std::normal_distribution<double> noise(0, drift);
+            error.x += noise(rng);
+            error.y += noise(rng);
+            error.theta += noise(rng) / 10;
+        }
+        p.x += error.x;
+        p.y += error.y;
+        p.theta += error.theta;
+        return OdomPacket(t, p);
+    }
+};
+
+#endif
@@ -0,0 +1,94 @@
+#include "BufferThreadedP.h"
+#include "FieldSim.h"
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+
+using namespace std;
+
+/**
+ * A 10 m by 6 m field with a few obstacles.
+ */
+FieldMap makeField() {
+    FieldMap map(10, 6, 0.02);
+    map.addBorder();
+    map.addBox(2.0, 1.0, 2.6, 1.6);
+    map.addBox(7.0, 4.0, 8.0, 4.5);
+    map.addWall(5.0, 0.0, 5.0, 1.5);
+    map.addWall(3.0, 5.0, 6.0, 4.5);
+    return map;
+}
+
+/**
+ * Scans per second that one LIDAR manages unpaced, and so the highest time
+ * scale at which a rateHz LIDAR keeps up.
+ */
+void bench(FieldSim* sim, int threads, double rateHz) {
+    SimLidar lidar(sim, 720, 2 * M_PI, 12, rateHz, threads);
+    SimPose p = {1.0, 3.0, 0.0};
+    int n = 0;
+    int64_t start = monotonicNs();
+    int64_t end = start + 1000000000LL;
+    while (monotonicNs() < end) {
+        p.theta += 0.01;
+        lidar.scanFrom(p, 0);
+        ++n;
+    }
+    double perSec = n / ((monotonicNs() - start) / 1e9);
+    printf("%d raycasting thread(s): %.0f scans/s, %.0fx real time at "
+           "%.0f Hz\n", threads, perSec, perSec / rateHz, rateHz);
+}
+
+/**
+ * Drives the simulated robot in a circle at 20 times real time, reading a
+ * simulated LIDAR and odometry through ordinary BufferThreads, then
+ * measures how fast the raycaster can go.
+ *
+ * Usage: FieldSimExample [threads]
+ */
+int main(int argc, char** argv) {
+    int threads = argc > 1 ? atoi(argv[1]) : sysconf(_SC_NPROCESSORS_ONLN);
+    FieldSim sim(makeField(), 20);
+    SimPose start = {3.0, 2.5, 0.0};
+    sim.setPose(start);
+    sim.setVelocity(0.6, 0.6);
+
+    SimLidar lidar(&sim, 720, 2 * M_PI, 12, 10, threads, 0.01);
+    SimOdometry odom(&sim, 100, 0.001);
+    BufferThread<LidarScan, SimLidar> lidarBuf(&lidar);
+    BufferThread<OdomPacket, SimOdometry> odomBuf(&odom);
+    lidarBuf.setThreadName("sim-lidar");
+    odomBuf.setThreadName("sim-odom");
+    lidarBuf.runContinuous();
+    odomBuf.runContinuous();
+
+    for (int i = 0; i < 10; i++) {
+        usleep(100000);
+        LidarScan scan = lidarBuf.getPacket();
+        OdomPacket o = odomBuf.getPacket();
+        const vector<float>& r = scan.getRanges();
+        float nearest = 1e9;
+        for (size_t b = 0; b < r.size(); b++) {
+            nearest = min(nearest, r[b]);
+        }
+        SimPose p = scan.getPose();
+        SimPose q = o.getPose();
+        printf("t=%5.2f s  pose (%.2f, %.2f, %5.2f)  odom (%.2f, %.2f)  "
+               "front %.2f m  nearest %.2f m\n",
+               scan.getTimeStamp().tv_sec +
+               scan.getTimeStamp().tv_usec / 1e6,
+               p.x, p.y, p.theta, q.x, q.y, r[r.size() / 2], nearest);
+    }
+    double simS = sim.now() / 1e9;
+    printf("%.1f simulated s: %llu scans, %llu odometry readings, "
+           "%llu collisions\n", simS,
+           (unsigned long long) lidarBuf.getVersion(),
+           (unsigned long long) odomBuf.getVersion(),
+           (unsigned long long) sim.getCollisions());
+
+    bench(&sim, 1, 10);
+    if (threads > 1) {
+        bench(&sim, threads, 10);
+    }
+    return 0;
+}
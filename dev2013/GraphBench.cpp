@@ -0,0 +1,128 @@
+#include "DataflowGraph.h"
+#include "StaticGraph.h"
+#include <algorithm>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+
+using namespace std;
+
+/**
+ * A sample with the time it was acquired, so the end of the pipeline can
+ * measure the latency.
+ */
+struct Sample {
+    double value;
+    int64_t acqNs;
+};
+
+/** Produces a sample every periodUs microseconds. */
+class SampleInterface {
+    int periodUs;
+    long n;
+
+    public:
+    SampleInterface(int periodUs) : periodUs(periodUs), n(0) {}
+
+    Sample getPacket() {
+        usleep(periodUs);
+        Sample s;
+        s.value = n++;
+        s.acqNs = monotonicNs();
+        return s;
+    }
+};
+
+/** A cheap processing step. */
+class Scale {
+    public:
+    Sample runProcess(Sample& in) {
+        Sample out = in;
+        out.value = in.value * 0.5 + 1.0;
+        return out;
+    }
+};
+
+/** The end of the pipeline: records the latency of every sample. */
+class LatencySink {
+    vector<int64_t> latencies;
+
+    public:
+    LatencySink() {
+        latencies.reserve(100000);
+    }
+
+    Sample runProcess(Sample& in) {
+        latencies.push_back(monotonicNs() - in.acqNs);
+        return in;
+    }
+
+    void print(const char* name) {
+        vector<int64_t> l(latencies);
+        sort(l.begin(), l.end());
+        if (l.empty()) {
+            cout << setw(10) << name << "  no samples" << endl;
+            return;
+        }
+        double sum = 0;
+        for (size_t i = 0; i < l.size(); i++) {
+            sum += l[i];
+        }
+        cout << setw(10) << name << setw(8) << l.size() << fixed <<
+            setprecision(2) << setw(12) << sum / l.size() / 1000 <<
+            setw(12) << l[l.size() / 2] / 1000.0 << setw(12) <<
+            l[l.size() * 99 / 100] / 1000.0 << setw(12) <<
+            l.back() / 1000.0 << endl;
+    }
+};
+
+/**
+ * End-to-end latency (acquisition to the last stage) of the same sensor and
+ * three-stage pipeline, wired at runtime with DataflowGraph and at compile
+ * time with StaticGraph.
+ *
+ * Usage: GraphBench [durationMs] [periodUs]  (defaults 1000, 1000)
+ */
+int main(int argc, char** argv) {
+    int durationMs = 1000;
+    int periodUs = 1000;
+    if (argc > 1) {
+        durationMs = atoi(argv[1]);
+    }
+    if (argc > 2) {
+        periodUs = atoi(argv[2]);
+    }
+    cout << setw(10) << "wiring" << setw(8) << "count" << setw(12) <<
+        "mean(us)" << setw(12) << "p50(us)" << setw(12) << "p99(us)" <<
+        setw(12) << "max(us)" << endl;
+
+    {
+        SampleInterface iface(periodUs);
+        Scale a, b;
+        LatencySink sink;
+        {
+            DataflowGraph g;
+            g.addSource<Sample>("sensor", &iface);
+            g.addStage<Sample, Sample>("a", &a, "sensor");
+            g.addStage<Sample, Sample>("b", &b, "a");
+            g.addStage<Sample, Sample>("sink", &sink, "b");
+            g.start();
+            usleep(durationMs * 1000);
+        }
+        sink.print("runtime");
+    }
+
+    {
+        SampleInterface iface(periodUs);
+        Scale a, b;
+        LatencySink sink;
+        {
+            StaticGraph<Node<SampleInterface>, Stage<Scale>, Stage<Scale>,
+                        Stage<LatencySink> > g(&iface, &a, &b, &sink);
+            g.start();
+            usleep(durationMs * 1000);
+        }
+        sink.print("static");
+    }
+    return 0;
+}
@@ -0,0 +1,159 @@
+#include "DataflowGraph.h"
+#include <iostream>
+
+using namespace std;
+
+/**
+ * Raw inertial reading.
+ */
+struct ImuPacket {
+    double accel;
+    double gyro;
+};
+
+/**
+ * Pose estimate.
+ */
+struct Pose {
+    double heading;
+    long updates;
+};
+
+typedef vector<float> Scan;
+
+/** Simulated IMU at 500 Hz. */
+class ImuInterface {
+    long n;
+
+    public:
+    ImuInterface() : n(0) {}
+
+    ImuPacket getPacket() {
+        usleep(2000);
+        ImuPacket p;
+        p.accel = 0.01 * (n % 7);
+        p.gyro = 0.5 + 0.001 * (n++ % 11);
+        return p;
+    }
+};
+
+/** Simulated laser scanner at 100 Hz. */
+class ScanInterface {
+    public:
+    Scan getPacket() {
+        usleep(10000);
+        return Scan(1080, 4.0f);
+    }
+};
+
+/** Cheap: exponential smoothing of the IMU. */
+class ImuFilter {
+    ImuPacket state;
+
+    public:
+    ImuFilter() {
+        state.accel = 0;
+        state.gyro = 0;
+    }
+
+    ImuPacket runProcess(ImuPacket& in) {
+        state.accel += 0.2 * (in.accel - state.accel);
+        state.gyro += 0.2 * (in.gyro - state.gyro);
+        return state;
+    }
+};
+
+/** Heavy: stands in for an EKF update taking 3 ms. */
+class Ekf {
+    Pose pose;
+
+    public:
+    Ekf() {
+        pose.heading = 0;
+        pose.updates = 0;
+    }
+
+    Pose runProcess(ImuPacket& in) {
+        usleep(3000);
+        pose.heading += in.gyro * 0.002;
+        ++pose.updates;
+        return pose;
+    }
+};
+
+/** Heavy: nearest obstacle in a scan, taking 5 ms. */
+class ObstacleDetector {
+    public:
+    float runProcess(Scan& in) {
+        usleep(5000);
+        float m = in[0];
+        for (size_t i = 1; i < in.size(); i++) {
+            m = min(m, in[i]);
+        }
+        return m;
+    }
+};
+
+/** Cheap: counts poses. */
+class PoseLogger {
+    long count;
+
+    public:
+    PoseLogger() : count(0) {}
+
+    long runProcess(Pose& in) {
+        return ++count;
+    }
+};
+
+/**
+ * A small robot graph: two sensors, two heavy stages with threads of their
+ * own, two cheap ones sharing a thread. Runs for a second and prints the
+ * edge statistics; then shows how a miswired graph is reported.
+ */
+int main() {
+    ImuInterface imu;
+    ScanInterface lidar;
+    ImuFilter filter;
+    Ekf ekf;
+    ObstacleDetector detector;
+    PoseLogger logger;
+
+    {
+        DataflowGraph g;
+        // Declared out of order on purpose; start() sorts them.
+        g.addStage<Pose, long>("logger", &logger, "ekf");
+        g.addStage<ImuPacket, Pose>("ekf", &ekf, "imuFilter", HEAVY);
+        g.addStage<ImuPacket, ImuPacket>("imuFilter", &filter, "imu");
+        g.addStage<Scan, float>("obstacles", &detector, "lidar", HEAVY);
+        g.addSource<ImuPacket>("imu", &imu);
+        g.addSource<Scan>("lidar", &lidar);
+        if (!g.start()) {
+            cout << "start failed: " << g.getError() << endl;
+            return 1;
+        }
+        cout << "start order:";
+        vector<string> order = g.getStartOrder();
+        for (size_t i = 0; i < order.size(); i++) {
+            cout << " " << order[i];
+        }
+        cout << endl << g.getNumWorkers() << " stage threads" << endl;
+
+        usleep(1000000);
+        Pose pose = Pose();
+        float nearest = 0;
+        g.getLatest("ekf", &pose);
+        g.getLatest("obstacles", &nearest);
+        cout << "heading " << pose.heading << " after " << pose.updates <<
+            " updates, nearest obstacle " << nearest << " m" << endl;
+        g.report(cout);
+    }
+
+    DataflowGraph bad;
+    bad.addSource<Scan>("lidar", &lidar);
+    bad.addStage<ImuPacket, Pose>("ekf", &ekf, "lidar");
+    if (!bad.start()) {
+        cout << "miswired graph: " << bad.getError() << endl;
+    }
+    return 0;
+}
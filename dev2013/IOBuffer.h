@@ -4,6 +4,17 @@
 #include <unistd.h>
 #include <sys/time.h>
 #include <utility>
+#include <atomic>
+#include <string>
+
+#include "SyncPolicy.h"
+#include "BufferStatus.h"
+#include "FutexEvent.h"
+#include "ReadyNotifier.h"
+#include "MonotonicClock.h"
+#include "Lineage.h"
+#include "PerfCounters.h"
+#include "ThreadAccounting.h"
 
 using boost::function;
 using boost::bind;
@@ -43,50 +54,67 @@ extern "C" void* pthreadWrapper(void* arg);
  * and operator= defined. In addition, it is recommended that large Packets
  * have sensible move semantics ( operator=(const Packet&& other) )
  *
+ * The optional fourth parameter selects how the input packet is handed to
+ * the processing thread and the output packet to callers; see SyncPolicy.h.
+ * Both go through cells of the policy, stamped with a version (see
+ * VersionedPacket) so that every packet is taken only once; there is no
+ * other lock. Only the default MutexPolicy (and SpinParkPolicy) move the
+ * packets out of the buffer; the other policies copy them, since their
+ * readers may not modify shared state.
+ *
  * TODO This could potentially be done better with unique_ptr functionality,
  * rather than packet move semantics.
  */
-template <class InputPacket, class OutputPacket, class Interface>
+template <class InputPacket, class OutputPacket, class Interface,
+          class SyncPolicy = MutexPolicy>
 class IOBuffer {
 
     private:
-    pthread_mutex_t upfl_mtx;
-    pthread_mutex_t idata_mtx;
-    pthread_mutex_t odata_mtx;
-    pthread_cond_t newipt;
+    FutexEvent newipt_evt;  // providePacket() -> processing thread
+    FutexEvent publish_evt; // processing thread -> waitForOutput()
+    std::atomic<bool> bStop;
+    bool bStarted;
     pthread_t read_thread;
 
     Interface* source;
-    InputPacket ipkt;
-    OutputPacket opkt;
-    bool idata_new; // Also tells whether the object is valid.
-    bool odata_new; // If it's new, it's valid; if it's not, it may be consumed.
+    typename SyncPolicy::template Cell<VersionedPacket<InputPacket> > icell;
+    typename SyncPolicy::template Cell<VersionedPacket<OutputPacket> > ocell;
+    // Versions of the last input provided and taken by the processing
+    // thread, and of the last output taken by a caller. A packet is new,
+    // and valid, while its version is above the one taken.
+    std::atomic<uint64_t> inputVersion;
+    std::atomic<uint64_t> inputTaken;
+    std::atomic<uint64_t> outputTaken;
 
-    bool bUpdating;
+    BufferStatus status;
+    std::atomic<ReadyNotifier*> notifier;
+    int notifyTag;
+    int lineageId;
+    std::atomic<PerfStageStats*> perfStats;
+    std::string threadName;
+    function<void(const OutputPacket&, uint64_t)> publishHook;
     function<void*()>* tfPersistent;
 
     public:
-    IOBuffer(Interface* source) : source(source) {
-        // Multithreading construct initialization and thread spawning
-        pthread_mutex_init(&upfl_mtx, NULL);
-        pthread_mutex_init(&idata_mtx, NULL);
-        pthread_mutex_init(&odata_mtx, NULL);
-        pthread_cond_init(&newpkt_cond, NULL);
-
+    IOBuffer(Interface* source) : bStop(false), bStarted(false),
+                                  source(source), inputVersion(0),
+                                  inputTaken(0), outputTaken(0),
+                                  notifier(NULL), notifyTag(-1),
+                                  lineageId(0), perfStats(NULL),
+                                  threadName("iobuffer") {
         tfPersistent = NULL;
-
-        bUpdating = false;
     }
 
     ~IOBuffer() {
         // Stop the thread and take care of the extra pthreads destruction
-        // requirements
-        pthread_cancel(read_thread);
-        pthread_join(read_thread, NULL);
-
-        pthread_mutex_destroy(&idata_mtx);
-        pthread_mutex_destroy(&odata_mtx);
-        pthread_mutex_destroy(&upfl_mtx);
+        // requirements. The thread may be asleep in a futex wait, which is
+        // not a cancellation point, so wake it up as well.
+        if (bStarted) {
+            bStop.store(true);
+            newipt_evt.notifyAll();
+            pthread_cancel(read_thread);
+            pthread_join(read_thread, NULL);
+        }
 
         delete tfPersistent;
     }
@@ -103,26 +131,72 @@ class IOBuffer {
      * memory leaks.
      */
     void runContinuous() {
-        function<void*()> thrFun = bind(&BufferThread::tmContinuous, this, 0);
+        function<void*()> thrFun = bind(&IOBuffer::tmContinuous, this, 0);
         tfPersistent = new function<void*()>(thrFun);
         pthread_create(&read_thread, NULL, &pthreadWrapper, tfPersistent);
+        bStarted = true;
     }
 
+    /**
+     * Whether the processing thread is running. Wait-free, like the other
+     * status queries below (single atomic loads with acquire semantics).
+     */
     bool isUpdating() {
-        /* This silly dance helps ensure thread safety.
-         *
-         * Yes, this is just a read of a boolean variable, but without the
-         * locks there is no guarantee that this read instruction won't be
-         * reordered by an aggressively optimizing compiler to some place that
-         * makes the program's semantics invalid.
-         *
-         * Trust me, multi-threading is tricky business.
-         */
-        bool retval;
-        pthread_mutex_lock(&upfl_mtx);
-        retval = bUpdating;
-        pthread_mutex_unlock(&upfl_mtx);
-        return retval;
+        return status.isUpdating();
+    }
+
+    /**
+     * The number of output packets published so far.
+     */
+    uint64_t getVersion() {
+        return status.getVersion();
+    }
+
+    /**
+     * Makes the notifier's descriptor readable whenever a new output packet
+     * is published; see BufferThread::attachNotifier().
+     *
+     * @return The tag that identifies this buffer in ReadyNotifier::drain(),
+     *         or -1 if the notifier has no room left.
+     */
+    int attachNotifier(ReadyNotifier* rn) {
+        int tag = rn->addSource();
+        if (tag >= 0) {
+            notifyTag = tag;
+            notifier.store(rn, std::memory_order_release);
+        }
+        return tag;
+    }
+
+    /**
+     * Installs a function that the processing thread calls with every output
+     * packet it is about to publish; see BufferThread::setPublishHook().
+     */
+    void setPublishHook(function<void(const OutputPacket&, uint64_t)> hook) {
+        publishHook = hook;
+    }
+
+    /**
+     * Names the processing thread; see BufferThread::setThreadName().
+     */
+    void setThreadName(const std::string& name) {
+        threadName = name;
+    }
+
+    /**
+     * Measures every runProcess() with the processing thread's performance
+     * counters; see BufferThread::setPerfStats().
+     */
+    void setPerfStats(PerfStageStats* stats) {
+        perfStats.store(stats, std::memory_order_release);
+    }
+
+    /**
+     * Sets the id this buffer records in the lineage of Traced packets (see
+     * Lineage.h). Call before starting the thread.
+     */
+    void setLineageId(int id) {
+        lineageId = id;
     }
 
     /**
@@ -130,11 +204,8 @@ class IOBuffer {
      * so callers can potentially save themselves a copy operation.
      */
     bool isInputUnsed() {
-        bool retval;
-        pthread_mutex_lock(&idata_mtx);
-        retval = idata_new;
-        pthread_mutex_unlock(&idata_mtx);
-        return retval;
+        return inputVersion.load(std::memory_order_acquire) >
+            inputTaken.load(std::memory_order_acquire);
     }
 
     /**
@@ -142,22 +213,45 @@ class IOBuffer {
      * inadvertently get a destroyed packet.
      */
     bool isOutputNew() {
-        bool retval;
-        pthread_mutex_lock(&odata_mtx);
-        retval = odata_new;
-        pthread_mutex_unlock(&odata_mtx);
-        return retval;
+        return status.getVersion() >
+            outputTaken.load(std::memory_order_acquire);
     }
 
-
+    /**
+     * Hands a new input packet to the processing thread, replacing one it
+     * has not taken yet. Like the updater of a cell, only one thread may
+     * provide packets at a time.
+     */
     void providePacket(InputPacket input) {
-        pthread_mutex_lock(&idata_mtx);
+        VersionedPacket<InputPacket> vp;
+        vp.version = inputVersion.load(std::memory_order_relaxed) + 1;
+        vp.ns = IsTraced<OutputPacket>::value ? monotonicNs() : 0;
         // Using move semantics so that the input packet isn't unncecessarily
         // copied
-        ipkt = std::move(input);
-        idata_new = true;
-        pthread_mutex_unlock(&idata_mtx);
-        pthread_cond_signal(&newipt);
+        vp.pkt = std::move(input);
+        uint64_t version = vp.version;
+        icell.store(vp);
+        inputVersion.store(version, std::memory_order_release);
+        // Costs no system call unless the processing thread is asleep.
+        newipt_evt.notifyOne();
+    }
+
+    /**
+     * Blocks until more than the given number of output packets have been
+     * published (see getVersion()), or until timeoutMs milliseconds have
+     * passed.
+     *
+     * @return The current output version; compare with the one passed in to
+     *         find out whether the wait timed out.
+     */
+    uint64_t waitForOutput(uint64_t version, int timeoutMs) {
+        uint32_t key = publish_evt.prepareWait();
+        uint64_t current = status.getVersion();
+        if (current <= version) {
+            publish_evt.waitFor(key, timeoutMs * 1000000LL);
+            current = status.getVersion();
+        }
+        return current;
     }
 
     /**
@@ -166,28 +260,35 @@ class IOBuffer {
      * is left unchanged.
      */
     bool getPacket(OutputPacket* output) {
-        /* All data-access sections must have these lock/unlock guards.
-         * They protect against access to the data while it is being modified.
+        /* All data access goes through the cell, which protects against
+         * access to the data while it is being modified. Each version is
+         * handed to one caller only: with the moving policies the cell
+         * itself sees to that (a packet moved out leaves version 0 behind),
+         * with the copying ones whoever advances outputTaken first.
          */
-        bool retval = true;
-        pthread_mutex_lock(&odata_mtx);
-        if (odata_new) {
-            *output = std::move(opkt);
-            // Important: The buffer's output packet is no longer valid.
-            odata_new = false;
-            retval = true;
-        } else {
-            retval = false;
+        uint64_t taken = outputTaken.load(std::memory_order_acquire);
+        // Nothing new is the common case when polling; don't touch the cell.
+        if (status.getVersion() <= taken) {
+            return false;
         }
-        pthread_mutex_unlock(&odata_mtx);
-
-        return retval;
+        VersionedPacket<OutputPacket> vp;
+        ocell.consume(vp);
+        while (vp.version > taken) {
+            if (outputTaken.compare_exchange_weak(taken, vp.version,
+                                                  std::memory_order_acq_rel)) {
+                *output = std::move(vp.pkt);
+                if (IsTraced<OutputPacket>::value) {
+                    lineagePolled(*output, monotonicNs());
+                }
+                return true;
+            }
+        }
+        return false;
     }
 
     /**
      * The updater thread function for continuous operation. Again, this
-     * function is not meant to return; it simply runs until the thread
-     * is canceled.
+     * function runs until the buffer is destroyed.
      *
      * \param intervalMs The minimum time between updates. If zero, the updates
      *        will immediately follow one another.
@@ -199,32 +300,67 @@ class IOBuffer {
     void* tmContinuous(int intervalMs) {
         // Basically the same as above, only we don't wait for readData.
 
-        InputPacket ipkl; // Thread-local packets
-        OutputPacket opkl;
-        // We're constantly updating, so this flag just stays true.
-        pthread_mutex_lock(&upfl_mtx);
-        bUpdating = true;
-        pthread_mutex_unlock(&upfl_mtx);
+        ThreadRegistration reg(threadName);
+        VersionedPacket<InputPacket> ivp; // Thread-local packets
+        VersionedPacket<OutputPacket> ovp;
+        PerfProbe probe;
+        // We're constantly updating, so the status just stays UPDATING.
+        status.setUpdating();
 
         while (true) {
 
-            // Consume the input packet. This operation invalidates the
-            // existing InputPacket.
-            pthread_mutex_lock(&ipkt);
-            while (!idata_new) {
-                pthread_cond_wait(&newipt)
+            // Wait for an input packet newer than the last one taken.
+            uint64_t taken = inputTaken.load(std::memory_order_relaxed);
+            while (true) {
+                uint32_t key = newipt_evt.prepareWait();
+                if (bStop.load()) {
+                    return NULL;
+                }
+                if (inputVersion.load(std::memory_order_acquire) > taken) {
+                    break;
+                }
+                newipt_evt.wait(key);
             }
-            ipkl = std::move(ipkt);
-            idata_new = false;
-            pthread_mutex_unlock(&ipkt);
 
-            opkl = source->runProcess(ipkl);
+            // Consume the input packet. This operation may invalidate the
+            // buffer's InputPacket.
+            icell.consume(ivp);
+            if (ivp.version <= taken) {
+                continue;
+            }
+            inputTaken.store(ivp.version, std::memory_order_release);
+            InputPacket& ipkl = ivp.pkt;
+            OutputPacket& opkl = ovp.pkt;
+            int64_t inNs = ivp.ns;
+
+            int64_t startNs = IsTraced<OutputPacket>::value ?
+                monotonicNs() : 0;
+            PerfStageStats* ps = perfStats.load(std::memory_order_acquire);
+            if (ps != NULL) {
+                probe.begin();
+                opkl = source->runProcess(ipkl);
+                probe.end(ps);
+            } else {
+                opkl = source->runProcess(ipkl);
+            }
+            if (IsTraced<OutputPacket>::value) {
+                lineageHop(opkl, lineageId, status.getVersion() + 1, inNs,
+                           startNs, monotonicNs());
+            }
+            if (publishHook) {
+                // Before the store, which may move the packet away.
+                publishHook(opkl, status.getVersion() + 1);
+            }
 
-            pthread_mutex_lock(&odata_mtx);
-            // Update cached packet, mark it new and valid.
-            opkt = std::move(opkl);
-            odata_new = true;
-            pthread_mutex_unlock(&odata_mtx);
+            // Update cached packet; its version makes it new and valid.
+            ovp.version = status.getVersion() + 1;
+            ocell.store(ovp);
+            status.publish(true);
+            publish_evt.notifyAll();
+            ReadyNotifier* rn = notifier.load(std::memory_order_acquire);
+            if (rn != NULL) {
+                rn->markReady(notifyTag);
+            }
 
             // Cancellation point, just to be sure
             // TODO add timed loop capability
@@ -235,3 +371,4 @@ class IOBuffer {
     }
 };
 
+#endif
@@ -0,0 +1,129 @@
+#include "BufferThreadedP.h"
+#include "IOBuffer.h"
+#include "LatencyHarness.h"
+#include <iostream>
+
+using namespace std;
+
+/**
+ * Raw inertial reading.
+ */
+struct ImuPacket {
+    double gyro;
+};
+
+/**
+ * Attitude estimate.
+ */
+struct Attitude {
+    double heading;
+};
+
+/**
+ * Nearest obstacle from a laser scan.
+ */
+struct RangePacket {
+    double nearest;
+};
+
+/** Simulated IMU at 200 Hz. */
+class ImuInterface {
+    long n;
+
+    public:
+    ImuInterface() : n(0) {}
+
+    ImuPacket getPacket() {
+        usleep(5000);
+        ImuPacket p = {(++n % 10) * 0.01};
+        return p;
+    }
+};
+
+/** Simulated laser scanner at 20 Hz. */
+class LidarInterface {
+    public:
+    RangePacket getPacket() {
+        usleep(50000);
+        RangePacket p = {2.5};
+        return p;
+    }
+};
+
+/** Integrates the gyro; takes about a millisecond. */
+class AttitudeFilter {
+    double heading;
+
+    public:
+    AttitudeFilter() : heading(0) {}
+
+    Attitude runProcess(ImuPacket& in) {
+        int64_t until = monotonicNs() + 1000000;
+        while (monotonicNs() < until) {
+            heading += in.gyro * 1e-6;
+        }
+        Attitude a = {heading};
+        return a;
+    }
+};
+
+typedef Traced<ImuPacket> TImu;
+typedef Traced<Attitude> TAttitude;
+typedef Traced<RangePacket> TRange;
+
+/**
+ * A 100 Hz control loop driven by an IMU -> attitude filter chain and a
+ * laser scanner, with the lineage of every command fed to LatencyHarness.
+ */
+int main(int argc, char** argv) {
+    ImuInterface imu;
+    LidarInterface lidar;
+    AttitudeFilter filter;
+    TracedSource<ImuInterface> tImu(&imu);
+    TracedSource<LidarInterface> tLidar(&lidar);
+    TracedStage<AttitudeFilter> tFilter(&filter);
+
+    BufferThread<TImu, TracedSource<ImuInterface> > imuBuf(&tImu);
+    BufferThread<TRange, TracedSource<LidarInterface> > lidarBuf(&tLidar);
+    IOBuffer<TImu, TAttitude, TracedStage<AttitudeFilter> >
+        filterBuf(&tFilter);
+    imuBuf.setLineageId(1);
+    lidarBuf.setLineageId(2);
+    filterBuf.setLineageId(3);
+
+    LatencyHarness harness(1000, vector<double>{0.5, 0.9, 0.99});
+    harness.setName(1, "imu");
+    harness.setName(2, "lidar");
+    harness.setName(3, "attitude");
+
+    imuBuf.runContinuous();
+    lidarBuf.runContinuous();
+    filterBuf.runContinuous();
+
+    uint64_t imuSeen = 0;
+    uint64_t lidarSeen = 0;
+    TRange range;
+    int64_t end = monotonicNs() + 3000000000LL;
+    while (monotonicNs() < end) {
+        if (imuBuf.getVersion() != imuSeen) {
+            imuSeen = imuBuf.getVersion();
+            filterBuf.providePacket(imuBuf.getPacket());
+        }
+        if (lidarBuf.getVersion() != lidarSeen) {
+            lidarSeen = lidarBuf.getVersion();
+            range = lidarBuf.getPacket();
+            // Obstacle check, straight from the scanner.
+            harness.record(range);
+        }
+        TAttitude att;
+        if (filterBuf.getPacket(&att)) {
+            // The steering command uses both the attitude and the scan.
+            att.lineage.mergeSources(range.lineage);
+            harness.record(att);
+        }
+        usleep(10000);
+    }
+
+    harness.report(cout);
+    return 0;
+}
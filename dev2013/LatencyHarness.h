@@ -0,0 +1,264 @@
+#include <pthread.h>
+#include <cstdio>
+#include <map>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "Lineage.h"
+#include "MonotonicClock.h"
+#include "WindowAggregator.h"
+
+// Header guards -- this file may be included more than once.
+#ifndef LATENCYHARNESS_H_
+#define LATENCYHARNESS_H_
+
+/**
+ * The parts of the end-to-end latency of a path; see LatencyHarness.
+ */
+enum LatencyPart {
+    LATENCY_TOTAL,       /**< Acquisition start to the consumer */
+    LATENCY_ACQUISITION, /**< Talking to the sensor */
+    LATENCY_POLL_WAIT,   /**< Published, but not taken by a reader yet */
+    LATENCY_QUEUEING,    /**< Taken, but not being processed yet */
+    LATENCY_PROCESSING,  /**< In the stages' runProcess() */
+    NUM_LATENCY_PARTS
+};
+
+/**
+ * Latency distributions of one path, as reported by LatencyHarness.
+ */
+struct PathLatency {
+    std::string path;  /**< E.g. "imu -> attitude" */
+    WindowStats parts[NUM_LATENCY_PARTS]; /**< In microseconds */
+    WindowStats dataAge; /**< Of the oldest source, in microseconds */
+};
+
+/**
+ * Measures how old the sensor data behind each output of the system (a
+ * motor command, say) is, from the lineage of the packet it was computed
+ * from (see Lineage.h):
+ *
+ *     LatencyHarness harness;
+ *     harness.setName(1, "imu");
+ *     harness.setName(2, "attitude");
+ *     ...
+ *     Traced<Attitude> att;
+ *     if (filterBuf.getPacket(&att)) {
+ *         motors.command(controller.update(att.pkt));
+ *         harness.record(att);
+ *     }
+ *     ...
+ *     harness.report(cout);
+ *
+ * Records are grouped by path, the sequence of buffers the packet passed
+ * through. For each path the harness keeps sliding-window distributions
+ * (see WindowAggregator) of the end-to-end latency, from the start of the
+ * acquisition to the call of record(), and of the parts it is made of:
+ *
+ *   - acquisition: the sensor buffer talking to the sensor;
+ *   - poll wait: packets sitting in a buffer until a reader takes them;
+ *   - queueing: packets taken, but waiting (in the caller or in an
+ *     IOBuffer's input slot) for processing to start, and the consumer's
+ *     own time until record();
+ *   - processing: the stages' runProcess().
+ *
+ * The parts add up to the total. The data age is measured from the oldest
+ * source instead; it differs from the total for packets merging several
+ * inputs (see Lineage::mergeSources()).
+ *
+ * record() may be called from any thread; it takes a mutex.
+ */
+class LatencyHarness {
+
+    private:
+    struct Path {
+        std::string name;
+        WindowAggregator* parts[NUM_LATENCY_PARTS];
+        WindowAggregator* dataAge;
+    };
+
+    pthread_mutex_t mtx;
+    std::map<int, std::string> names;
+    std::map<std::vector<int>, Path*> paths;
+    size_t windowSize;
+    std::vector<double> quantiles;
+
+    LatencyHarness(const LatencyHarness&);
+    LatencyHarness& operator=(const LatencyHarness&);
+
+    WindowAggregator* newAggregator() {
+        return new WindowAggregator(windowSize, quantiles, 0.01, 1e-3, 1e8);
+    }
+
+    std::string nameOf(int id) {
+        std::map<int, std::string>::iterator it = names.find(id);
+        if (it != names.end()) {
+            return it->second;
+        }
+        std::ostringstream ss;
+        ss << "#" << id;
+        return ss.str();
+    }
+
+    Path* pathOf(const Lineage& l) {
+        std::vector<int> ids;
+        for (int i = 0; i < l.numHops; i++) {
+            ids.push_back(l.hops[i].bufferId);
+        }
+        std::map<std::vector<int>, Path*>::iterator it = paths.find(ids);
+        if (it != paths.end()) {
+            return it->second;
+        }
+        Path* p = new Path();
+        for (size_t i = 0; i < ids.size(); i++) {
+            p->name += (i > 0 ? " -> " : "") + nameOf(ids[i]);
+        }
+        for (int i = 0; i < NUM_LATENCY_PARTS; i++) {
+            p->parts[i] = newAggregator();
+        }
+        p->dataAge = newAggregator();
+        paths[ids] = p;
+        return p;
+    }
+
+    public:
+    /**
+     * @param windowSize Number of records per path the distributions cover.
+     * @param quantiles The quantiles to report.
+     */
+    LatencyHarness(size_t windowSize = 1000,
+                   const std::vector<double>& quantiles =
+                       std::vector<double>{0.5, 0.99}) :
+                   windowSize(windowSize), quantiles(quantiles) {
+        pthread_mutex_init(&mtx, NULL);
+    }
+
+    ~LatencyHarness() {
+        std::map<std::vector<int>, Path*>::iterator it;
+        for (it = paths.begin(); it != paths.end(); ++it) {
+            for (int i = 0; i < NUM_LATENCY_PARTS; i++) {
+                delete it->second->parts[i];
+            }
+            delete it->second->dataAge;
+            delete it->second;
+        }
+        pthread_mutex_destroy(&mtx);
+    }
+
+    /**
+     * Names a buffer id (see BufferThread::setLineageId()) for the report.
+     * Call before the first record().
+     */
+    void setName(int id, const std::string& name) {
+        pthread_mutex_lock(&mtx);
+        names[id] = name;
+        pthread_mutex_unlock(&mtx);
+    }
+
+    /**
+     * Records that the output derived from a packet with the given lineage
+     * took effect at nowNs (see monotonicNs()).
+     */
+    void record(const Lineage& l, int64_t nowNs) {
+        if (l.numHops == 0) {
+            return;
+        }
+        int64_t parts[NUM_LATENCY_PARTS] = {0};
+        const LineageHop* h = l.hops;
+        parts[LATENCY_ACQUISITION] = h[0].publishNs - h[0].startNs;
+        for (int i = 0; i < l.numHops; i++) {
+            // A packet handed on without going through getPacket() counts
+            // as taken when it was handed on.
+            int64_t next = i + 1 < l.numHops ? h[i + 1].inNs : nowNs;
+            int64_t polled = h[i].polledNs != 0 ? h[i].polledNs : next;
+            parts[LATENCY_POLL_WAIT] += polled - h[i].publishNs;
+            if (i + 1 < l.numHops) {
+                parts[LATENCY_QUEUEING] += h[i + 1].startNs - polled;
+                parts[LATENCY_PROCESSING] +=
+                    h[i + 1].publishNs - h[i + 1].startNs;
+            } else {
+                parts[LATENCY_QUEUEING] += nowNs - polled;
+            }
+        }
+        parts[LATENCY_TOTAL] = nowNs - h[0].startNs;
+
+        pthread_mutex_lock(&mtx);
+        Path* p = pathOf(l);
+        for (int i = 0; i < NUM_LATENCY_PARTS; i++) {
+            p->parts[i]->add(parts[i] / 1000.0);
+        }
+        p->dataAge->add((nowNs - l.oldestAcqNs()) / 1000.0);
+        pthread_mutex_unlock(&mtx);
+    }
+
+    /**
+     * Records that the output derived from a packet took effect now.
+     */
+    template <class Packet>
+    void record(const Traced<Packet>& pkt) {
+        record(pkt.lineage, monotonicNs());
+    }
+
+    /**
+     * The distributions of every path seen so far.
+     */
+    std::vector<PathLatency> getPaths() {
+        std::vector<PathLatency> st;
+        pthread_mutex_lock(&mtx);
+        std::map<std::vector<int>, Path*>::iterator it;
+        for (it = paths.begin(); it != paths.end(); ++it) {
+            PathLatency pl;
+            pl.path = it->second->name;
+            for (int i = 0; i < NUM_LATENCY_PARTS; i++) {
+                pl.parts[i] = it->second->parts[i]->getStats();
+            }
+            pl.dataAge = it->second->dataAge->getStats();
+            st.push_back(pl);
+        }
+        pthread_mutex_unlock(&mtx);
+        return st;
+    }
+
+    /**
+     * Prints the distributions of every path as a table.
+     */
+    void report(std::ostream& os) {
+        static const char* partNames[] = {"total", "acquisition",
+                                          "poll wait", "queueing",
+                                          "processing"};
+        std::vector<PathLatency> st = getPaths();
+        for (size_t i = 0; i < st.size(); i++) {
+            os << st[i].path << " (" << st[i].parts[LATENCY_TOTAL].total
+                << " records)" << std::endl;
+            os << "                 mean(us)   max(us)";
+            for (int q = 0; q < st[i].parts[0].numQuantiles; q++) {
+                char label[16];
+                char head[32];
+                snprintf(label, sizeof(label), "p%g",
+                         st[i].parts[0].probs[q] * 100);
+                snprintf(head, sizeof(head), " %9s", label);
+                os << head;
+            }
+            os << std::endl;
+            for (int p = 0; p <= NUM_LATENCY_PARTS; p++) {
+                const WindowStats& ws = p < NUM_LATENCY_PARTS ?
+                    st[i].parts[p] : st[i].dataAge;
+                char line[64];
+                snprintf(line, sizeof(line), "  %-12s %10.1f %9.1f",
+                         p < NUM_LATENCY_PARTS ? partNames[p] : "data age",
+                         ws.mean, ws.max);
+                os << line;
+                for (int q = 0; q < ws.numQuantiles; q++) {
+                    snprintf(line, sizeof(line), " %9.1f", ws.quantiles[q]);
+                    os << line;
+                }
+                os << std::endl;
+            }
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,66 @@
+#include "BufferThreadedP.h"
+#include <cstdio>
+#include <vector>
+
+using namespace std;
+
+/** A large packet: a 512 kB point cloud, as a depth camera delivers. */
+typedef vector<float> Cloud;
+
+/** Simulated depth camera, publishing a new cloud every 5 ms. */
+class CloudSensor {
+    size_t n;
+    float frame;
+
+    public:
+    CloudSensor(size_t n) : n(n), frame(0) {}
+
+    Cloud getPacket() {
+        usleep(5000);
+        return Cloud(n, ++frame);
+    }
+};
+
+/**
+ * Times reading one element and the size of the packet through getPacket()
+ * and through lease(), for one sync policy, and prints the lease stats.
+ */
+template <class Policy>
+void bench(const char* name, int rounds) {
+    CloudSensor sensor(128 * 1024);
+    BufferThread<Cloud, CloudSensor, Policy> buf(&sensor);
+    buf.runContinuous();
+    buf.waitForVersion(0);
+
+    double sum = 0;
+    int64_t start = monotonicNs();
+    for (int i = 0; i < rounds; i++) {
+        Cloud c = buf.getPacket();
+        sum += c[i % c.size()] + c.size();
+    }
+    double copyNs = (double) (monotonicNs() - start) / rounds;
+
+    start = monotonicNs();
+    for (int i = 0; i < rounds; i++) {
+        PacketLease<Cloud> lease = buf.lease();
+        sum += (*lease)[i % lease->size()] + lease->size();
+    }
+    double leaseNs = (double) (monotonicNs() - start) / rounds;
+
+    LeaseStats st = buf.getLeaseStats();
+    printf("%-12s getPacket() %9.0f ns  lease() %9.0f ns  (%llu leases, "
+           "mean %.0f ns, max %lld ns held)%s\n", name, copyNs, leaseNs,
+           (unsigned long long) st.count,
+           st.count > 0 ? (double) st.totalNs / st.count : 0.0,
+           (long long) st.maxNs, sum < 0 ? "!" : "");
+}
+
+/**
+ * Compares copying a large packet with leasing it. Only RcuPolicy leases
+ * without copying; with MutexPolicy a lease is a heap copy.
+ */
+int main(int argc, char** argv) {
+    bench<MutexPolicy>("MutexPolicy", 2000);
+    bench<RcuPolicy>("RcuPolicy", 2000);
+    return 0;
+}
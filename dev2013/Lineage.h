@@ -0,0 +1,203 @@
+#include <type_traits>
+#include <utility>
+#include <stdint.h>
+
+// Header guards -- this file may be included more than once.
+#ifndef LINEAGE_H_
+#define LINEAGE_H_
+
+/** Most sensor readings a Lineage records. */
+const int MAX_LINEAGE_SOURCES = 4;
+
+/** Most buffers a Lineage records along its path. */
+const int MAX_LINEAGE_HOPS = 8;
+
+/**
+ * A sensor reading a packet was derived from.
+ */
+struct LineageSource {
+    int bufferId;      /**< See BufferThread::setLineageId() */
+    uint64_t seq;      /**< The version the buffer published it as */
+    int64_t acqStartNs; /**< Acquisition start (see monotonicNs()) */
+    int64_t acqEndNs;   /**< Acquisition end, i.e. publication */
+};
+
+/**
+ * One buffer a packet passed through, with the times (see monotonicNs()) at
+ * which it got there. For a sensor buffer, inNs and startNs are both the
+ * start of the acquisition.
+ */
+struct LineageHop {
+    int bufferId;
+    uint64_t seq;      /**< The version the buffer published */
+    int64_t inNs;      /**< The input was handed to the buffer */
+    int64_t startNs;   /**< Processing of the input started */
+    int64_t publishNs; /**< The result was published */
+    int64_t polledNs;  /**< A reader took the result; 0 if none yet */
+};
+
+/**
+ * Where a packet came from: the sensor readings it was derived from and the
+ * buffers it passed through on the way, with timestamps. Trivially
+ * copyable, so it travels with the packet at the cost of a copy.
+ */
+struct Lineage {
+    int numSources;
+    LineageSource sources[MAX_LINEAGE_SOURCES];
+    int numHops;
+    LineageHop hops[MAX_LINEAGE_HOPS];
+
+    /** The start of the oldest acquisition, or 0 if there is none. */
+    int64_t oldestAcqNs() const {
+        int64_t oldest = 0;
+        for (int i = 0; i < numSources; i++) {
+            if (oldest == 0 || sources[i].acqStartNs < oldest) {
+                oldest = sources[i].acqStartNs;
+            }
+        }
+        return oldest;
+    }
+
+    /**
+     * Adds the sources of another lineage, for a packet combining several
+     * inputs. The hops stay those of this lineage, which should be the one
+     * of the input that determines the path of interest.
+     */
+    void mergeSources(const Lineage& other) {
+        for (int i = 0; i < other.numSources &&
+                 numSources < MAX_LINEAGE_SOURCES; i++) {
+            sources[numSources++] = other.sources[i];
+        }
+    }
+};
+
+/**
+ * A packet together with its lineage. Buffers of Traced packets stamp the
+ * lineage as the packet moves along, without either the sensor interfaces
+ * or the stages having to know about it (see TracedSource and
+ * TracedStage):
+ *
+ *     TracedSource<ImuInterface> tracedImu(&imu);
+ *     BufferThread<Traced<ImuPacket>, TracedSource<ImuInterface> >
+ *         imuBuf(&tracedImu);
+ *     TracedStage<AttitudeFilter> tracedFilter(&filter);
+ *     IOBuffer<Traced<ImuPacket>, Traced<Attitude>,
+ *              TracedStage<AttitudeFilter> > filterBuf(&tracedFilter);
+ *     imuBuf.setLineageId(1);
+ *     filterBuf.setLineageId(2);
+ *
+ * The lineage of every packet a reader gets then tells how old the sensor
+ * data behind it is and where that time went; see LatencyHarness.
+ */
+template <class Packet>
+struct Traced {
+    Packet pkt;
+    Lineage lineage;
+
+    Traced() : pkt(), lineage() {}
+};
+
+/**
+ * Adapts a sensor interface to a buffer of Traced packets.
+ */
+template <class Interface>
+class TracedSource {
+    Interface* iface;
+
+    public:
+    TracedSource(Interface* iface) : iface(iface) {}
+
+    typedef typename std::decay<decltype(
+        std::declval<Interface&>().getPacket())>::type Packet;
+
+    Traced<Packet> getPacket() {
+        Traced<Packet> t;
+        t.pkt = iface->getPacket();
+        return t;
+    }
+};
+
+/**
+ * Adapts a processing stage to an IOBuffer of Traced packets. The output
+ * inherits the lineage of the input; the IOBuffer adds its own hop.
+ */
+template <class Stage>
+class TracedStage {
+    Stage* stage;
+
+    public:
+    TracedStage(Stage* stage) : stage(stage) {}
+
+    template <class In>
+    Traced<typename std::decay<decltype(std::declval<Stage&>().runProcess(
+        std::declval<In&>()))>::type> runProcess(Traced<In>& in) {
+        Traced<typename std::decay<decltype(std::declval<Stage&>()
+            .runProcess(std::declval<In&>()))>::type> out;
+        out.pkt = stage->runProcess(in.pkt);
+        out.lineage = in.lineage;
+        return out;
+    }
+};
+
+/*
+ * Stamping functions called by the buffers. They do nothing for plain
+ * packets, so buffers of those pay nothing; the overloads for Traced
+ * packets do the work.
+ */
+
+/** A sensor buffer publishes a packet: starts a new lineage. */
+template <class Packet>
+inline void lineageSource(Packet&, int, uint64_t, int64_t, int64_t) {}
+
+template <class Packet>
+inline void lineageSource(Traced<Packet>& p, int bufferId, uint64_t seq,
+                          int64_t acqStartNs, int64_t acqEndNs) {
+    LineageSource src = {bufferId, seq, acqStartNs, acqEndNs};
+    LineageHop hop = {bufferId, seq, acqStartNs, acqStartNs, acqEndNs, 0};
+    p.lineage.numSources = 1;
+    p.lineage.sources[0] = src;
+    p.lineage.numHops = 1;
+    p.lineage.hops[0] = hop;
+}
+
+/** A processing buffer publishes a packet: adds its hop. */
+template <class Packet>
+inline void lineageHop(Packet&, int, uint64_t, int64_t, int64_t, int64_t) {}
+
+template <class Packet>
+inline void lineageHop(Traced<Packet>& p, int bufferId, uint64_t seq,
+                       int64_t inNs, int64_t startNs, int64_t publishNs) {
+    Lineage& l = p.lineage;
+    LineageHop hop = {bufferId, seq, inNs, startNs, publishNs, 0};
+    if (l.numHops < MAX_LINEAGE_HOPS) {
+        l.hops[l.numHops++] = hop;
+    } else {
+        // Keep the latest hop, at the expense of the one before it.
+        l.hops[MAX_LINEAGE_HOPS - 1] = hop;
+    }
+}
+
+/** A reader got its copy of a packet. */
+template <class Packet>
+inline void lineagePolled(Packet&, int64_t) {}
+
+template <class Packet>
+inline void lineagePolled(Traced<Packet>& p, int64_t ns) {
+    if (p.lineage.numHops > 0 && p.lineage.hops[p.lineage.numHops - 1]
+            .polledNs == 0) {
+        p.lineage.hops[p.lineage.numHops - 1].polledNs = ns;
+    }
+}
+
+/** Whether lineage is tracked for a packet type at all. */
+template <class Packet>
+struct IsTraced {
+    static const bool value = false;
+};
+
+template <class Packet>
+struct IsTraced<Traced<Packet> > {
+    static const bool value = true;
+};
+
+#endif
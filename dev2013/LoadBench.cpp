@@ -0,0 +1,144 @@
+#include "BufferThreadedP.h"
+#include "ControlLoop.h"
+#include "LoadGenerator.h"
+#include "WindowAggregator.h"
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+
+using namespace std;
+
+typedef BufferThread<SynthPacket, SynthInterface> SynthBuffer;
+
+/**
+ * What the main loop sees of one stream.
+ */
+struct StreamView {
+    SynthInterface* iface;
+    SynthBuffer* buf;
+    uint64_t lastSeq;
+    uint64_t consumed;
+    uint64_t bytes;
+    WindowAggregator* ageUs;
+};
+
+/**
+ * The gather phase of the main loop: takes the newest packet of every
+ * stream that has one, and the status values that changed.
+ */
+class Consumer {
+    vector<StreamView>* views;
+    StatusStore<SynthStatus>* store;
+    uint64_t statusSeen;
+    vector<StatusStore<SynthStatus>::Entry> changed;
+
+    public:
+    uint64_t statusRead;
+    WindowAggregator statusAgeUs;
+
+    Consumer(vector<StreamView>* views, StatusStore<SynthStatus>* store,
+             const vector<double>& probs) : views(views), store(store),
+             statusSeen(0), statusRead(0), statusAgeUs(10000, probs, 0.01,
+                                                       1e-3, 1e8) {}
+
+    void gather() {
+        int64_t now = monotonicNs();
+        for (size_t i = 0; i < views->size(); i++) {
+            StreamView& v = (*views)[i];
+            if (v.buf->getVersion() == v.lastSeq) {
+                continue;
+            }
+            SynthPacket p = v.buf->getPacket();
+            if (p.getSeq() == v.lastSeq) {
+                continue;
+            }
+            v.lastSeq = p.getSeq();
+            ++v.consumed;
+            v.bytes += p.getPayload().size();
+            v.ageUs->add((now - p.getSampleNs()) / 1e3);
+        }
+        changed.clear();
+        statusSeen = store->changedSince(statusSeen, changed);
+        for (size_t i = 0; i < changed.size(); i++) {
+            statusAgeUs.add((now - changed[i].value.setNs) / 1e3);
+        }
+        statusRead += changed.size();
+    }
+};
+
+/**
+ * Drives the buffers with the production traffic mix (optionally scaled)
+ * for a few seconds, read by a 100 Hz main loop, and reports what the
+ * loop got out of them: packets, bandwidth, and the age of the data when
+ * the loop took it.
+ *
+ * Usage: LoadBench [rate factor] [seconds]
+ */
+int main(int argc, char** argv) {
+    double factor = argc > 1 ? atof(argv[1]) : 1.0;
+    int seconds = argc > 2 ? atoi(argv[2]) : 5;
+    WorkloadProfile profile = WorkloadProfile::production();
+    profile.scaleRates(factor);
+    printf("Traffic: %.1f MB/s in %zu streams, %zu status values at "
+           "%.0f Hz\n", profile.bytesPerSecond() / 1e6,
+           profile.streams.size(), profile.status.numKeys,
+           profile.status.rateHz);
+
+    vector<double> probs;
+    probs.push_back(0.5);
+    probs.push_back(0.99);
+    vector<StreamView> views;
+    for (size_t i = 0; i < profile.streams.size(); i++) {
+        StreamView v;
+        v.iface = new SynthInterface(profile.streams[i], i + 1);
+        v.buf = new SynthBuffer(v.iface);
+        v.buf->setThreadName(profile.streams[i].name);
+        v.lastSeq = 0;
+        v.consumed = 0;
+        v.bytes = 0;
+        v.ageUs = new WindowAggregator(10000, probs, 0.01, 1e-3, 1e8);
+        views.push_back(v);
+    }
+    StatusStore<SynthStatus> store(profile.status.numKeys * 2);
+    StatusLoad status(&store, profile.status);
+    Consumer consumer(&views, &store, probs);
+
+    ControlLoop loop(10000000);
+    loop.addStep(PHASE_GATHER, "gather", bind(&Consumer::gather, &consumer));
+
+    for (size_t i = 0; i < views.size(); i++) {
+        views[i].buf->runContinuous();
+    }
+    status.start();
+    loop.start();
+    usleep(seconds * 1000000);
+    // Both join their threads, so nothing touches the buffers, the store or
+    // the consumer's counters while they are reported and deleted.
+    loop.stop();
+    status.stop();
+
+    printf("%-10s %9s %9s %10s %10s %10s %10s\n", "stream", "produced",
+           "taken", "kB/s", "age p50", "age p99", "age max");
+    for (size_t i = 0; i < views.size(); i++) {
+        StreamView& v = views[i];
+        WindowStats st = v.ageUs->getStats();
+        printf("%-10s %9llu %9llu %10.1f %8.0fus %8.0fus %8.0fus\n",
+               profile.streams[i].name.c_str(),
+               (unsigned long long) v.buf->getVersion(),
+               (unsigned long long) v.consumed, v.bytes / 1e3 / seconds,
+               st.quantiles[0], st.quantiles[1], st.max);
+    }
+    WindowStats st = consumer.statusAgeUs.getStats();
+    printf("%-10s %9llu %9llu %10s %8.0fus %8.0fus %8.0fus\n", "status",
+           (unsigned long long) status.getPuts(),
+           (unsigned long long) consumer.statusRead, "-", st.quantiles[0],
+           st.quantiles[1], st.max);
+    loop.report(cout);
+
+    for (size_t i = 0; i < views.size(); i++) {
+        delete views[i].buf;
+        delete views[i].iface;
+        delete views[i].ageUs;
+    }
+    return 0;
+}
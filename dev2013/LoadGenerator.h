@@ -0,0 +1,342 @@
+#include <pthread.h>
+#include <boost/function.hpp>
+#include <boost/bind.hpp>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <sys/time.h>
+#include <time.h>
+
+#include "BufferThreadedP.h"
+#include "MonotonicClock.h"
+#include "StatusStore.h"
+#include "ThreadAccounting.h"
+
+// Header guards -- this file may be included more than once.
+#ifndef LOADGENERATOR_H_
+#define LOADGENERATOR_H_
+
+/**
+ * The traffic of one synthetic sensor. Samples are taken every period
+ * (with some jitter), occasionally in bursts, and each is delivered after
+ * an acquisition latency drawn from a log-normal distribution, the usual
+ * shape of transfer and driver delays: mostly close to the median, with a
+ * long tail.
+ */
+struct StreamSpec {
+    std::string name;
+    double rateHz;
+    size_t sizeBytes;      /**< Mean packet size */
+    double sizeSpread;     /**< Relative standard deviation of the size */
+    double periodJitter;   /**< Standard deviation, as a fraction of the
+                                period */
+    double burstProb;      /**< Chance of a sample starting a burst */
+    int burstLen;          /**< Samples in a burst, delivered together */
+    int64_t latencyNs;     /**< Median acquisition latency */
+    double latencySigma;   /**< Sigma of log(latency) */
+
+    StreamSpec(const std::string& name = "", double rateHz = 10,
+               size_t sizeBytes = 64, double sizeSpread = 0,
+               double periodJitter = 0, double burstProb = 0,
+               int burstLen = 1, int64_t latencyNs = 0,
+               double latencySigma = 0) : name(name), rateHz(rateHz),
+               sizeBytes(sizeBytes), sizeSpread(sizeSpread),
+               periodJitter(periodJitter), burstProb(burstProb),
+               burstLen(burstLen), latencyNs(latencyNs),
+               latencySigma(latencySigma) {}
+};
+
+/**
+ * The status values: numKeys values, each updated about rateHz times a
+ * second, in batches of batchSize.
+ */
+struct StatusSpec {
+    size_t numKeys;
+    double rateHz;
+    size_t batchSize;
+
+    StatusSpec(size_t numKeys = 0, double rateHz = 10,
+               size_t batchSize = 16) : numKeys(numKeys), rateHz(rateHz),
+               batchSize(batchSize) {}
+};
+
+/**
+ * A traffic mix: some packet streams and some status values.
+ */
+struct WorkloadProfile {
+    std::vector<StreamSpec> streams;
+    StatusSpec status;
+
+    /**
+     * The robot's traffic in competition: a 40 Hz LIDAR scan of 1080
+     * beams, 30 fps VGA frames, a 200 Hz IMU, 50 Hz wheel odometry and 300
+     * status values at 10 Hz.
+     */
+    static WorkloadProfile production() {
+        WorkloadProfile p;
+        // 1080 float ranges plus 1080 byte intensities and a header.
+        p.streams.push_back(StreamSpec("lidar", 40, 1080 * 5 + 32, 0,
+                                       0.01, 0, 1, 2000000, 0.3));
+        // RGB frames; MJPEG-size variation, USB transfers that bunch up.
+        p.streams.push_back(StreamSpec("camera", 30, 640 * 480 * 3, 0.05,
+                                       0.05, 0.05, 3, 8000000, 0.5));
+        // The IMU shares a USB hub and arrives in batches of four.
+        p.streams.push_back(StreamSpec("imu", 200, 64, 0, 0.02, 0.25, 4,
+                                       500000, 0.4));
+        p.streams.push_back(StreamSpec("odometry", 50, 48, 0, 0.02, 0, 1,
+                                       1000000, 0.3));
+        p.status = StatusSpec(300, 10, 16);
+        return p;
+    }
+
+    /**
+     * Multiplies all rates by factor, to see where the buffers give out.
+     */
+    void scaleRates(double factor) {
+        for (size_t i = 0; i < streams.size(); i++) {
+            streams[i].rateHz *= factor;
+        }
+        status.rateHz *= factor;
+    }
+
+    /** Bytes per second the packet streams produce on average. */
+    double bytesPerSecond() const {
+        double b = 0;
+        for (size_t i = 0; i < streams.size(); i++) {
+            b += streams[i].rateHz * streams[i].sizeBytes;
+        }
+        return b;
+    }
+};
+
+/**
+ * A packet of a synthetic stream: a payload of the stream's size, filled
+ * so that it has to be really written, and the monotonic time it was
+ * sampled at, for measuring its age downstream.
+ */
+class SynthPacket {
+
+    private:
+    timeval stamp;
+    uint64_t seq;
+    int64_t sampleNs;
+    std::vector<uint8_t> payload;
+
+    public:
+    SynthPacket() : seq(0), sampleNs(0) {
+        stamp.tv_sec = 0;
+        stamp.tv_usec = 0;
+    }
+
+    SynthPacket(uint64_t seq, int64_t sampleNs, size_t size) : seq(seq),
+                sampleNs(sampleNs), payload(size) {
+        gettimeofday(&stamp, NULL);
+        if (size > 0) {
+            memset(&payload[0], (int) (seq & 0xff), size);
+        }
+    }
+
+    timeval getTimeStamp() const {
+        return stamp;
+    }
+
+    uint64_t getSeq() const {
+        return seq;
+    }
+
+    int64_t getSampleNs() const {
+        return sampleNs;
+    }
+
+    const std::vector<uint8_t>& getPayload() const {
+        return payload;
+    }
+};
+
+/**
+ * Interface producing the packets of one StreamSpec, for a BufferThread:
+ *
+ *     SynthInterface lidar(WorkloadProfile::production().streams[0]);
+ *     BufferThread<SynthPacket, SynthInterface> lidarBuf(&lidar);
+ *
+ * getPacket() blocks until the next packet's delivery time, like a driver
+ * waiting for its device.
+ */
+class SynthInterface {
+
+    private:
+    StreamSpec spec;
+    std::mt19937 rng;
+    int64_t nextSampleNs;
+    int64_t lastDeliveryNs;
+    int burstLeft;
+    uint64_t seq;
+
+    static void sleepUntil(int64_t ns) {
+        timespec ts;
+        ts.tv_sec = ns / 1000000000;
+        ts.tv_nsec = ns % 1000000000;
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL)
+               != 0) {}
+    }
+
+    public:
+    SynthInterface(const StreamSpec& spec, unsigned seed = 1) : spec(spec),
+                   rng(seed), nextSampleNs(0), lastDeliveryNs(0),
+                   burstLeft(0), seq(0) {}
+
+    const StreamSpec& getSpec() const {
+        return spec;
+    }
+
+    SynthPacket getPacket() {
+        int64_t period = (int64_t) (1e9 / spec.rateHz);
+        int64_t now = monotonicNs();
+        if (nextSampleNs == 0 || nextSampleNs + 10 * period < now) {
+            // First call, or far behind (the buffer was not reading):
+            // start afresh rather than deliver a backlog.
+            nextSampleNs = now;
+        }
+
+        int64_t sampleNs = nextSampleNs;
+        std::uniform_real_distribution<double> u(0, 1);
+        if (burstLeft > 0) {
+            --burstLeft;
+        } else if (spec.burstLen > 1 && u(rng) < spec.burstProb) {
+            burstLeft = spec.burstLen - 1;
+        }
+        int64_t step = period;
+        if (spec.periodJitter > 0) {
+            std::normal_distribution<double> jit(0, spec.periodJitter);
+            step = (int64_t) (period * std::max(0.1, 1 + jit(rng)));
+        }
+        nextSampleNs += step;
+
+        // Samples of a burst are held back and delivered with its last one.
+        int64_t latency = spec.latencyNs;
+        if (spec.latencySigma > 0 && latency > 0) {
+            std::lognormal_distribution<double> lat(std::log(latency),
+                                                    spec.latencySigma);
+            latency = (int64_t) lat(rng);
+        }
+        int64_t delivery = sampleNs + latency + burstLeft * period;
+        if (delivery < lastDeliveryNs) {
+            delivery = lastDeliveryNs;
+        }
+        lastDeliveryNs = delivery;
+        sleepUntil(delivery);
+
+        size_t size = spec.sizeBytes;
+        if (spec.sizeSpread > 0) {
+            std::normal_distribution<double> sz(1, spec.sizeSpread);
+            size = (size_t) (size * std::max(0.0, sz(rng)));
+        }
+        return SynthPacket(++seq, sampleNs, size);
+    }
+};
+
+/**
+ * A status value as written by StatusLoad: the time it was set, and a
+ * reading.
+ */
+struct SynthStatus {
+    int64_t setNs;
+    double value;
+};
+
+/**
+ * Writes the status values of a StatusSpec into a StatusStore from a
+ * thread of its own, batch by batch, keys 0 to numKeys - 1 in turn.
+ */
+class StatusLoad {
+
+    private:
+    StatusStore<SynthStatus>* store;
+    StatusSpec spec;
+    std::atomic<bool> bStop;
+    std::atomic<uint64_t> puts;
+    bool bStarted;
+    pthread_t load_thread;
+    boost::function<void*()>* tfPersistent;
+
+    StatusLoad(const StatusLoad&);
+    StatusLoad& operator=(const StatusLoad&);
+
+    /**
+     * The writer thread function.
+     *
+     * It is called from an external wrapper function.
+     */
+    void* loadMeth() {
+        ThreadRegistration reg("status-load");
+        // Batches per second to update every key rateHz times a second.
+        double batchHz = spec.rateHz * spec.numKeys / spec.batchSize;
+        int64_t period = (int64_t) (1e9 / batchHz);
+        int64_t next = monotonicNs();
+        uint64_t key = 0;
+        while (!bStop.load(std::memory_order_relaxed)) {
+            timespec ts;
+            ts.tv_sec = next / 1000000000;
+            ts.tv_nsec = next % 1000000000;
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+            SynthStatus s;
+            s.setNs = monotonicNs();
+            for (size_t i = 0; i < spec.batchSize; i++) {
+                s.value = std::sin(key * 0.1 + s.setNs * 1e-9);
+                store->put(key, s);
+                key = (key + 1) % spec.numKeys;
+            }
+            puts.fetch_add(spec.batchSize, std::memory_order_relaxed);
+            next += period;
+            if (next < s.setNs) {
+                next = s.setNs;
+            }
+        }
+        return NULL;
+    }
+
+    public:
+    /**
+     * @param store Must have room for spec.numKeys keys and outlive the
+     *        load.
+     */
+    StatusLoad(StatusStore<SynthStatus>* store, const StatusSpec& spec) :
+               store(store), spec(spec), bStop(false), puts(0),
+               bStarted(false), tfPersistent(NULL) {}
+
+    ~StatusLoad() {
+        stop();
+        delete tfPersistent;
+    }
+
+    /**
+     * Starts writing; does nothing for a spec without keys.
+     */
+    void start() {
+        if (spec.numKeys == 0 || spec.batchSize == 0 || bStarted) {
+            return;
+        }
+        boost::function<void*()> thrFun = bind(&StatusLoad::loadMeth, this);
+        tfPersistent = new boost::function<void*()>(thrFun);
+        pthread_create(&load_thread, NULL, &pthreadWrapper, tfPersistent);
+        bStarted = true;
+    }
+
+    void stop() {
+        if (bStarted) {
+            bStop.store(true);
+            pthread_join(load_thread, NULL);
+            bStarted = false;
+        }
+    }
+
+    uint64_t getPuts() {
+        return puts.load(std::memory_order_relaxed);
+    }
+};
+
+#endif
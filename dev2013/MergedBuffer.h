@@ -0,0 +1,404 @@
+#include <pthread.h>
+#include <boost/function.hpp>
+#include <boost/bind.hpp>
+#include <atomic>
+#include <queue>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <sched.h>
+#include <sys/time.h>
+
+#include "BufferThreadedP.h" // for the pthreadWrapper definition
+#include "FutexEvent.h"
+#include "MonotonicClock.h"
+#include "ThreadAccounting.h"
+
+using boost::function;
+using boost::bind;
+
+// Header guards -- this file may be included more than once.
+#ifndef MERGEDBUFFER_H_
+#define MERGEDBUFFER_H_
+
+/**
+ * Per-producer statistics of a MergedBuffer.
+ */
+struct MergedProducerStats {
+    uint64_t packets;       /**< Packets acquired */
+    uint64_t overflows;     /**< Packets dropped because the queue was full */
+    uint64_t late;          /**< Packets dropped for arriving too late */
+    double ratePerSec;      /**< Average acquisition rate since the start */
+    int64_t meanAcqNs;      /**< Mean time spent in Interface::getPacket() */
+    int64_t meanDeliveryNs; /**< Mean time from enqueue to delivery */
+    int64_t maxDeliveryNs;  /**< Longest time from enqueue to delivery */
+};
+
+/**
+ * Merges the packets of several identical sensors (say, all the ultrasonic
+ * rangefinders, or all the cameras) into one stream ordered by timestamp.
+ *
+ * Each producer Interface gets its own thread that calls getPacket()
+ * continuously and pushes the result into a single bounded multi-producer,
+ * single-consumer queue; producers never block each other or the consumer.
+ * The consumer side reorders packets by their getTimeStamp() within a
+ * bounded reorder window: a packet is delivered once a packet at least one
+ * window newer has arrived, or once it has waited one window, whichever
+ * comes first. A packet that arrives after newer ones have already been
+ * delivered would break the ordering, so it is dropped and counted as late.
+ *
+ * The Packet must provide `timeval getTimeStamp()` (SensorInterface.md) and
+ * be default-constructible and copyable; the Interface must provide
+ * `Packet getPacket()`, as for BufferThread.
+ *
+ * Packets are consumed (taken out) by getPacket(), which is meant to be
+ * called by a single consumer thread at a time.
+ */
+template <class Packet, class Interface>
+class MergedBuffer {
+
+    private:
+    /**
+     * One queue slot. The sequence number tells producers and the consumer
+     * whose turn it is (bounded MPMC queue after D. Vyukov).
+     */
+    struct Slot {
+        std::atomic<uint64_t> seq;
+        Packet pkt;
+        int producer;
+        int64_t enqueueNs;
+    };
+
+    /**
+     * A packet waiting in the reorder window.
+     */
+    struct Pending {
+        Packet pkt;
+        int64_t stampUs;
+        int64_t enqueueNs;
+        int64_t arrivalNs;
+        int producer;
+    };
+
+    struct LaterFirst {
+        bool operator()(const Pending& a, const Pending& b) const {
+            return a.stampUs > b.stampUs;
+        }
+    };
+
+    /**
+     * A producer thread and its statistics.
+     */
+    struct Producer {
+        Interface* source;
+        pthread_t thread;
+        function<void*()>* tfPersistent;
+        std::atomic<uint64_t> packets;
+        std::atomic<uint64_t> overflows;
+        std::atomic<uint64_t> late;
+        std::atomic<int64_t> acqNs;
+        std::atomic<int64_t> deliveryNs;
+        std::atomic<int64_t> maxDeliveryNs;
+        std::atomic<uint64_t> delivered;
+    };
+
+    Slot* ring;
+    size_t mask;
+    std::atomic<uint64_t> head;
+    uint64_t tail;
+
+    std::vector<Producer*> producers;
+    std::priority_queue<Pending, std::vector<Pending>, LaterFirst> reorder;
+    int64_t windowUs;
+    int64_t newestUs;
+    int64_t lastDeliveredUs;
+    pthread_mutex_t consumer_mtx;
+
+    FutexEvent data_evt;
+    std::atomic<bool> bStop;
+    // Threads inside getPacket() or waitPacket(), which the destructor has
+    // to wake and wait out.
+    std::atomic<int> callers;
+    bool bStarted;
+    int64_t startNs;
+
+    MergedBuffer(const MergedBuffer&);
+    MergedBuffer& operator=(const MergedBuffer&);
+
+    static int64_t stampToUs(const timeval& tv) {
+        return tv.tv_sec * 1000000LL + tv.tv_usec;
+    }
+
+    bool enqueue(Packet& pkt, int producer) {
+        uint64_t pos = head.load(std::memory_order_relaxed);
+        Slot* slot;
+        while (true) {
+            slot = &ring[pos & mask];
+            uint64_t seq = slot->seq.load(std::memory_order_acquire);
+            int64_t diff = (int64_t) seq - (int64_t) pos;
+            if (diff == 0) {
+                if (head.compare_exchange_weak(pos, pos + 1,
+                                               std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return false; // Full
+            } else {
+                pos = head.load(std::memory_order_relaxed);
+            }
+        }
+        slot->pkt = std::move(pkt);
+        slot->producer = producer;
+        slot->enqueueNs = monotonicNs();
+        slot->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * Moves everything that is in the queue into the reorder heap.
+     * Consumer only.
+     */
+    void collect() {
+        int64_t now = monotonicNs();
+        while (true) {
+            Slot* slot = &ring[tail & mask];
+            if (slot->seq.load(std::memory_order_acquire) != tail + 1) {
+                return;
+            }
+            Pending p;
+            p.pkt = std::move(slot->pkt);
+            p.producer = slot->producer;
+            p.enqueueNs = slot->enqueueNs;
+            p.arrivalNs = now;
+            slot->seq.store(tail + mask + 1, std::memory_order_release);
+            ++tail;
+
+            p.stampUs = stampToUs(p.pkt.getTimeStamp());
+            if (p.stampUs < lastDeliveredUs) {
+                producers[p.producer]->late.fetch_add(
+                    1, std::memory_order_relaxed);
+                continue;
+            }
+            if (p.stampUs > newestUs) {
+                newestUs = p.stampUs;
+            }
+            reorder.push(p);
+        }
+    }
+
+    public:
+    /**
+     * @param capacity Queue capacity in packets; rounded up to a power of
+     *        two.
+     * @param reorderWindowMs How far out of order packets may arrive and
+     *        still be put back in order; also the longest a packet waits
+     *        for stragglers.
+     */
+    MergedBuffer(size_t capacity, int reorderWindowMs) :
+                 head(0), tail(0), windowUs(reorderWindowMs * 1000LL),
+                 newestUs(0), lastDeliveredUs(0), bStop(false),
+                 callers(0), bStarted(false), startNs(0) {
+        size_t size = 2;
+        while (size < capacity) {
+            size *= 2;
+        }
+        mask = size - 1;
+        ring = new Slot[size];
+        for (size_t i = 0; i < size; i++) {
+            ring[i].seq.store(i, std::memory_order_relaxed);
+        }
+        pthread_mutex_init(&consumer_mtx, NULL);
+    }
+
+    ~MergedBuffer() {
+        bStop.store(true);
+        // Consumers waiting for a packet return empty-handed; wait until
+        // they have, before anything they use goes away.
+        data_evt.notifyAll();
+        while (callers.load() > 0) {
+            sched_yield();
+        }
+        for (size_t i = 0; i < producers.size(); i++) {
+            if (bStarted) {
+                pthread_cancel(producers[i]->thread);
+                pthread_join(producers[i]->thread, NULL);
+            }
+            delete producers[i]->tfPersistent;
+            delete producers[i];
+        }
+        pthread_mutex_destroy(&consumer_mtx);
+        delete[] ring;
+    }
+
+    /**
+     * Adds a producer. All producers must be added before start().
+     *
+     * @param source The interface; must outlive the buffer.
+     *
+     * @return The producer's index, used for getProducerStats().
+     */
+    int addProducer(Interface* source) {
+        Producer* p = new Producer();
+        p->source = source;
+        p->tfPersistent = NULL;
+        p->packets.store(0);
+        p->overflows.store(0);
+        p->late.store(0);
+        p->acqNs.store(0);
+        p->deliveryNs.store(0);
+        p->maxDeliveryNs.store(0);
+        p->delivered.store(0);
+        producers.push_back(p);
+        return producers.size() - 1;
+    }
+
+    /**
+     * Starts one acquisition thread per producer. Call only once.
+     */
+    void start() {
+        startNs = monotonicNs();
+        for (size_t i = 0; i < producers.size(); i++) {
+            function<void*()> thrFun =
+                bind(&MergedBuffer::producerMeth, this, (int) i);
+            producers[i]->tfPersistent = new function<void*()>(thrFun);
+            pthread_create(&producers[i]->thread, NULL, &pthreadWrapper,
+                           producers[i]->tfPersistent);
+        }
+        bStarted = true;
+    }
+
+    /**
+     * Takes the next packet in timestamp order, if one is due.
+     *
+     * @param output Receives the packet; left unchanged if there is none.
+     * @param producer If not NULL, receives the index of the producer the
+     *        packet came from.
+     *
+     * @return Whether a packet was delivered.
+     */
+    bool getPacket(Packet* output, int* producer = NULL) {
+        bool retval = false;
+        callers.fetch_add(1);
+        if (bStop.load()) {
+            callers.fetch_sub(1);
+            return false;
+        }
+        pthread_mutex_lock(&consumer_mtx);
+        collect();
+        if (!reorder.empty()) {
+            const Pending& top = reorder.top();
+            int64_t now = monotonicNs();
+            if (newestUs - top.stampUs >= windowUs ||
+                    now - top.arrivalNs >= windowUs * 1000) {
+                *output = top.pkt;
+                if (producer != NULL) {
+                    *producer = top.producer;
+                }
+                lastDeliveredUs = top.stampUs;
+
+                Producer* p = producers[top.producer];
+                int64_t delivery = now - top.enqueueNs;
+                p->deliveryNs.fetch_add(delivery, std::memory_order_relaxed);
+                p->delivered.fetch_add(1, std::memory_order_relaxed);
+                if (delivery > p->maxDeliveryNs.load(
+                        std::memory_order_relaxed)) {
+                    p->maxDeliveryNs.store(delivery,
+                                           std::memory_order_relaxed);
+                }
+                reorder.pop();
+                retval = true;
+            }
+        }
+        pthread_mutex_unlock(&consumer_mtx);
+        callers.fetch_sub(1);
+        return retval;
+    }
+
+    /**
+     * Like getPacket(), but waits up to timeoutMs milliseconds for a packet
+     * to become due. Returns false early if the buffer is destroyed
+     * meanwhile.
+     */
+    bool waitPacket(Packet* output, int timeoutMs, int* producer = NULL) {
+        callers.fetch_add(1);
+        int64_t deadline = monotonicNs() + timeoutMs * 1000000LL;
+        while (true) {
+            uint32_t key = data_evt.prepareWait();
+            if (getPacket(output, producer)) {
+                callers.fetch_sub(1);
+                return true;
+            }
+            int64_t left = deadline - monotonicNs();
+            if (left <= 0 || bStop.load()) {
+                callers.fetch_sub(1);
+                return false;
+            }
+            // Packets held back for reordering become due without any
+            // producer activity, so don't sleep longer than a window.
+            int64_t nap = windowUs * 1000;
+            if (nap <= 0 || nap > left) {
+                nap = left;
+            }
+            data_evt.waitFor(key, nap);
+        }
+    }
+
+    /**
+     * The number of producers.
+     */
+    int getNumProducers() {
+        return producers.size();
+    }
+
+    /**
+     * Rate and latency statistics of one producer.
+     */
+    MergedProducerStats getProducerStats(int index) {
+        Producer* p = producers[index];
+        MergedProducerStats st;
+        st.packets = p->packets.load(std::memory_order_relaxed);
+        st.overflows = p->overflows.load(std::memory_order_relaxed);
+        st.late = p->late.load(std::memory_order_relaxed);
+        int64_t elapsed = monotonicNs() - startNs;
+        st.ratePerSec = (bStarted && elapsed > 0) ?
+            st.packets * 1e9 / elapsed : 0;
+        st.meanAcqNs = st.packets > 0 ?
+            p->acqNs.load(std::memory_order_relaxed) / (int64_t) st.packets :
+            0;
+        uint64_t delivered = p->delivered.load(std::memory_order_relaxed);
+        st.meanDeliveryNs = delivered > 0 ?
+            p->deliveryNs.load(std::memory_order_relaxed) /
+            (int64_t) delivered : 0;
+        st.maxDeliveryNs = p->maxDeliveryNs.load(std::memory_order_relaxed);
+        return st;
+    }
+
+    /**
+     * The acquisition thread of one producer. Runs until the buffer is
+     * destroyed.
+     *
+     * It is called from an external wrapper function.
+     */
+    void* producerMeth(int index) {
+        ThreadRegistration reg("merged-" + std::to_string(index));
+        Producer* p = producers[index];
+        Packet pkl; // Thread-local packet
+        while (!bStop.load(std::memory_order_relaxed)) {
+            int64_t t0 = monotonicNs();
+            pkl = p->source->getPacket();
+            p->acqNs.fetch_add(monotonicNs() - t0,
+                               std::memory_order_relaxed);
+            p->packets.fetch_add(1, std::memory_order_relaxed);
+            if (enqueue(pkl, index)) {
+                data_evt.notifyOne();
+            } else {
+                p->overflows.fetch_add(1, std::memory_order_relaxed);
+            }
+            // Cancellation point, just to be sure
+            sleep(0);
+        }
+        return NULL;
+    }
+};
+
+#endif
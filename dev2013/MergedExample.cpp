@@ -0,0 +1,105 @@
+#include "MergedBuffer.h"
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+
+using namespace std;
+
+/**
+ * An ultrasonic range reading.
+ */
+class RangePacket {
+    timeval stamp;
+    double range;
+
+    public:
+    RangePacket() : range(0) {
+        stamp.tv_sec = 0;
+        stamp.tv_usec = 0;
+    }
+
+    RangePacket(timeval stamp, double range) : stamp(stamp), range(range) {}
+
+    timeval getTimeStamp() {
+        return stamp;
+    }
+
+    double getRange() {
+        return range;
+    }
+};
+
+/**
+ * Simulated ultrasonic sensor. The reading is stamped when the ping goes
+ * out and returned after a random echo and transfer delay, so readings of
+ * different sensors reach the buffer out of order.
+ */
+class RangeInterface {
+    int periodUs;
+    unsigned int seed;
+
+    public:
+    RangeInterface(int periodUs, unsigned int seed) :
+                   periodUs(periodUs), seed(seed) {}
+
+    RangePacket getPacket() {
+        timeval stamp;
+        gettimeofday(&stamp, NULL);
+        usleep(periodUs + rand_r(&seed) % periodUs);
+        return RangePacket(stamp, 0.2 + (rand_r(&seed) % 400) / 100.0);
+    }
+};
+
+/**
+ * Four rangefinders merged into one time-ordered stream.
+ *
+ * Usage: MergedExample [reorderWindowMs]  (default 50)
+ */
+int main(int argc, char** argv) {
+    int windowMs = 50;
+    if (argc > 1) {
+        windowMs = atoi(argv[1]);
+    }
+    const int numSensors = 4;
+    RangeInterface* sensors[numSensors];
+    MergedBuffer<RangePacket, RangeInterface> merged(64, windowMs);
+    for (int i = 0; i < numSensors; i++) {
+        sensors[i] = new RangeInterface(5000 * (i + 1), i + 1);
+        merged.addProducer(sensors[i]);
+    }
+    merged.start();
+
+    long delivered = 0;
+    long outOfOrder = 0;
+    int64_t prevUs = 0;
+    int64_t endNs = monotonicNs() + 2000000000LL;
+    while (monotonicNs() < endNs) {
+        RangePacket pkt;
+        if (merged.waitPacket(&pkt, 100)) {
+            timeval tv = pkt.getTimeStamp();
+            int64_t us = tv.tv_sec * 1000000LL + tv.tv_usec;
+            if (us < prevUs) {
+                ++outOfOrder;
+            }
+            prevUs = us;
+            ++delivered;
+        }
+    }
+
+    cout << delivered << " packets delivered, " << outOfOrder <<
+        " out of order" << endl;
+    cout << setw(8) << "sensor" << setw(10) << "packets" << setw(10) <<
+        "rate/s" << setw(8) << "late" << setw(10) << "overflow" <<
+        setw(12) << "acq(us)" << setw(14) << "deliv(us)" << setw(14) <<
+        "maxDeliv(us)" << endl;
+    cout << fixed << setprecision(1);
+    for (int i = 0; i < numSensors; i++) {
+        MergedProducerStats st = merged.getProducerStats(i);
+        cout << setw(8) << i << setw(10) << st.packets << setw(10) <<
+            st.ratePerSec << setw(8) << st.late << setw(10) <<
+            st.overflows << setw(12) << st.meanAcqNs / 1000.0 <<
+            setw(14) << st.meanDeliveryNs / 1000.0 << setw(14) <<
+            st.maxDeliveryNs / 1000.0 << endl;
+    }
+    return 0;
+}
@@ -0,0 +1,19 @@
+#include <stdint.h>
+#include <time.h>
+
+// Header guards -- this file may be included more than once.
+#ifndef MONOTONICCLOCK_H_
+#define MONOTONICCLOCK_H_
+
+/**
+ * The current time of the monotonic clock in nanoseconds. Unlike
+ * gettimeofday(), this clock never jumps, so it is the one to use for
+ * measuring ages, latencies and deadlines.
+ */
+inline int64_t monotonicNs() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+#endif
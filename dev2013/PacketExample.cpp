@@ -102,13 +102,15 @@ int main(int argc, char** argv) {
     char cmd;
     TestPacket tp;
     TestInterface iface;
+    TestInterface spare; // Swapped in and out with 's'
+    TestInterface* active = &iface;
 
     BufferThread<TestPacket, TestInterface>* buf;
     buf = new BufferThread<TestPacket, TestInterface>(&iface);
     buf->spawnThreads();
     while (bContinue) {
         cout << "Please enter a command out of " <<
-            "{\'u\', \'g\', \'i\', \'q\'}: ";
+            "{\'u\', \'g\', \'i\', \'s\', \'q\'}: ";
         cin >> cmd;
         cout << endl;
         switch (cmd) {
@@ -125,6 +127,11 @@ int main(int argc, char** argv) {
             // Inquiry, isUpdating.
             cout << "Updating: " << buf->isUpdating() << endl;
             break;
+        case 's':
+            // Swap the interface; waits for an update in flight to finish.
+            active = active == &iface ? &spare : &iface;
+            cout << "Swapped: " << buf->swapInterface(active, 5000) << endl;
+            break;
         case 'q':
             // Quit.
             bContinue = false;
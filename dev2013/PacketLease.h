@@ -0,0 +1,139 @@
+#include <atomic>
+#include <memory>
+#include <stdint.h>
+
+#include "MonotonicClock.h"
+
+// Header guards -- this file may be included more than once.
+#ifndef PACKETLEASE_H_
+#define PACKETLEASE_H_
+
+/**
+ * Lease duration statistics of one buffer, see LeaseMeter.
+ */
+struct LeaseStats {
+    uint64_t count;     /**< Leases released so far */
+    uint64_t active;    /**< Leases currently held */
+    int64_t totalNs;    /**< Sum of the durations of the released leases */
+    int64_t maxNs;      /**< Longest lease released so far */
+};
+
+/**
+ * Collects lease statistics for a buffer. Updated with relaxed atomics
+ * only, so taking and releasing a lease never blocks.
+ */
+class LeaseMeter {
+
+    private:
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> active;
+    std::atomic<int64_t> totalNs;
+    std::atomic<int64_t> maxNs;
+
+    public:
+    LeaseMeter() : count(0), active(0), totalNs(0), maxNs(0) {}
+
+    void leaseTaken() {
+        active.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void leaseReleased(int64_t durationNs) {
+        active.fetch_sub(1, std::memory_order_relaxed);
+        count.fetch_add(1, std::memory_order_relaxed);
+        totalNs.fetch_add(durationNs, std::memory_order_relaxed);
+        int64_t prevMax = maxNs.load(std::memory_order_relaxed);
+        while (durationNs > prevMax &&
+               !maxNs.compare_exchange_weak(prevMax, durationNs,
+                                            std::memory_order_relaxed)) {
+        }
+    }
+
+    LeaseStats getStats() {
+        LeaseStats st;
+        st.count = count.load(std::memory_order_relaxed);
+        st.active = active.load(std::memory_order_relaxed);
+        st.totalNs = totalNs.load(std::memory_order_relaxed);
+        st.maxNs = maxNs.load(std::memory_order_relaxed);
+        return st;
+    }
+};
+
+/**
+ * A scoped read lease on a buffer's packet; the implementation of the
+ * acquireLock()/releaseLock() strategy of SensorInterface.md. While the
+ * lease is held, the packet it refers to does not change, no matter how
+ * many updates the buffer publishes in the meantime; the writer simply
+ * publishes into other storage. Any number of leases may be held at once,
+ * and none of them ever stalls the writer.
+ *
+ * With RcuPolicy the lease pins the published packet itself; with the other
+ * policies it holds a private copy taken when the lease was granted. Either
+ * way the packet is shared, so only its const methods can be called.
+ *
+ * The lease is released when it goes out of scope (or on release()). It
+ * must not outlive the buffer that granted it.
+ *
+ * Usage:
+ *
+ *     {
+ *         PacketLease<LidarPacket> lease = buf.lease();
+ *         double h = lease->getHeading();
+ *         timeval ts = lease->getTimeStamp(); // same update as h
+ *     }
+ */
+template <class Packet>
+class PacketLease {
+
+    private:
+    std::shared_ptr<const Packet> pkt;
+    LeaseMeter* meter;
+    int64_t startNs;
+
+    PacketLease(const PacketLease&);
+    PacketLease& operator=(const PacketLease&);
+
+    public:
+    /**
+     * Used by the buffers to grant a lease; see BufferThread::lease().
+     */
+    PacketLease(std::shared_ptr<const Packet> pkt, LeaseMeter* meter) :
+                pkt(pkt), meter(meter), startNs(monotonicNs()) {
+        meter->leaseTaken();
+    }
+
+    PacketLease(PacketLease&& other) :
+                pkt(std::move(other.pkt)), meter(other.meter),
+                startNs(other.startNs) {
+        other.meter = NULL;
+    }
+
+    ~PacketLease() {
+        release();
+    }
+
+    /**
+     * Gives the lease back early. The lease may not be dereferenced
+     * afterwards.
+     */
+    void release() {
+        if (meter != NULL) {
+            meter->leaseReleased(monotonicNs() - startNs);
+            meter = NULL;
+            pkt.reset();
+        }
+    }
+
+    const Packet& operator*() const {
+        return *pkt;
+    }
+
+    const Packet* operator->() const {
+        return pkt.get();
+    }
+
+    const Packet* get() const {
+        return pkt.get();
+    }
+};
+
+#endif
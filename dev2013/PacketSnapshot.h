@@ -0,0 +1,635 @@
+#include <pthread.h>
+#include <boost/function.hpp>
+#include <boost/bind.hpp>
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include <fcntl.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include "BufferThreadedP.h"
+#include "FutexEvent.h"
+#include "ThreadAccounting.h"
+
+// Header guards -- this file may be included more than once.
+#ifndef PACKETSNAPSHOT_H_
+#define PACKETSNAPSHOT_H_
+
+/** Most buffers a snapshot file holds. */
+const int MAX_SNAPSHOT_ENTRIES = 64;
+
+/** Longest buffer name in a snapshot file, including the terminating 0. */
+const size_t SNAPSHOT_NAME_LEN = 48;
+
+/**
+ * Describes how a packet is stored in a PacketSnapshot: its size in bytes,
+ * and how to write it to and read it back from a byte array. Trivially
+ * copyable packets are stored as they are, and std::vector of trivially
+ * copyable elements as its elements; specialize it for other packets:
+ *
+ *     template <> struct PacketSnapshotTraits<MapPacket> {
+ *         static size_t size(const MapPacket& p);
+ *         static void encode(const MapPacket& p, char* out);
+ *         static bool decode(MapPacket& p, const char* in, size_t n);
+ *     };
+ *
+ * decode() returns false if the bytes do not make a valid packet. The bytes
+ * are read back by the same program, possibly after a restart, so the
+ * format need not be portable, but it should not contain pointers.
+ */
+template <class Packet, class Enable = void>
+struct PacketSnapshotTraits;
+
+template <class Packet>
+struct PacketSnapshotTraits<Packet, typename std::enable_if<
+    std::is_trivially_copyable<Packet>::value>::type> {
+
+    static size_t size(const Packet&) {
+        return sizeof(Packet);
+    }
+
+    static void encode(const Packet& p, char* out) {
+        memcpy(out, &p, sizeof(Packet));
+    }
+
+    static bool decode(Packet& p, const char* in, size_t n) {
+        if (n != sizeof(Packet)) {
+            return false;
+        }
+        memcpy(&p, in, sizeof(Packet));
+        return true;
+    }
+};
+
+template <class T>
+struct PacketSnapshotTraits<std::vector<T>, typename std::enable_if<
+    std::is_trivially_copyable<T>::value>::type> {
+
+    static size_t size(const std::vector<T>& p) {
+        return p.size() * sizeof(T);
+    }
+
+    static void encode(const std::vector<T>& p, char* out) {
+        if (!p.empty()) {
+            memcpy(out, p.data(), p.size() * sizeof(T));
+        }
+    }
+
+    static bool decode(std::vector<T>& p, const char* in, size_t n) {
+        if (n % sizeof(T) != 0) {
+            return false;
+        }
+        p.resize(n / sizeof(T));
+        if (n > 0) {
+            memcpy(p.data(), in, n);
+        }
+        return true;
+    }
+};
+
+/**
+ * Keeps the latest packet of selected buffers in a memory-mapped file, so
+ * that after a crash or restart the buffers can start out with the last
+ * known packets instead of default-constructed ones ("warm start"):
+ *
+ *     BufferThread<Pose, Localizer> poseBuf(&localizer);
+ *     PacketSnapshot snap("/var/lib/robot/packets.snap");
+ *     snap.restore("pose", &poseBuf, 60000); // If at most a minute old
+ *     snap.persist("pose", &poseBuf, sizeof(Pose));
+ *     poseBuf.spawnThreads();
+ *     snap.start();
+ *     ...
+ *     if (poseBuf.isRestored()) {
+ *         // Stale: from the last run, no fresh estimate yet.
+ *     }
+ *     ...
+ *     snap.stop(); // Writes the last packets; poseBuf may go away now
+ *
+ * A writer thread checks the persisted buffers every intervalMs, and copies
+ * the packets of those that published since its last pass into the file
+ * (see PacketSnapshotTraits for the format). Only the writer touches the
+ * buffers, and only through getPacket(), so the updaters never wait for the
+ * file. For Traced packets (Lineage.h) that getPacket() counts as a poll:
+ * it stamps polledNs in the lineage of the writer's copy, so a packet
+ * written to the file, and restored from it, carries the time the writer
+ * took it rather than the time a consumer did.
+ *
+ * Crash consistency: every buffer has two copies in the file, each with a
+ * generation number and a CRC32 of its contents. A new packet overwrites
+ * the older copy, and loading takes the newest copy whose CRC matches, so a
+ * write torn by a crash just falls back to the previous packet. The file is
+ * a shared mapping, so what was written survives the process crashing. To
+ * survive a power loss, it must reach the disk: each pass schedules that
+ * with msync(MS_ASYNC), and flush() waits for it. A directory entry whose
+ * name or copies do not fit in the file is taken as absent.
+ *
+ * The file has a fixed size and a directory of MAX_SNAPSHOT_ENTRIES names.
+ * A buffer persisted with a larger capacity than its existing entry gets a
+ * new one; the space of the old one is not reused. Delete the file to
+ * start over.
+ */
+class PacketSnapshot {
+
+    private:
+    /** At offset 0. */
+    struct FileHeader {
+        char magic[8];
+        uint32_t format;
+        uint32_t numEntries;
+        uint64_t used;   // Bytes allocated to entries, from offset 0
+        uint64_t size;
+    };
+
+    /** MAX_SNAPSHOT_ENTRIES of them, from offset DIR_OFFSET. */
+    struct DirEntry {
+        char name[SNAPSHOT_NAME_LEN]; // Empty if abandoned
+        uint64_t offset;   // Of the first of two copies
+        uint64_t capacity; // Bytes of packet data per copy
+    };
+
+    /** Precedes the packet data of each copy. */
+    struct CopyHeader {
+        uint64_t generation; // 0 if never written
+        uint64_t length;
+        int64_t wallUs;      // When it was written
+        uint64_t version;    // Of the buffer, in the run that wrote it
+        uint32_t crc;        // Of the fields above and the data
+        uint32_t pad;
+    };
+
+    /** A buffer being persisted. */
+    struct Persisted {
+        int entry;
+        uint64_t generation; // Of the newest copy
+        uint64_t version;    // The buffer version last written
+        // Fetches the buffer's packet if its version is not the one given.
+        boost::function<bool(std::vector<char>&, uint64_t&)> fetch;
+    };
+
+    /** Fetch function for a BufferThread. */
+    template <class Packet, class Buffer>
+    struct BufferFetch {
+        Buffer* buf;
+
+        bool operator()(std::vector<char>& bytes, uint64_t& version) {
+            uint64_t v = buf->getVersion();
+            if (v == 0 || v == version) {
+                return false;
+            }
+            Packet pkt = buf->getPacket(); // At least version v
+            bytes.resize(PacketSnapshotTraits<Packet>::size(pkt));
+            PacketSnapshotTraits<Packet>::encode(pkt, bytes.data());
+            version = v;
+            return true;
+        }
+    };
+
+    static const uint32_t FORMAT = 1;
+    static const size_t DIR_OFFSET = 64;
+    static const size_t DATA_OFFSET = 8192;
+
+    int fd;
+    char* base;
+    size_t size;
+    FileHeader* header;
+    DirEntry* dir;
+    std::string error;
+
+    pthread_mutex_t mtx; // Guards the file and persisted
+    std::vector<Persisted> persisted;
+    std::vector<char> scratch;
+    std::atomic<uint64_t> writes;
+    std::atomic<uint64_t> oversize;
+
+    int64_t intervalNs;
+    FutexEvent stop_evt;
+    std::atomic<bool> bStop;
+    bool bStarted;
+    pthread_t write_thread;
+    boost::function<void*()>* tfPersistent;
+
+    PacketSnapshot(const PacketSnapshot&);
+    PacketSnapshot& operator=(const PacketSnapshot&);
+
+    struct CrcTable {
+        uint32_t entries[256];
+
+        CrcTable() {
+            for (uint32_t i = 0; i < 256; i++) {
+                uint32_t c = i;
+                for (int k = 0; k < 8; k++) {
+                    c = c & 1 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+                }
+                entries[i] = c;
+            }
+        }
+    };
+
+    static uint32_t crc32(uint32_t crc, const void* data, size_t n) {
+        static const CrcTable table;
+        const unsigned char* p = static_cast<const unsigned char*>(data);
+        crc = ~crc;
+        for (size_t i = 0; i < n; i++) {
+            crc = table.entries[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+        }
+        return ~crc;
+    }
+
+    static int64_t wallUs() {
+        timeval tv;
+        gettimeofday(&tv, NULL);
+        return tv.tv_sec * 1000000LL + tv.tv_usec;
+    }
+
+    static size_t copySize(uint64_t capacity) {
+        return (sizeof(CopyHeader) + capacity + 63) & ~size_t(63);
+    }
+
+    /**
+     * Whether a directory entry is sound: its name is terminated and both
+     * its copies lie in the data area of the file.
+     */
+    bool entryValid(int entry) {
+        const DirEntry& e = dir[entry];
+        return memchr(e.name, '\0', SNAPSHOT_NAME_LEN) != NULL &&
+            e.offset >= DATA_OFFSET && e.offset <= size &&
+            e.capacity <= size &&
+            2 * copySize(e.capacity) <= size - e.offset;
+    }
+
+    CopyHeader* copyAt(int entry, int which) {
+        const DirEntry& e = dir[entry];
+        return reinterpret_cast<CopyHeader*>(
+            base + e.offset + which * copySize(e.capacity));
+    }
+
+    uint32_t copyCrc(const CopyHeader* c) {
+        uint32_t crc = crc32(0, c, offsetof(CopyHeader, crc));
+        return crc32(crc, c + 1, c->length);
+    }
+
+    /**
+     * The newest intact copy of an entry, or -1 if there is none.
+     */
+    int newestCopy(int entry) {
+        if (!entryValid(entry)) {
+            return -1;
+        }
+        int best = -1;
+        for (int i = 0; i < 2; i++) {
+            CopyHeader* c = copyAt(entry, i);
+            if (c->generation == 0 || c->length > dir[entry].capacity ||
+                c->crc != copyCrc(c)) {
+                continue;
+            }
+            if (best < 0 || c->generation > copyAt(entry, best)->generation) {
+                best = i;
+            }
+        }
+        return best;
+    }
+
+    /**
+     * The entry of a name, or -1 if there is no valid one.
+     */
+    int findEntry(const std::string& name) {
+        for (uint32_t i = 0; i < header->numEntries; i++) {
+            if (entryValid(i) && name == dir[i].name) {
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    /**
+     * Sets up an empty file. Called with a fresh mapping only.
+     */
+    void format() {
+        memset(base, 0, DATA_OFFSET);
+        header->format = FORMAT;
+        header->numEntries = 0;
+        header->used = DATA_OFFSET;
+        header->size = size;
+        // The magic last: a file without it is formatted again.
+        memcpy(header->magic, "PKTSNAP", 8);
+        msync(base, DATA_OFFSET, MS_SYNC);
+    }
+
+    /**
+     * Writes the packets of the buffers that published since the last pass.
+     * Called with mtx held.
+     */
+    void writeChanged() {
+        for (size_t i = 0; i < persisted.size(); i++) {
+            Persisted& p = persisted[i];
+            if (!p.fetch(scratch, p.version)) {
+                continue;
+            }
+            if (scratch.size() > dir[p.entry].capacity) {
+                oversize.fetch_add(1, std::memory_order_relaxed);
+                continue;
+            }
+            // Overwrite the older copy; the newer one stays intact until
+            // this one is complete.
+            CopyHeader* c = copyAt(p.entry, (p.generation + 1) % 2);
+            memcpy(c + 1, scratch.data(), scratch.size());
+            c->length = scratch.size();
+            c->wallUs = wallUs();
+            c->version = p.version;
+            c->generation = ++p.generation;
+            c->crc = copyCrc(c);
+            writes.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * Stops the writer thread, if it runs.
+     */
+    void stopWriter() {
+        if (bStarted) {
+            bStop.store(true);
+            stop_evt.notifyAll();
+            pthread_join(write_thread, NULL);
+            bStarted = false;
+        }
+    }
+
+    /**
+     * The writer thread function.
+     *
+     * It is called from an external wrapper function.
+     */
+    void* writerMeth() {
+        ThreadRegistration reg("snapshot-writer");
+        while (true) {
+            uint32_t key = stop_evt.prepareWait();
+            if (bStop.load()) {
+                return NULL;
+            }
+            pthread_mutex_lock(&mtx);
+            writeChanged();
+            pthread_mutex_unlock(&mtx);
+            msync(base, size, MS_ASYNC);
+            stop_evt.waitFor(key, intervalNs);
+        }
+    }
+
+    public:
+    /**
+     * Opens the snapshot file, creating it if needed. A file that is not a
+     * snapshot file (or from another format version) is overwritten.
+     *
+     * @param path The file.
+     * @param fileSize Size of a new file, in bytes.
+     * @param intervalMs How often the writer thread checks the buffers.
+     */
+    PacketSnapshot(const std::string& path, size_t fileSize = 1 << 20,
+                   int intervalMs = 1000) :
+                   base(NULL), size(0), header(NULL), dir(NULL), writes(0),
+                   oversize(0), intervalNs(intervalMs * 1000000LL),
+                   bStop(false), bStarted(false), tfPersistent(NULL) {
+        pthread_mutex_init(&mtx, NULL);
+        fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            error = "cannot open " + path;
+            return;
+        }
+
+        struct stat st;
+        fstat(fd, &st);
+        bool fresh = (size_t) st.st_size < DATA_OFFSET;
+        if (!fresh) {
+            FileHeader h;
+            fresh = pread(fd, &h, sizeof(h), 0) != sizeof(h) ||
+                memcmp(h.magic, "PKTSNAP", 8) != 0 || h.format != FORMAT ||
+                h.size != (uint64_t) st.st_size || h.used > h.size ||
+                h.used < DATA_OFFSET ||
+                h.numEntries > MAX_SNAPSHOT_ENTRIES;
+        }
+        if (fresh) {
+            size = fileSize > DATA_OFFSET ? fileSize : DATA_OFFSET;
+            if (ftruncate(fd, 0) != 0 || ftruncate(fd, size) != 0) {
+                error = "cannot size " + path;
+                return;
+            }
+        } else {
+            size = st.st_size;
+        }
+
+        void* m = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (m == MAP_FAILED) {
+            error = "cannot map " + path;
+            return;
+        }
+        base = static_cast<char*>(m);
+        header = reinterpret_cast<FileHeader*>(base);
+        dir = reinterpret_cast<DirEntry*>(base + DIR_OFFSET);
+        if (fresh) {
+            format();
+        }
+    }
+
+    /**
+     * Stops the writer thread and waits for what it wrote to reach the
+     * disk. The persisted buffers are not touched, so they may already be
+     * gone; call stop() before they go to have their latest packets
+     * written.
+     */
+    ~PacketSnapshot() {
+        stopWriter();
+        if (base != NULL) {
+            msync(base, size, MS_SYNC);
+            munmap(base, size);
+        }
+        if (fd >= 0) {
+            close(fd);
+        }
+        pthread_mutex_destroy(&mtx);
+        delete tfPersistent;
+    }
+
+    /**
+     * Whether the file could be opened; if not, getError() tells why, and
+     * nothing is restored or persisted.
+     */
+    bool isOpen() {
+        return base != NULL;
+    }
+
+    const std::string& getError() {
+        return error;
+    }
+
+    /**
+     * Reads the packet last written for a buffer.
+     *
+     * @param ageMs If not NULL, receives how long ago it was written.
+     *
+     * @return False if there is none, or it does not decode.
+     */
+    template <class Packet>
+    bool load(const std::string& name, Packet& out, int64_t* ageMs = NULL) {
+        if (base == NULL) {
+            return false;
+        }
+        pthread_mutex_lock(&mtx);
+        int e = findEntry(name);
+        int c = e < 0 ? -1 : newestCopy(e);
+        bool ok = false;
+        if (c >= 0) {
+            CopyHeader* h = copyAt(e, c);
+            ok = PacketSnapshotTraits<Packet>::decode(
+                out, reinterpret_cast<const char*>(h + 1), h->length);
+            if (ok && ageMs != NULL) {
+                *ageMs = (wallUs() - h->wallUs) / 1000;
+            }
+        }
+        pthread_mutex_unlock(&mtx);
+        return ok;
+    }
+
+    /**
+     * Seeds a buffer with the packet last written for it; see
+     * BufferThread::restorePacket(). Call before the buffer's threads start.
+     *
+     * @param maxAgeMs Do not restore a packet older than that; -1 for any.
+     *
+     * @return Whether the buffer was seeded.
+     */
+    template <class Packet, class Interface, class Policy>
+    bool restore(const std::string& name,
+                 BufferThread<Packet, Interface, Policy>* buf,
+                 int64_t maxAgeMs = -1) {
+        Packet pkt;
+        int64_t age;
+        if (!load(name, pkt, &age) || (maxAgeMs >= 0 && age > maxAgeMs)) {
+            return false;
+        }
+        buf->restorePacket(pkt);
+        return true;
+    }
+
+    /**
+     * Adds a buffer to those written to the file. The buffer must outlive
+     * the snapshot, or stop() must be called before it goes away.
+     *
+     * @param name Unique name, shorter than SNAPSHOT_NAME_LEN.
+     * @param capacity Largest packet, in bytes (see
+     *        PacketSnapshotTraits::size()); larger packets are not written.
+     *
+     * @return False if the name is too long or the file is full.
+     */
+    template <class Packet, class Interface, class Policy>
+    bool persist(const std::string& name,
+                 BufferThread<Packet, Interface, Policy>* buf,
+                 size_t capacity) {
+        if (base == NULL) {
+            return false;
+        }
+        if (name.empty() || name.size() >= SNAPSHOT_NAME_LEN) {
+            error = "bad snapshot name " + name;
+            return false;
+        }
+        pthread_mutex_lock(&mtx);
+        int e = findEntry(name);
+        if (e >= 0 && dir[e].capacity < capacity) {
+            // Abandon the entry for a bigger one.
+            dir[e].name[0] = '\0';
+            e = -1;
+        }
+        if (e < 0) {
+            size_t need = 2 * copySize(capacity);
+            if (header->numEntries >= MAX_SNAPSHOT_ENTRIES ||
+                header->used + need > size) {
+                error = "snapshot file full";
+                pthread_mutex_unlock(&mtx);
+                return false;
+            }
+            e = header->numEntries;
+            DirEntry& d = dir[e];
+            d.offset = header->used;
+            d.capacity = capacity;
+            memset(d.name, 0, SNAPSHOT_NAME_LEN);
+            memcpy(d.name, name.data(), name.size());
+            memset(base + d.offset, 0, need);
+            header->used += need;
+            // Counting the entry in last makes it visible only when complete.
+            header->numEntries = e + 1;
+        }
+
+        Persisted p;
+        p.entry = e;
+        int c = newestCopy(e);
+        p.generation = c < 0 ? 0 : copyAt(e, c)->generation;
+        p.version = 0;
+        BufferFetch<Packet, BufferThread<Packet, Interface, Policy> > fetch =
+            {buf};
+        p.fetch = fetch;
+        persisted.push_back(p);
+        pthread_mutex_unlock(&mtx);
+        return true;
+    }
+
+    /**
+     * Starts the writer thread. Call only once, after persist().
+     */
+    void start() {
+        if (base == NULL) {
+            return;
+        }
+        boost::function<void*()> thrFun =
+            bind(&PacketSnapshot::writerMeth, this);
+        tfPersistent = new boost::function<void*()>(thrFun);
+        pthread_create(&write_thread, NULL, &pthreadWrapper, tfPersistent);
+        bStarted = true;
+    }
+
+    /**
+     * Stops the writer thread, writes the latest packets one last time and
+     * forgets the persisted buffers, which may then be destroyed. Call it
+     * when shutting down, before the buffers go away.
+     */
+    void stop() {
+        stopWriter();
+        if (base == NULL) {
+            return;
+        }
+        flush();
+        pthread_mutex_lock(&mtx);
+        persisted.clear();
+        pthread_mutex_unlock(&mtx);
+    }
+
+    /**
+     * Writes the packets published since the last pass now, and waits for
+     * the file to reach the disk.
+     */
+    void flush() {
+        if (base == NULL) {
+            return;
+        }
+        pthread_mutex_lock(&mtx);
+        writeChanged();
+        pthread_mutex_unlock(&mtx);
+        msync(base, size, MS_SYNC);
+    }
+
+    /** Number of packets written to the file. */
+    uint64_t getWriteCount() {
+        return writes.load(std::memory_order_relaxed);
+    }
+
+    /** Number of packets not written for exceeding their capacity. */
+    uint64_t getOversizeCount() {
+        return oversize.load(std::memory_order_relaxed);
+    }
+};
+
+#endif
@@ -0,0 +1,137 @@
+#include "BufferThreadedP.h"
+#include "IOBuffer.h"
+#include <cstdlib>
+#include <iostream>
+
+using namespace std;
+
+const size_t ARRAY_LEN = 1 << 22; // 16 MB of ints, more than the caches
+
+/** Simulated sensor: a short sleep, then a little copying. */
+class SleepySensor {
+    int n;
+
+    public:
+    SleepySensor() : n(0) {}
+
+    int getPacket() {
+        usleep(2000);
+        return ++n;
+    }
+};
+
+/** Sums the array front to back: prefetch friendly. */
+class ScanStage {
+    vector<int>* data;
+
+    public:
+    ScanStage(vector<int>* data) : data(data) {}
+
+    long runProcess(int& in) {
+        long sum = in;
+        for (size_t i = 0; i < data->size(); i++) {
+            sum += (*data)[i];
+        }
+        return sum;
+    }
+};
+
+/** Follows a random cycle through the array: a cache miss per step. */
+class ChaseStage {
+    vector<int>* next;
+
+    public:
+    ChaseStage(vector<int>* next) : next(next) {}
+
+    long runProcess(int& in) {
+        int i = in % next->size();
+        for (size_t k = 0; k < (1 << 20); k++) {
+            i = (*next)[i];
+        }
+        return i;
+    }
+};
+
+/** Branches on random data: a mispredict every other element. */
+class BranchStage {
+    vector<int>* data;
+
+    public:
+    BranchStage(vector<int>* data) : data(data) {}
+
+    long runProcess(int& in) {
+        long count = in;
+        for (size_t i = 0; i < (1 << 20); i++) {
+            if ((*data)[i] & 1) {
+                count += (*data)[i] >> 3;
+            } else {
+                count -= 7;
+            }
+        }
+        return count;
+    }
+};
+
+/**
+ * Runs a stage on a number of inputs, measuring it with the counters.
+ */
+template <class Stage>
+void runStage(Stage* stage, PerfStageStats* stats, int rounds) {
+    IOBuffer<int, long, Stage> buf(stage);
+    buf.setPerfStats(stats);
+    buf.runContinuous();
+    uint64_t v = 0;
+    for (int r = 0; r < rounds; r++) {
+        buf.providePacket(r);
+        while (buf.waitForOutput(v, 1000) == v) {}
+        v = buf.getVersion();
+    }
+}
+
+/**
+ * Compares the hardware (or, failing that, software) counters of a sensor
+ * read and three stages with very different memory and branch behaviour.
+ */
+int main(int argc, char** argv) {
+    vector<int> data(ARRAY_LEN);
+    srand(1);
+    for (size_t i = 0; i < ARRAY_LEN; i++) {
+        data[i] = rand();
+    }
+    // A single random cycle (Sattolo's algorithm) for the pointer chase.
+    vector<int> next(ARRAY_LEN);
+    for (size_t i = 0; i < ARRAY_LEN; i++) {
+        next[i] = i;
+    }
+    for (size_t i = ARRAY_LEN - 1; i > 0; i--) {
+        size_t j = rand() % i;
+        swap(next[i], next[j]);
+    }
+
+    PerfStageStats sensorStats("sensor read");
+    PerfStageStats scanStats("scan");
+    PerfStageStats chaseStats("chase");
+    PerfStageStats branchStats("branch");
+
+    SleepySensor sensor;
+    {
+        BufferThread<int, SleepySensor> buf(&sensor);
+        buf.setPerfStats(&sensorStats);
+        buf.runContinuous();
+        buf.waitForVersion(100);
+    }
+    ScanStage scan(&data);
+    runStage(&scan, &scanStats, 20);
+    ChaseStage chase(&next);
+    runStage(&chase, &chaseStats, 20);
+    BranchStage branch(&data);
+    runStage(&branch, &branchStats, 20);
+
+    vector<PerfStageStats*> all;
+    all.push_back(&sensorStats);
+    all.push_back(&scanStats);
+    all.push_back(&chaseStats);
+    all.push_back(&branchStats);
+    PerfStageStats::report(cout, all);
+    return 0;
+}
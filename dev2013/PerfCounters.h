@@ -0,0 +1,299 @@
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <unistd.h>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+
+#include "MonotonicClock.h"
+
+// Header guards -- this file may be included more than once.
+#ifndef PERFCOUNTERS_H_
+#define PERFCOUNTERS_H_
+
+/** Counters per PerfCounterGroup. */
+const int NUM_PERF_COUNTERS = 4;
+
+/**
+ * Which counters a PerfCounterGroup could open.
+ */
+enum PerfMode {
+    PERF_NONE,     /**< None; only the wall time is measured */
+    PERF_HARDWARE, /**< Cycles, instructions, cache and branch misses */
+    PERF_SOFTWARE  /**< Task clock, context switches, page faults */
+};
+
+/**
+ * The perf_event_open() counters of the calling thread, opened as one group
+ * so that they are always scheduled (and read) together. The hardware
+ * counters of the PMU are tried first; where there is no PMU, as in most
+ * virtual machines, or it may not be used, the kernel's software counters
+ * are used instead, and if perf_event_open() is not allowed at all (see
+ * /proc/sys/kernel/perf_event_paranoid), none.
+ *
+ * Hardware events are counted in user space only, which is all an
+ * unprivileged process may count; software events in the kernel as well,
+ * where allowed. The group counts for the thread that constructed it only.
+ */
+class PerfCounterGroup {
+
+    private:
+    int fds[NUM_PERF_COUNTERS];
+    int num;
+    PerfMode mode;
+
+    PerfCounterGroup(const PerfCounterGroup&);
+    PerfCounterGroup& operator=(const PerfCounterGroup&);
+
+    static int openCounter(uint32_t type, uint64_t config, bool user,
+                           int group) {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.read_format = PERF_FORMAT_GROUP;
+        attr.exclude_kernel = user;
+        attr.exclude_hv = 1;
+        return syscall(SYS_perf_event_open, &attr, 0, -1, group,
+                       PERF_FLAG_FD_CLOEXEC);
+    }
+
+    void closeAll() {
+        for (int i = 0; i < num; i++) {
+            close(fds[i]);
+        }
+        num = 0;
+    }
+
+    bool openSet(uint32_t type, const uint64_t* configs, int n, bool user) {
+        for (int i = 0; i < n; i++) {
+            int fd = openCounter(type, configs[i], user,
+                                 i == 0 ? -1 : fds[0]);
+            if (fd < 0) {
+                closeAll();
+                return false;
+            }
+            fds[num++] = fd;
+        }
+        return true;
+    }
+
+    public:
+    PerfCounterGroup() : num(0), mode(PERF_NONE) {
+        static const uint64_t hw[] = {
+            PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+            PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+        static const uint64_t sw[] = {
+            PERF_COUNT_SW_TASK_CLOCK, PERF_COUNT_SW_CONTEXT_SWITCHES,
+            PERF_COUNT_SW_PAGE_FAULTS};
+        // Software events such as context switches happen in the kernel,
+        // so count them there too if allowed.
+        if (openSet(PERF_TYPE_HARDWARE, hw, 4, true)) {
+            mode = PERF_HARDWARE;
+        } else if (openSet(PERF_TYPE_SOFTWARE, sw, 3, false) ||
+                   openSet(PERF_TYPE_SOFTWARE, sw, 3, true)) {
+            mode = PERF_SOFTWARE;
+        }
+    }
+
+    ~PerfCounterGroup() {
+        closeAll();
+    }
+
+    PerfMode getMode() {
+        return mode;
+    }
+
+    /**
+     * Reads the counters, in the order of PerfStageStats::counterName();
+     * unused ones read as zero.
+     *
+     * @return False if there are no counters or the read failed.
+     */
+    bool read(uint64_t values[NUM_PERF_COUNTERS]) {
+        uint64_t buf[1 + NUM_PERF_COUNTERS];
+        memset(values, 0, NUM_PERF_COUNTERS * sizeof(uint64_t));
+        if (num == 0 || ::read(fds[0], buf, sizeof(buf)) <
+                (ssize_t) ((1 + num) * sizeof(uint64_t))) {
+            return false;
+        }
+        for (int i = 0; i < num && i < (int) buf[0]; i++) {
+            values[i] = buf[1 + i];
+        }
+        return true;
+    }
+};
+
+/**
+ * Plain copy of the totals of a PerfStageStats.
+ */
+struct PerfSummary {
+    std::string name;
+    PerfMode mode;
+    uint64_t samples;
+    uint64_t wallNs;
+    uint64_t counters[NUM_PERF_COUNTERS];
+};
+
+/**
+ * Counter totals of one processing stage or sensor read, over all the
+ * threads that report to it: e.g. pass one to the IOBuffer running the
+ * stage with IOBuffer::setPerfStats(). The totals are relaxed atomics, like
+ * the other statistics of the buffers.
+ */
+class PerfStageStats {
+
+    private:
+    std::string name;
+    std::atomic<int> mode;
+    std::atomic<uint64_t> samples;
+    std::atomic<uint64_t> wallNs;
+    std::atomic<uint64_t> counters[NUM_PERF_COUNTERS];
+
+    PerfStageStats(const PerfStageStats&);
+    PerfStageStats& operator=(const PerfStageStats&);
+
+    public:
+    PerfStageStats(const std::string& name) : name(name), mode(-1),
+                                              samples(0), wallNs(0) {
+        for (int i = 0; i < NUM_PERF_COUNTERS; i++) {
+            counters[i].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * The name of counter i in the given mode, or NULL if it is unused.
+     */
+    static const char* counterName(PerfMode m, int i) {
+        static const char* hw[] = {"cycles", "instructions", "cache-misses",
+                                   "branch-misses"};
+        static const char* sw[] = {"task-clock-ns", "ctx-switches",
+                                   "page-faults", NULL};
+        if (m == PERF_HARDWARE) {
+            return hw[i];
+        }
+        return m == PERF_SOFTWARE ? sw[i] : NULL;
+    }
+
+    /**
+     * Adds one sample. Samples of a mode other than that of the first one
+     * (a thread that could not open the same counters) count for the wall
+     * time only.
+     */
+    void add(PerfMode m, const uint64_t delta[NUM_PERF_COUNTERS],
+             int64_t ns) {
+        int expected = -1;
+        mode.compare_exchange_strong(expected, m, std::memory_order_relaxed);
+        samples.fetch_add(1, std::memory_order_relaxed);
+        wallNs.fetch_add(ns, std::memory_order_relaxed);
+        if (mode.load(std::memory_order_relaxed) != m) {
+            return;
+        }
+        for (int i = 0; i < NUM_PERF_COUNTERS; i++) {
+            counters[i].fetch_add(delta[i], std::memory_order_relaxed);
+        }
+    }
+
+    PerfSummary getSummary() {
+        PerfSummary s;
+        s.name = name;
+        int m = mode.load(std::memory_order_relaxed);
+        s.mode = m < 0 ? PERF_NONE : static_cast<PerfMode>(m);
+        s.samples = samples.load(std::memory_order_relaxed);
+        s.wallNs = wallNs.load(std::memory_order_relaxed);
+        for (int i = 0; i < NUM_PERF_COUNTERS; i++) {
+            s.counters[i] = counters[i].load(std::memory_order_relaxed);
+        }
+        return s;
+    }
+
+    /**
+     * Prints the means per sample of a number of stages as a table, with
+     * instructions per cycle and misses per thousand instructions when the
+     * hardware counters were available.
+     */
+    static void report(std::ostream& os,
+                       const std::vector<PerfStageStats*>& stages) {
+        for (size_t i = 0; i < stages.size(); i++) {
+            PerfSummary s = stages[i]->getSummary();
+            double n = s.samples > 0 ? s.samples : 1;
+            char line[256];
+            snprintf(line, sizeof(line), "%-16s %8llu samples %10.1f us",
+                     s.name.c_str(), (unsigned long long) s.samples,
+                     s.wallNs / n / 1000);
+            os << line;
+            for (int c = 0; c < NUM_PERF_COUNTERS; c++) {
+                const char* cn = counterName(s.mode, c);
+                if (cn != NULL) {
+                    snprintf(line, sizeof(line), "  %s %.1f", cn,
+                             s.counters[c] / n);
+                    os << line;
+                }
+            }
+            if (s.mode == PERF_HARDWARE && s.counters[0] > 0 &&
+                    s.counters[1] > 0) {
+                snprintf(line, sizeof(line), "  IPC %.2f  cache-MPKI %.2f  "
+                         "branch-MPKI %.2f",
+                         (double) s.counters[1] / s.counters[0],
+                         1000.0 * s.counters[2] / s.counters[1],
+                         1000.0 * s.counters[3] / s.counters[1]);
+                os << line;
+            } else if (s.mode == PERF_NONE) {
+                os << "  (no counters available)";
+            }
+            os << std::endl;
+        }
+    }
+};
+
+/**
+ * Measures sections of code on one thread (a buffer's updater, say) into
+ * PerfStageStats. The counters are opened on the first begin(), i.e. by
+ * the thread using the probe, and closed when the probe is destroyed.
+ */
+class PerfProbe {
+
+    private:
+    PerfCounterGroup* group;
+    uint64_t before[NUM_PERF_COUNTERS];
+    int64_t startNs;
+
+    PerfProbe(const PerfProbe&);
+    PerfProbe& operator=(const PerfProbe&);
+
+    public:
+    PerfProbe() : group(NULL), startNs(0) {}
+
+    ~PerfProbe() {
+        delete group;
+    }
+
+    void begin() {
+        if (group == NULL) {
+            group = new PerfCounterGroup();
+        }
+        group->read(before);
+        startNs = monotonicNs();
+    }
+
+    void end(PerfStageStats* stats) {
+        int64_t ns = monotonicNs() - startNs;
+        uint64_t after[NUM_PERF_COUNTERS];
+        uint64_t delta[NUM_PERF_COUNTERS];
+        PerfMode m = group->getMode();
+        if (!group->read(after)) {
+            m = PERF_NONE;
+        }
+        for (int i = 0; i < NUM_PERF_COUNTERS; i++) {
+            delta[i] = after[i] - before[i];
+        }
+        stats->add(m, delta, ns);
+    }
+};
+
+#endif
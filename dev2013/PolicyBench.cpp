@@ -0,0 +1,166 @@
+#include "BufferThreadedP.h"
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <time.h>
+
+using namespace std;
+
+/**
+ * Fixed-size, trivially copyable packet. Every byte holds the same value, so
+ * readers can tell if they were handed a torn (half-updated) copy.
+ */
+template <size_t Size>
+struct BlobPacket {
+    unsigned char data[Size];
+
+    BlobPacket() {
+        memset(data, 0, Size);
+    }
+
+    bool isConsistent() const {
+        for (size_t i = 1; i < Size; i++) {
+            if (data[i] != data[0]) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+/**
+ * Sensor stand-in that produces a new packet as fast as it is asked to.
+ */
+template <size_t Size>
+class BlobInterface {
+    unsigned char counter;
+    std::atomic<long>* writes;
+
+    public:
+    BlobInterface(std::atomic<long>* writes) : counter(0), writes(writes) {}
+
+    BlobPacket<Size> getPacket() {
+        BlobPacket<Size> pkt;
+        memset(pkt.data, ++counter, Size);
+        writes->fetch_add(1, std::memory_order_relaxed);
+        return pkt;
+    }
+};
+
+/**
+ * State shared between the reader threads of one benchmark run.
+ */
+template <class Buffer>
+struct ReaderArgs {
+    Buffer* buf;
+    std::atomic<bool>* stop;
+    long reads;
+    long torn;
+};
+
+template <class Buffer>
+void* readerMain(void* arg) {
+    ReaderArgs<Buffer>* ra = static_cast<ReaderArgs<Buffer>*>(arg);
+    while (!ra->stop->load(std::memory_order_relaxed)) {
+        if (!ra->buf->getPacket().isConsistent()) {
+            ++ra->torn;
+        }
+        ++ra->reads;
+    }
+    return NULL;
+}
+
+/**
+ * Runs one cell of the matrix: a continuously updating buffer with the
+ * given policy and packet size, hammered by numReaders threads for
+ * durationMs milliseconds. Prints reads/s, writes/s and torn reads.
+ */
+template <class SyncPolicy, size_t Size>
+void runCell(const char* name, int numReaders, int durationMs) {
+    typedef BufferThread<BlobPacket<Size>, BlobInterface<Size>, SyncPolicy>
+        Buffer;
+    std::atomic<long> writes(0);
+    std::atomic<bool> stop(false);
+    BlobInterface<Size> iface(&writes);
+    Buffer* buf = new Buffer(&iface);
+    buf->runContinuous();
+
+    ReaderArgs<Buffer>* args = new ReaderArgs<Buffer>[numReaders];
+    pthread_t* threads = new pthread_t[numReaders];
+    for (int i = 0; i < numReaders; i++) {
+        args[i].buf = buf;
+        args[i].stop = &stop;
+        args[i].reads = 0;
+        args[i].torn = 0;
+        pthread_create(&threads[i], NULL, &readerMain<Buffer>, &args[i]);
+    }
+
+    timespec ts;
+    ts.tv_sec = durationMs / 1000;
+    ts.tv_nsec = (durationMs % 1000) * 1000000L;
+    long writesBefore = writes.load();
+    nanosleep(&ts, NULL);
+    long writesDone = writes.load() - writesBefore;
+    stop.store(true);
+
+    long reads = 0;
+    long torn = 0;
+    for (int i = 0; i < numReaders; i++) {
+        pthread_join(threads[i], NULL);
+        reads += args[i].reads;
+        torn += args[i].torn;
+    }
+    delete buf;
+    delete[] threads;
+    delete[] args;
+
+    double secs = durationMs / 1000.0;
+    cout << setw(14) << name << setw(8) << Size << setw(8) << numReaders <<
+        setw(14) << (long) (reads / secs) <<
+        setw(14) << (long) (writesDone / secs) <<
+        setw(8) << torn << endl;
+}
+
+/**
+ * One row of the matrix: all policies for a given packet size and reader
+ * count.
+ */
+template <size_t Size>
+void runRow(int numReaders, int durationMs) {
+    runCell<MutexPolicy, Size>("Mutex", numReaders, durationMs);
+    runCell<SpinParkPolicy, Size>("SpinPark", numReaders, durationMs);
+    runCell<SeqLockPolicy, Size>("SeqLock", numReaders, durationMs);
+    runCell<DoubleBufferPolicy, Size>("DoubleBuffer", numReaders,
+                                      durationMs);
+    runCell<RcuPolicy, Size>("Rcu", numReaders, durationMs);
+}
+
+template <size_t Size>
+void runSize(int durationMs) {
+    long numCpus = sysconf(_SC_NPROCESSORS_ONLN);
+    for (int readers = 1; readers <= numCpus; readers *= 2) {
+        runRow<Size>(readers, durationMs);
+    }
+}
+
+/**
+ * Benchmark matrix of the buffer synchronization policies over packet size
+ * and reader count.
+ *
+ * Usage: PolicyBench [durationMs]  (default 200 ms per cell)
+ */
+int main(int argc, char** argv) {
+    int durationMs = 200;
+    if (argc > 1) {
+        durationMs = atoi(argv[1]);
+    }
+    cout << setw(14) << "policy" << setw(8) << "bytes" << setw(8) <<
+        "readers" << setw(14) << "reads/s" << setw(14) << "writes/s" <<
+        setw(8) << "torn" << endl;
+    runSize<16>(durationMs);
+    runSize<512>(durationMs);
+    runSize<8192>(durationMs);
+    return 0;
+}
@@ -0,0 +1,153 @@
+#include <pthread.h>
+#include <atomic>
+#include <vector>
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+// Header guards -- this file may be included more than once.
+#ifndef READYNOTIFIER_H_
+#define READYNOTIFIER_H_
+
+/**
+ * Publication readiness for external event loops. A ReadyNotifier owns an
+ * eventfd that becomes readable whenever one of the buffers attached to it
+ * publishes a new packet, so an application that already sits in epoll(),
+ * poll() or select() can watch any number of buffers through a single file
+ * descriptor, without a polling thread.
+ *
+ * Each attached buffer gets a small integer tag. When the descriptor is
+ * readable, drain() hands back the tags of all buffers that published since
+ * the last drain; each tag is reported once per drain, however many packets
+ * that buffer published in between.
+ *
+ * Use one notifier per buffer for one descriptor per buffer, or share one
+ * between a group of buffers. The eventfd is only written when the notifier
+ * goes from "nothing ready" to "something ready", so a busy group costs one
+ * system call per drain rather than one per publication.
+ *
+ * The number of sources is fixed when the notifier is constructed.
+ */
+class ReadyNotifier {
+
+    private:
+    int efd;
+    pthread_mutex_t list_mtx;
+    // Per-tag "already in the ready list" flags, indexed by tag.
+    std::atomic<bool>* flags;
+    int capacity;
+    int numSources;
+    std::vector<int> readyList;
+    std::atomic<bool> signalled;
+
+    ReadyNotifier(const ReadyNotifier&);
+    ReadyNotifier& operator=(const ReadyNotifier&);
+
+    public:
+    /**
+     * @param capacity The maximum number of sources that can be attached.
+     */
+    ReadyNotifier(int capacity = 1024) :
+                  capacity(capacity), numSources(0), signalled(false) {
+        efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        pthread_mutex_init(&list_mtx, NULL);
+        flags = new std::atomic<bool>[capacity];
+        for (int i = 0; i < capacity; i++) {
+            flags[i].store(false, std::memory_order_relaxed);
+        }
+        readyList.reserve(capacity);
+    }
+
+    ~ReadyNotifier() {
+        close(efd);
+        pthread_mutex_destroy(&list_mtx);
+        delete[] flags;
+    }
+
+    /**
+     * The file descriptor to hand to epoll/poll/select (readable means
+     * "call drain()"). It is non-blocking and close-on-exec, and is owned
+     * by the notifier; do not close it. Negative if eventfd() failed.
+     */
+    int getFd() {
+        return efd;
+    }
+
+    /**
+     * Registers a new source and returns its tag, or -1 if the notifier is
+     * full. Buffers call this from their attachNotifier() method; there is
+     * normally no need to call it directly.
+     */
+    int addSource() {
+        int tag = -1;
+        pthread_mutex_lock(&list_mtx);
+        if (numSources < capacity) {
+            tag = numSources++;
+        }
+        pthread_mutex_unlock(&list_mtx);
+        return tag;
+    }
+
+    /**
+     * Marks the source with the given tag as ready. Called by the buffer's
+     * updater thread after each publication.
+     */
+    void markReady(int tag) {
+        std::atomic<bool>* flag = &flags[tag];
+        /* Fast path: already listed. The fence pairs with the one in drain():
+         * either we see the flag cleared, or the drainer sees our
+         * publication when it reads the buffer.
+         */
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (flag->load(std::memory_order_relaxed)) {
+            return;
+        }
+
+        pthread_mutex_lock(&list_mtx);
+        if (!flag->load(std::memory_order_relaxed)) {
+            flag->store(true, std::memory_order_relaxed);
+            readyList.push_back(tag);
+        }
+        pthread_mutex_unlock(&list_mtx);
+
+        if (!signalled.exchange(true)) {
+            uint64_t one = 1;
+            ssize_t ret;
+            do {
+                ret = write(efd, &one, sizeof(one));
+            } while (ret < 0 && errno == EINTR);
+        }
+    }
+
+    /**
+     * Collects the tags of all sources that published since the last call
+     * and resets the descriptor to non-readable. Never blocks.
+     *
+     * @param ready Receives the ready tags (appended, in no special order).
+     *
+     * @return The number of tags appended.
+     */
+    size_t drain(std::vector<int>& ready) {
+        // Re-arm first, so that a publication racing with us signals again.
+        signalled.store(false);
+        uint64_t count;
+        ssize_t ret;
+        do {
+            ret = read(efd, &count, sizeof(count));
+        } while (ret < 0 && errno == EINTR);
+
+        size_t before = ready.size();
+        pthread_mutex_lock(&list_mtx);
+        for (size_t i = 0; i < readyList.size(); i++) {
+            flags[readyList[i]].store(false, std::memory_order_relaxed);
+            ready.push_back(readyList[i]);
+        }
+        readyList.clear();
+        pthread_mutex_unlock(&list_mtx);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        return ready.size() - before;
+    }
+};
+
+#endif
@@ -0,0 +1,146 @@
+#include "BufferThreadedP.h"
+#include <atomic>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <sched.h>
+#include <time.h>
+
+using namespace std;
+
+/**
+ * A robot pose, the textbook example of a small packet read by everybody.
+ */
+struct PosePacket {
+    double x;
+    double y;
+    double heading;
+    double velocity;
+    long seq;
+};
+
+/**
+ * Pose source publishing at a fixed rate.
+ */
+class PoseInterface {
+    long seq;
+    int periodUs;
+
+    public:
+    PoseInterface(int periodUs) : seq(0), periodUs(periodUs) {}
+
+    PosePacket getPacket() {
+        usleep(periodUs);
+        PosePacket p;
+        p.x = p.y = p.heading = p.velocity = seq;
+        p.seq = ++seq;
+        return p;
+    }
+};
+
+std::atomic<bool> stopFlag(false);
+
+/**
+ * Arguments of one reader thread.
+ */
+template <class Buffer>
+struct ReaderArgs {
+    Buffer* buf;
+    int cpu;
+    long reads;
+};
+
+template <class Buffer>
+void* readerMain(void* arg) {
+    ReaderArgs<Buffer>* ra = static_cast<ReaderArgs<Buffer>*>(arg);
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(ra->cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+
+    double sum = 0;
+    while (!stopFlag.load(std::memory_order_relaxed)) {
+        sum += ra->buf->getPacket().heading;
+        ++ra->reads;
+    }
+    // Keep the reads from being optimized away.
+    if (sum < 0) {
+        cout << sum;
+    }
+    return NULL;
+}
+
+/**
+ * Total reads per second of numReaders threads, one per core, reading a
+ * pose buffer with the given policy while it is updated at 1 kHz.
+ */
+template <class SyncPolicy>
+double readRate(int numReaders, int durationMs) {
+    typedef BufferThread<PosePacket, PoseInterface, SyncPolicy> Buffer;
+    PoseInterface iface(1000);
+    Buffer buf(&iface);
+    buf.runContinuous();
+
+    stopFlag.store(false);
+    ReaderArgs<Buffer>* args = new ReaderArgs<Buffer>[numReaders];
+    pthread_t* threads = new pthread_t[numReaders];
+    for (int i = 0; i < numReaders; i++) {
+        args[i].buf = &buf;
+        args[i].cpu = i;
+        args[i].reads = 0;
+        pthread_create(&threads[i], NULL, &readerMain<Buffer>, &args[i]);
+    }
+    timespec ts;
+    ts.tv_sec = durationMs / 1000;
+    ts.tv_nsec = (durationMs % 1000) * 1000000L;
+    nanosleep(&ts, NULL);
+    stopFlag.store(true);
+
+    long reads = 0;
+    for (int i = 0; i < numReaders; i++) {
+        pthread_join(threads[i], NULL);
+        reads += args[i].reads;
+    }
+    delete[] threads;
+    delete[] args;
+    return reads * 1000.0 / durationMs;
+}
+
+/**
+ * One row of the table: all policies with numReaders readers.
+ */
+void printRow(int numReaders, int durationMs) {
+    cout << setw(8) << numReaders <<
+        setw(12) << readRate<MutexPolicy>(numReaders, durationMs) / 1e6 <<
+        setw(12) << readRate<SeqLockPolicy>(numReaders, durationMs) / 1e6 <<
+        setw(12) << readRate<RcuPolicy>(numReaders, durationMs) / 1e6 <<
+        setw(14) << readRate<ReplicatedPolicy<SeqLockPolicy> >(
+            numReaders, durationMs) / 1e6 <<
+        setw(12) << readRate<ReplicatedPolicy<MutexPolicy> >(
+            numReaders, durationMs) / 1e6 << endl;
+}
+
+/**
+ * Read scaling from one core to all cores: single-slot policies against
+ * per-core replicated ones. Prints total reads per second (millions).
+ *
+ * Usage: ReplicaBench [durationMs]  (default 300 ms per run)
+ */
+int main(int argc, char** argv) {
+    int durationMs = 300;
+    if (argc > 1) {
+        durationMs = atoi(argv[1]);
+    }
+    int numCpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    cout << setw(8) << "readers" << setw(12) << "Mutex" << setw(12) <<
+        "SeqLock" << setw(12) << "Rcu" << setw(14) << "Repl<SeqLock>" <<
+        setw(12) << "Repl<Mutex>" << "   (Mreads/s)" << endl;
+    cout << fixed << setprecision(2);
+    int n;
+    for (n = 1; n < numCpus; n *= 2) {
+        printRow(n, durationMs);
+    }
+    printRow(numCpus, durationMs);
+    return 0;
+}
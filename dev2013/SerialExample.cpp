@@ -0,0 +1,169 @@
+#include "BufferThreadedP.h"
+#include "DeviceEmulator.h"
+#include "SerialLine.h"
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#include <vector>
+
+using namespace std;
+
+/** One reading of the sensor Arduino. */
+class ArduinoPacket {
+    timeval stamp;
+    uint64_t seq;
+    int64_t sentNs;
+    vector<int> channels;
+
+    public:
+    ArduinoPacket() : seq(0), sentNs(0) {
+        stamp.tv_sec = 0;
+        stamp.tv_usec = 0;
+    }
+
+    ArduinoPacket(uint64_t seq, int64_t sentNs, const vector<int>& ch) :
+                  seq(seq), sentNs(sentNs), channels(ch) {
+        gettimeofday(&stamp, NULL);
+    }
+
+    timeval getTimeStamp() const {
+        return stamp;
+    }
+
+    uint64_t getSeq() const {
+        return seq;
+    }
+
+    const vector<int>& getChannels() const {
+        return channels;
+    }
+};
+
+/**
+ * A serial Interface of the kind that talks to the real Arduino: it knows
+ * nothing about the emulator, only the device path. It keeps the latency
+ * of every reading (from the Arduino's time stamp to parsing) and counts
+ * readings missing from the sequence.
+ */
+class ArduinoInterface {
+    SerialLine port;
+    uint64_t lastSeq;
+
+    public:
+    vector<int64_t> latencies;
+    uint64_t missing;
+
+    ArduinoInterface(const string& path, int baud) : lastSeq(0),
+                                                     missing(0) {
+        port.open(path, baud);
+    }
+
+    ArduinoPacket getPacket() {
+        string line;
+        while (port.readLine(line, 1000)) {
+            unsigned long long seq;
+            long long ns;
+            int off = 0;
+            if (sscanf(line.c_str(), "A,%llu,%lld%n", &seq, &ns, &off) < 2) {
+                continue;
+            }
+            latencies.push_back(monotonicNs() - ns);
+            if (lastSeq != 0 && seq > lastSeq + 1) {
+                missing += seq - lastSeq - 1;
+            }
+            lastSeq = seq;
+            vector<int> ch;
+            const char* p = line.c_str() + off;
+            int v, n;
+            while (sscanf(p, ",%d%n", &v, &n) == 1) {
+                ch.push_back(v);
+                p += n;
+            }
+            return ArduinoPacket(seq, ns, ch);
+        }
+        return ArduinoPacket();
+    }
+
+    uint64_t getBadLines() const {
+        return port.getBadLines();
+    }
+};
+
+/**
+ * Streams the emulated Arduino at 200 Hz over one link model for a second,
+ * read by an ArduinoInterface in a BufferThread.
+ */
+void runArduino(const char* name, const LinkModel& link) {
+    ArduinoProtocol arduino(200, 6);
+    DeviceEmulator<ArduinoProtocol> emu(&arduino, link);
+    if (!emu.isOpen()) {
+        cout << "Could not create a pseudo-terminal" << endl;
+        return;
+    }
+    ArduinoInterface iface(emu.getPath(), link.baud);
+    emu.start();
+    {
+        BufferThread<ArduinoPacket, ArduinoInterface> buf(&iface);
+        buf.setThreadName("arduino");
+        buf.runContinuous();
+        usleep(1000000);
+    }
+    vector<int64_t> lat = iface.latencies;
+    sort(lat.begin(), lat.end());
+    if (lat.empty()) {
+        printf("%-22s no readings\n", name);
+        return;
+    }
+    printf("%-22s %5zu readings %4llu missing %3llu bad  latency "
+           "p50 %7.1f  p99 %7.1f  max %7.1f us\n", name, lat.size(),
+           (unsigned long long) iface.missing,
+           (unsigned long long) iface.getBadLines(),
+           lat[lat.size() / 2] / 1e3, lat[lat.size() * 99 / 100] / 1e3,
+           lat.back() / 1e3);
+}
+
+/**
+ * Round trips to the emulated motor controller.
+ */
+void runMotor(const LinkModel& link) {
+    MotorControllerProtocol motors;
+    DeviceEmulator<MotorControllerProtocol> emu(&motors, link);
+    SerialLine port;
+    if (!emu.isOpen() || !port.open(emu.getPath(), link.baud)) {
+        cout << "Could not open the motor controller" << endl;
+        return;
+    }
+    emu.start();
+    const int N = 200;
+    int ok = 0;
+    int64_t start = monotonicNs();
+    for (int i = 0; i < N; i++) {
+        char cmd[32];
+        snprintf(cmd, sizeof(cmd), "M,%d,%d", i % 255, -(i % 255));
+        port.writeLine(cmd);
+        string reply;
+        if (port.readLine(reply, 100) && reply.compare(0, 3, "OK,") == 0) {
+            ++ok;
+        }
+    }
+    double rtt = (monotonicNs() - start) / 1e3 / N;
+    port.writeLine("Q");
+    string enc;
+    port.readLine(enc, 100);
+    printf("motor controller: %d/%d commands acknowledged, mean round trip "
+           "%.1f us, last encoders %s\n", ok, N, rtt, enc.c_str());
+}
+
+/**
+ * Runs the serial Interfaces against emulated devices over a range of
+ * links.
+ */
+int main(int argc, char** argv) {
+    runArduino("clean 115200 baud", LinkModel(115200));
+    runArduino("9600 baud, 64 B buffer", LinkModel(9600, 0, 0, 0, 0, 64));
+    runArduino("2 ms + 1 ms jitter", LinkModel(115200, 2000000, 1000000));
+    runArduino("noisy (1e-3/byte, 1%)", LinkModel(115200, 0, 0, 1e-3,
+                                                   0.01));
+    runMotor(LinkModel(115200, 500000));
+    return 0;
+}
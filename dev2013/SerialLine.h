@@ -0,0 +1,203 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <stdint.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "MonotonicClock.h"
+
+// Header guards -- this file may be included more than once.
+#ifndef SERIALLINE_H_
+#define SERIALLINE_H_
+
+/**
+ * Wraps a payload into a line of the serial protocols:
+ * `<payload>*<checksum>\n`, with the checksum the XOR of the payload bytes
+ * in two hex digits, as in NMEA.
+ */
+inline std::string frameLine(const std::string& payload) {
+    uint8_t ck = 0;
+    for (size_t i = 0; i < payload.size(); i++) {
+        ck ^= (uint8_t) payload[i];
+    }
+    char tail[8];
+    snprintf(tail, sizeof(tail), "*%02X\n", ck);
+    return payload + tail;
+}
+
+/**
+ * Checks the checksum of a line (without its newline) and extracts the
+ * payload.
+ *
+ * @return Whether the line was intact.
+ */
+inline bool unframeLine(const std::string& line, std::string& payload) {
+    size_t star = line.rfind('*');
+    if (star == std::string::npos || line.size() - star != 3) {
+        return false;
+    }
+    uint8_t ck = 0;
+    for (size_t i = 0; i < star; i++) {
+        ck ^= (uint8_t) line[i];
+    }
+    char* end;
+    unsigned long want = strtoul(line.c_str() + star + 1, &end, 16);
+    if (*end != '\0' || want != ck) {
+        return false;
+    }
+    payload = line.substr(0, star);
+    return true;
+}
+
+/**
+ * A serial port in raw mode, read and written a line at a time; the
+ * building block of the Interfaces of serial devices. It works the same on
+ * a real port (/dev/ttyUSB0) and on the pseudo-terminal of a
+ * DeviceEmulator (DeviceEmulator.h).
+ */
+class SerialLine {
+
+    private:
+    int fd;
+    std::string pending;
+    uint64_t badLines;
+
+    SerialLine(const SerialLine&);
+    SerialLine& operator=(const SerialLine&);
+
+    static speed_t speedOf(int baud) {
+        switch (baud) {
+        case 9600: return B9600;
+        case 19200: return B19200;
+        case 38400: return B38400;
+        case 57600: return B57600;
+        case 230400: return B230400;
+        case 460800: return B460800;
+        case 921600: return B921600;
+        default: return B115200;
+        }
+    }
+
+    public:
+    SerialLine() : fd(-1), badLines(0) {}
+
+    ~SerialLine() {
+        close();
+    }
+
+    /**
+     * Opens the port in raw 8N1 mode.
+     *
+     * @return False if the port could not be opened or configured.
+     */
+    bool open(const std::string& path, int baud = 115200) {
+        close();
+        fd = ::open(path.c_str(), O_RDWR | O_NOCTTY | O_CLOEXEC);
+        if (fd < 0) {
+            return false;
+        }
+        termios tio;
+        if (tcgetattr(fd, &tio) != 0) {
+            close();
+            return false;
+        }
+        cfmakeraw(&tio);
+        cfsetspeed(&tio, speedOf(baud));
+        tio.c_cflag |= CLOCAL | CREAD;
+        tio.c_cc[VMIN] = 1;
+        tio.c_cc[VTIME] = 0;
+        if (tcsetattr(fd, TCSANOW, &tio) != 0) {
+            close();
+            return false;
+        }
+        tcflush(fd, TCIOFLUSH);
+        pending.clear();
+        return true;
+    }
+
+    void close() {
+        if (fd >= 0) {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+
+    bool isOpen() const {
+        return fd >= 0;
+    }
+
+    /**
+     * Reads the next intact line, skipping (and counting) lines whose
+     * checksum does not match.
+     *
+     * @param payload The payload of the line, without checksum.
+     * @param timeoutMs How long to wait in all; negative to wait forever.
+     * @return False on timeout or error.
+     */
+    bool readLine(std::string& payload, int timeoutMs = -1) {
+        int64_t deadline = monotonicNs() + timeoutMs * 1000000LL;
+        while (true) {
+            size_t nl;
+            while ((nl = pending.find('\n')) != std::string::npos) {
+                std::string line = pending.substr(0, nl);
+                pending.erase(0, nl + 1);
+                if (unframeLine(line, payload)) {
+                    return true;
+                }
+                ++badLines;
+            }
+            int wait = -1;
+            if (timeoutMs >= 0) {
+                int64_t left = deadline - monotonicNs();
+                if (left <= 0) {
+                    return false;
+                }
+                wait = (int) ((left + 999999) / 1000000);
+            }
+            pollfd pfd = {fd, POLLIN, 0};
+            int r = poll(&pfd, 1, wait);
+            if (r < 0 && errno == EINTR) {
+                continue;
+            }
+            if (r <= 0) {
+                return false;
+            }
+            char buf[512];
+            ssize_t n = ::read(fd, buf, sizeof(buf));
+            if (n <= 0) {
+                return false;
+            }
+            pending.append(buf, n);
+        }
+    }
+
+    /**
+     * Frames and writes a payload.
+     */
+    bool writeLine(const std::string& payload) {
+        std::string line = frameLine(payload);
+        size_t off = 0;
+        while (off < line.size()) {
+            ssize_t n = ::write(fd, line.data() + off, line.size() - off);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                return false;
+            }
+            off += n;
+        }
+        return true;
+    }
+
+    /** Lines dropped for a bad checksum. */
+    uint64_t getBadLines() const {
+        return badLines;
+    }
+};
+
+#endif
@@ -0,0 +1,100 @@
+#include "StartupOrchestrator.h"
+#include <iostream>
+
+using namespace std;
+
+/**
+ * Simulated sensor: the device takes initMs to open, after which every
+ * reading takes periodMs.
+ */
+class SlowInterface {
+    int periodMs;
+    long n;
+
+    public:
+    SlowInterface(int initMs, int periodMs) : periodMs(periodMs), n(0) {
+        usleep(initMs * 1000);
+    }
+
+    long getPacket() {
+        usleep(periodMs * 1000);
+        return ++n;
+    }
+};
+
+typedef BufferThread<long, SlowInterface> SlowBuffer;
+
+/**
+ * A sensor as the robot sets it up: the interface and its buffer.
+ */
+struct Sensor {
+    const char* name;
+    int initMs;
+    int periodMs;
+    SlowInterface* iface;
+    SlowBuffer* buf;
+};
+
+bool openSensor(Sensor* s) {
+    s->iface = new SlowInterface(s->initMs, s->periodMs);
+    s->buf = new SlowBuffer(s->iface);
+    s->buf->runContinuous();
+    return true;
+}
+
+/**
+ * Brings up a set of simulated sensors, some depending on others, and starts
+ * the "control loop" as soon as the two sensors it needs are ready.
+ */
+int main(int argc, char** argv) {
+    Sensor sensors[] = {
+        {"can_bus", 300, 10, NULL, NULL},
+        {"wheels", 200, 20, NULL, NULL},  // On the CAN bus
+        {"imu", 400, 2, NULL, NULL},
+        {"lidar", 900, 100, NULL, NULL},
+        {"camera", 600, 33, NULL, NULL},  // Synchronized to the lidar
+    };
+    const int numSensors = sizeof(sensors) / sizeof(sensors[0]);
+
+    int serialMs = 0;
+    for (int i = 0; i < numSensors; i++) {
+        serialMs += sensors[i].initMs + sensors[i].periodMs;
+    }
+
+    StartupOrchestrator boot;
+    for (int i = 0; i < numSensors; i++) {
+        vector<string> deps;
+        if (string(sensors[i].name) == "wheels") {
+            deps = StartupOrchestrator::deps("can_bus");
+        } else if (string(sensors[i].name) == "camera") {
+            deps = StartupOrchestrator::deps("lidar");
+        }
+        boot.add(sensors[i].name, bind(&openSensor, &sensors[i]),
+                 boot.firstPacketOf(&sensors[i].buf), deps);
+    }
+
+    int64_t t0 = monotonicNs();
+    if (!boot.start()) {
+        cout << "Startup failed: " << boot.getError() << endl;
+        return 1;
+    }
+    if (!boot.waitFor(StartupOrchestrator::deps("imu", "wheels"), 5000)) {
+        cout << "Control loop sensors did not come up" << endl;
+        boot.report(cout);
+        return 1;
+    }
+    cout << "Control loop started after " << (monotonicNs() - t0) / 1000000
+        << " ms" << endl;
+
+    bool all = boot.waitAll(5000);
+    cout << "All sensors " << (all ? "ready" : "NOT ready") << " after "
+        << (monotonicNs() - t0) / 1000000 << " ms (serially about "
+        << serialMs << " ms)" << endl << endl;
+    boot.report(cout);
+
+    for (int i = 0; i < numSensors; i++) {
+        delete sensors[i].buf;
+        delete sensors[i].iface;
+    }
+    return all ? 0 : 1;
+}
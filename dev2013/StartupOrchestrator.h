@@ -0,0 +1,548 @@
+#include <pthread.h>
+#include <boost/function.hpp>
+#include <boost/bind.hpp>
+#include <atomic>
+#include <cstdio>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "BufferThreadedP.h"
+#include "FutexEvent.h"
+#include "MonotonicClock.h"
+#include "ThreadAccounting.h"
+
+// Header guards -- this file may be included more than once.
+#ifndef STARTUPORCHESTRATOR_H_
+#define STARTUPORCHESTRATOR_H_
+
+/**
+ * Where a startup task is.
+ */
+enum StartupState {
+    STARTUP_WAITING,      /**< For its dependencies */
+    STARTUP_INITIALIZING, /**< Running its init function */
+    STARTUP_FIRST_PACKET, /**< Waiting for its first packet */
+    STARTUP_READY,
+    STARTUP_FAILED,       /**< Init failed, or no packet in time */
+    STARTUP_SKIPPED       /**< A dependency failed or was skipped */
+};
+
+/**
+ * Timing of one startup task, relative to StartupOrchestrator::start(), in
+ * nanoseconds. Times of steps not reached are -1.
+ */
+struct StartupTiming {
+    std::string name;
+    StartupState state;
+    int64_t startNs;       /**< All dependencies ready, init started */
+    int64_t initDoneNs;    /**< Init function returned */
+    int64_t readyNs;       /**< First packet arrived */
+    std::string releasedBy; /**< The dependency that was ready last */
+};
+
+/**
+ * Brings up a robot's sensors in parallel. Each sensor is a task: an init
+ * function, which opens the device, constructs the interface and starts its
+ * buffer, and a first-packet function, which waits until the buffer has
+ * published something. Every task runs on a thread of its own as soon as the
+ * tasks it depends on are ready, so independent devices initialize
+ * concurrently and the boot time is the longest dependency chain rather than
+ * the sum of all of them:
+ *
+ *     ImuInterface* imu;
+ *     BufferThread<ImuPacket, ImuInterface>* imuBuf;
+ *     StartupOrchestrator boot;
+ *     boot.add("imu", bind(&openImu, &imu, &imuBuf),
+ *              boot.firstPacketOf(&imuBuf));
+ *     boot.add("odom", bind(&openOdometry, ...), ...,
+ *              StartupOrchestrator::deps("imu"));
+ *     boot.start();
+ *     if (!boot.waitFor(StartupOrchestrator::deps("imu", "odom"), 5000)) {
+ *         boot.report(cerr);
+ *         ...
+ *     }
+ *     // The control loop runs; the other sensors keep coming up.
+ *
+ * The control loop needs to wait only for the subset it requires
+ * (waitFor()); report() prints the time to first packet of every task and
+ * the critical path of the startup, i.e. the chain of tasks that determined
+ * when the last one became ready.
+ *
+ * A task whose init fails, or whose first packet does not arrive in time,
+ * fails, and so do (as skipped) the tasks depending on it. When the
+ * orchestrator is destroyed, a task waiting through firstPacketOf() gives up
+ * within WAIT_SLICE_MS, and a task stuck in its init function (or in a first
+ * packet function of its own) is cancelled, like the updater thread of a
+ * BufferThread. Cancellation only takes effect at a cancellation point, so
+ * a first packet function of the task's own should wait in short slices and
+ * return false once isStopping() says so.
+ */
+class StartupOrchestrator {
+
+    public:
+    /** Initializes a task's device; returns false if that failed. */
+    typedef boost::function<bool()> InitFunc;
+    /** Waits at most the given ns for the first packet; false if none. */
+    typedef boost::function<bool(int64_t)> ReadyFunc;
+
+    /** Longest a firstPacketOf() wait takes to notice destruction. */
+    static const int WAIT_SLICE_MS = 20;
+
+    private:
+    struct Task {
+        std::string name;
+        std::vector<std::string> deps;
+        std::vector<size_t> depIdx;
+        InitFunc init;
+        ReadyFunc firstPacket;
+        int64_t timeoutNs;
+        StartupState state; // Under mtx
+        int64_t startNs;
+        int64_t initDoneNs;
+        int64_t readyNs;
+        int releasedBy;
+        pthread_t thread;
+        boost::function<void*()>* tfPersistent;
+        bool finished;
+    };
+
+    std::vector<Task*> tasks;
+    std::map<std::string, size_t> byName;
+    pthread_mutex_t mtx;
+    FutexEvent change_evt; // Any task changed state
+    std::atomic<bool> bStop;
+    bool bStarted;
+    int64_t startNs;
+    std::string error;
+
+    StartupOrchestrator(const StartupOrchestrator&);
+    StartupOrchestrator& operator=(const StartupOrchestrator&);
+
+    void setState(Task* t, StartupState state, int64_t* stamp) {
+        pthread_mutex_lock(&mtx);
+        t->state = state;
+        if (stamp != NULL) {
+            *stamp = monotonicNs() - startNs;
+        }
+        pthread_mutex_unlock(&mtx);
+        change_evt.notifyAll();
+    }
+
+    /**
+     * Resolves the dependency names and rejects cycles (Kahn's algorithm).
+     */
+    bool checkDeps() {
+        std::vector<int> pending(tasks.size());
+        std::vector<std::vector<size_t> > dependents(tasks.size());
+        std::vector<size_t> ready;
+        for (size_t i = 0; i < tasks.size(); i++) {
+            Task* t = tasks[i];
+            for (size_t d = 0; d < t->deps.size(); d++) {
+                std::map<std::string, size_t>::iterator it =
+                    byName.find(t->deps[d]);
+                if (it == byName.end()) {
+                    error = t->name + ": unknown dependency " + t->deps[d];
+                    return false;
+                }
+                t->depIdx.push_back(it->second);
+                dependents[it->second].push_back(i);
+            }
+            pending[i] = t->depIdx.size();
+            if (pending[i] == 0) {
+                ready.push_back(i);
+            }
+        }
+        for (size_t i = 0; i < ready.size(); i++) {
+            std::vector<size_t>& next = dependents[ready[i]];
+            for (size_t j = 0; j < next.size(); j++) {
+                if (--pending[next[j]] == 0) {
+                    ready.push_back(next[j]);
+                }
+            }
+        }
+        if (ready.size() != tasks.size()) {
+            error = "the dependencies have a cycle";
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * Waits for the dependencies of a task. Returns false if one of them
+     * failed (and marks the task skipped) or the orchestrator is going away.
+     */
+    bool waitForDeps(Task* t) {
+        while (true) {
+            uint32_t key = change_evt.prepareWait();
+            if (bStop.load()) {
+                return false;
+            }
+            bool all = true;
+            int last = -1;
+            pthread_mutex_lock(&mtx);
+            for (size_t d = 0; d < t->depIdx.size(); d++) {
+                Task* dep = tasks[t->depIdx[d]];
+                if (dep->state == STARTUP_FAILED ||
+                    dep->state == STARTUP_SKIPPED) {
+                    pthread_mutex_unlock(&mtx);
+                    setState(t, STARTUP_SKIPPED, NULL);
+                    return false;
+                }
+                if (dep->state != STARTUP_READY) {
+                    all = false;
+                } else if (last < 0 ||
+                           dep->readyNs > tasks[last]->readyNs) {
+                    last = t->depIdx[d];
+                }
+            }
+            if (all) {
+                t->releasedBy = last;
+            }
+            pthread_mutex_unlock(&mtx);
+            if (all) {
+                return true;
+            }
+            change_evt.wait(key);
+        }
+    }
+
+    /**
+     * The thread function of a task.
+     *
+     * It is called from an external wrapper function.
+     */
+    void* runTask(Task* t) {
+        ThreadRegistration reg("startup:" + t->name);
+        if (waitForDeps(t)) {
+            setState(t, STARTUP_INITIALIZING, &t->startNs);
+            bool ok = t->init();
+            setState(t, ok ? STARTUP_FIRST_PACKET : STARTUP_FAILED,
+                     &t->initDoneNs);
+            if (ok) {
+                if (t->firstPacket) {
+                    ok = t->firstPacket(t->timeoutNs);
+                }
+                setState(t, ok ? STARTUP_READY : STARTUP_FAILED,
+                         ok ? &t->readyNs : NULL);
+            }
+        }
+        pthread_mutex_lock(&mtx);
+        t->finished = true;
+        pthread_mutex_unlock(&mtx);
+        return NULL;
+    }
+
+    /**
+     * A first-packet function for a BufferThread (or anything else with
+     * getVersion() and waitForVersion(version, timeoutMs)). The futex wait
+     * is not a cancellation point, so it waits in slices and checks whether
+     * the orchestrator is going away in between.
+     */
+    template <class Buffer>
+    struct FirstPacketWait {
+        Buffer* const* buf;
+        const std::atomic<bool>* stop;
+
+        bool operator()(int64_t timeoutNs) {
+            int64_t deadline = monotonicNs() + timeoutNs;
+            while ((*buf)->getVersion() == 0) {
+                int64_t left = deadline - monotonicNs();
+                if (left <= 0 || stop->load()) {
+                    return false;
+                }
+                int ms = (int) (left / 1000000 + 1);
+                (*buf)->waitForVersion(0, ms < WAIT_SLICE_MS ? ms :
+                                          WAIT_SLICE_MS);
+            }
+            return true;
+        }
+    };
+
+    public:
+    StartupOrchestrator() : bStop(false), bStarted(false), startNs(0) {
+        pthread_mutex_init(&mtx, NULL);
+    }
+
+    ~StartupOrchestrator() {
+        bStop.store(true);
+        change_evt.notifyAll();
+        for (size_t i = 0; i < tasks.size(); i++) {
+            Task* t = tasks[i];
+            if (bStarted) {
+                pthread_mutex_lock(&mtx);
+                bool finished = t->finished;
+                pthread_mutex_unlock(&mtx);
+                if (!finished) {
+                    // Stuck in the device's init or its own first packet
+                    // function; a FirstPacketWait returns by itself.
+                    pthread_cancel(t->thread);
+                }
+                pthread_join(t->thread, NULL);
+                delete t->tfPersistent;
+            }
+            delete t;
+        }
+        pthread_mutex_destroy(&mtx);
+    }
+
+    /**
+     * A list of task names, for add() and waitFor().
+     */
+    static std::vector<std::string> deps(const std::string& a,
+                                         const std::string& b = "",
+                                         const std::string& c = "",
+                                         const std::string& d = "") {
+        std::vector<std::string> v;
+        const std::string* names[] = {&a, &b, &c, &d};
+        for (int i = 0; i < 4; i++) {
+            if (!names[i]->empty()) {
+                v.push_back(*names[i]);
+            }
+        }
+        return v;
+    }
+
+    /**
+     * A first-packet function that waits for the buffer *buf to publish.
+     * The pointer is read only once the task's init has run, so init may
+     * create the buffer. The wait ends early if the orchestrator is
+     * destroyed.
+     */
+    template <class Buffer>
+    ReadyFunc firstPacketOf(Buffer* const* buf) {
+        FirstPacketWait<Buffer> wait = {buf, &bStop};
+        return wait;
+    }
+
+    /**
+     * Whether the orchestrator is being destroyed; first packet functions
+     * of the tasks' own should then give up.
+     */
+    bool isStopping() {
+        return bStop.load();
+    }
+
+    /**
+     * Declares a task. Call before start().
+     *
+     * @param name Unique task name.
+     * @param init Initializes the device and starts its buffer.
+     * @param firstPacket Waits for the first packet; if empty, the task is
+     *        ready as soon as init returns.
+     * @param deps Names of the tasks that must be ready before init runs.
+     * @param firstPacketTimeoutMs How long to wait for the first packet.
+     */
+    void add(const std::string& name, InitFunc init,
+             ReadyFunc firstPacket = ReadyFunc(),
+             const std::vector<std::string>& deps =
+                 std::vector<std::string>(),
+             int firstPacketTimeoutMs = 10000) {
+        if (byName.count(name) != 0) {
+            error = "duplicate task " + name;
+        }
+        Task* t = new Task();
+        t->name = name;
+        t->deps = deps;
+        t->init = init;
+        t->firstPacket = firstPacket;
+        t->timeoutNs = firstPacketTimeoutMs * 1000000LL;
+        t->state = STARTUP_WAITING;
+        t->startNs = t->initDoneNs = t->readyNs = -1;
+        t->releasedBy = -1;
+        t->tfPersistent = NULL;
+        t->finished = false;
+        byName[name] = tasks.size();
+        tasks.push_back(t);
+    }
+
+    /**
+     * Checks the dependencies, then starts every task on a thread of its
+     * own. Call only once.
+     *
+     * @return False, with nothing started, if the description is wrong;
+     *         getError() tells why.
+     */
+    bool start() {
+        if (bStarted || !error.empty() || !checkDeps()) {
+            return false;
+        }
+        startNs = monotonicNs();
+        for (size_t i = 0; i < tasks.size(); i++) {
+            Task* t = tasks[i];
+            boost::function<void*()> thrFun =
+                bind(&StartupOrchestrator::runTask, this, t);
+            t->tfPersistent = new boost::function<void*()>(thrFun);
+            pthread_create(&t->thread, NULL, &pthreadWrapper,
+                           t->tfPersistent);
+        }
+        bStarted = true;
+        return true;
+    }
+
+    /**
+     * Why start() failed.
+     */
+    const std::string& getError() {
+        return error;
+    }
+
+    /**
+     * Blocks until all the named tasks are ready, e.g. the sensors the
+     * control loop cannot run without.
+     *
+     * @return False if one of them failed (or does not exist), or after
+     *         timeoutMs milliseconds.
+     */
+    bool waitFor(const std::vector<std::string>& names, int timeoutMs) {
+        std::vector<size_t> idx;
+        for (size_t i = 0; i < names.size(); i++) {
+            std::map<std::string, size_t>::iterator it = byName.find(names[i]);
+            if (it == byName.end()) {
+                return false;
+            }
+            idx.push_back(it->second);
+        }
+        int64_t deadline = monotonicNs() + timeoutMs * 1000000LL;
+        while (true) {
+            uint32_t key = change_evt.prepareWait();
+            bool all = true;
+            pthread_mutex_lock(&mtx);
+            for (size_t i = 0; i < idx.size(); i++) {
+                StartupState s = tasks[idx[i]]->state;
+                if (s == STARTUP_FAILED || s == STARTUP_SKIPPED) {
+                    pthread_mutex_unlock(&mtx);
+                    return false;
+                }
+                all = all && s == STARTUP_READY;
+            }
+            pthread_mutex_unlock(&mtx);
+            if (all) {
+                return true;
+            }
+            int64_t left = deadline - monotonicNs();
+            if (!bStarted || left <= 0) {
+                return false;
+            }
+            change_evt.waitFor(key, left);
+        }
+    }
+
+    /**
+     * Blocks until every task is ready; see waitFor().
+     */
+    bool waitAll(int timeoutMs) {
+        std::vector<std::string> names;
+        for (size_t i = 0; i < tasks.size(); i++) {
+            names.push_back(tasks[i]->name);
+        }
+        return waitFor(names, timeoutMs);
+    }
+
+    /**
+     * Where the named task is.
+     */
+    StartupState getState(const std::string& name) {
+        std::map<std::string, size_t>::iterator it = byName.find(name);
+        if (it == byName.end()) {
+            return STARTUP_FAILED;
+        }
+        pthread_mutex_lock(&mtx);
+        StartupState s = tasks[it->second]->state;
+        pthread_mutex_unlock(&mtx);
+        return s;
+    }
+
+    /**
+     * The timing of every task, in the order they were added.
+     */
+    std::vector<StartupTiming> getTimings() {
+        std::vector<StartupTiming> st;
+        pthread_mutex_lock(&mtx);
+        for (size_t i = 0; i < tasks.size(); i++) {
+            Task* t = tasks[i];
+            StartupTiming tm;
+            tm.name = t->name;
+            tm.state = t->state;
+            tm.startNs = t->startNs;
+            tm.initDoneNs = t->initDoneNs;
+            tm.readyNs = t->readyNs;
+            if (t->releasedBy >= 0) {
+                tm.releasedBy = tasks[t->releasedBy]->name;
+            }
+            st.push_back(tm);
+        }
+        pthread_mutex_unlock(&mtx);
+        return st;
+    }
+
+    /**
+     * The critical path of the startup so far: the task that became ready
+     * last, preceded by the dependency that released it, and so on.
+     */
+    std::vector<std::string> getCriticalPath() {
+        std::vector<StartupTiming> st = getTimings();
+        int last = -1;
+        for (size_t i = 0; i < st.size(); i++) {
+            if (st[i].state == STARTUP_READY &&
+                (last < 0 || st[i].readyNs > st[last].readyNs)) {
+                last = i;
+            }
+        }
+        std::vector<std::string> path;
+        while (last >= 0) {
+            path.insert(path.begin(), st[last].name);
+            last = st[last].releasedBy.empty() ? -1 :
+                byName[st[last].releasedBy];
+        }
+        return path;
+    }
+
+    /**
+     * Prints the time to first packet of every task, and the critical path.
+     */
+    void report(std::ostream& os) {
+        static const char* stateNames[] = {"waiting", "init", "packet",
+                                           "ready", "failed", "skipped"};
+        std::vector<StartupTiming> st = getTimings();
+        os << "task                 state     start(ms)  init(ms) "
+            "packet(ms)  ready(ms)" << std::endl;
+        for (size_t i = 0; i < st.size(); i++) {
+            StartupTiming& t = st[i];
+            std::string name = t.name;
+            name.resize(20, ' ');
+            char line[128];
+            snprintf(line, sizeof(line), "%s %-8s %10.1f %9.1f %10.1f "
+                     "%10.1f", name.c_str(), stateNames[t.state],
+                     t.startNs < 0 ? -1 : t.startNs / 1e6,
+                     t.initDoneNs < 0 ? -1 : (t.initDoneNs - t.startNs) / 1e6,
+                     t.readyNs < 0 ? -1 : (t.readyNs - t.initDoneNs) / 1e6,
+                     t.readyNs < 0 ? -1 : t.readyNs / 1e6);
+            os << line << std::endl;
+        }
+
+        std::vector<std::string> path = getCriticalPath();
+        os << "critical path:";
+        int64_t prevReady = 0;
+        for (size_t i = 0; i < path.size(); i++) {
+            const StartupTiming& t = st[byName[path[i]]];
+            char step[64];
+            // Time spent in the task, plus any wait for a thread to run it.
+            snprintf(step, sizeof(step), " %.1f ms", (t.readyNs - prevReady) /
+                     1e6);
+            os << (i > 0 ? " ->" : "") << " " << path[i] << step;
+            prevReady = t.readyNs;
+        }
+        if (!path.empty()) {
+            char total[64];
+            snprintf(total, sizeof(total), " = %.1f ms",
+                     st[byName[path.back()]].readyNs / 1e6);
+            os << total;
+        }
+        os << std::endl;
+    }
+};
+
+#endif
@@ -0,0 +1,216 @@
+#include <pthread.h>
+#include <atomic>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "SyncPolicy.h"
+#include "FutexEvent.h"
+#include "ThreadAccounting.h"
+
+// Header guards -- this file may be included more than once.
+#ifndef STATICGRAPH_H_
+#define STATICGRAPH_H_
+
+/**
+ * Marks the sensor interface at the head of a StaticGraph.
+ */
+template <class Interface>
+struct Node {};
+
+/**
+ * Marks a processing stage of a StaticGraph.
+ */
+template <class S>
+struct Stage {};
+
+/**
+ * The packet types flowing through a chain of stages starting with In, as a
+ * std::tuple: In, then the result of each stage's runProcess().
+ */
+template <class In, class... Ss>
+struct StagePackets {
+    typedef std::tuple<In> type;
+};
+
+template <class In, class S, class... Rest>
+struct StagePackets<In, S, Rest...> {
+    typedef typename std::decay<decltype(std::declval<S&>().runProcess(
+        std::declval<In&>()))>::type Out;
+    typedef decltype(std::tuple_cat(
+        std::declval<std::tuple<In> >(),
+        std::declval<typename StagePackets<Out, Rest...>::type>())) type;
+};
+
+/**
+ * The cell an edge of a StaticGraph uses for a packet type: a sequence lock
+ * for trivially copyable packets, a mutex otherwise.
+ */
+template <class Packet>
+struct StaticEdgeCell {
+    typedef typename std::conditional<
+        std::is_trivially_copyable<Packet>::value, SeqLockCell<Packet>,
+        LockedCell<Packet, PthreadMutex> >::type type;
+};
+
+template <class Tuple>
+struct StaticEdgeCells;
+
+template <class... Ps>
+struct StaticEdgeCells<std::tuple<Ps...> > {
+    typedef std::tuple<typename StaticEdgeCell<Ps>::type...> type;
+};
+
+template <class... Parts>
+class StaticGraph;
+
+/**
+ * A sensor pipeline whose wiring is resolved entirely at compile time, for
+ * the hard-real-time part of the loop:
+ *
+ *     StaticGraph<Node<ImuInterface>, Stage<ImuFilter>, Stage<Ekf> >
+ *         graph(&imu, &filter, &ekf);
+ *     graph.start();
+ *     Pose p = graph.get<2>(); // output of the second stage
+ *
+ * The graph type describes the topology: a sensor interface (`Packet
+ * getPacket()`) followed by any number of stages (`Out runProcess(In&)`, as
+ * for IOBuffer and DataflowGraph). From it the compiler derives the packet
+ * type of every edge, the edge buffers (a cell per edge; see
+ * StaticEdgeCell) and one fused update cycle that acquires a packet and
+ * runs it through all stages as plain, inlinable member function calls.
+ *
+ * There is no type erasure, no virtual call, no boost::function and no heap
+ * allocation: the packets, the cells and the thread state all live in the
+ * graph object. The cycle runs either on the graph's own thread (start()),
+ * or on the caller's (runOnce()), e.g. from a control loop's executive.
+ *
+ * Every edge is published as soon as the stage reading it has taken its
+ * input (which lets the cell move the packet instead of copying it), so
+ * readers of intermediate results do not wait for the rest of the chain.
+ */
+template <class Interface, class... Ss>
+class StaticGraph<Node<Interface>, Stage<Ss>...> {
+
+    public:
+    typedef typename std::decay<decltype(
+        std::declval<Interface&>().getPacket())>::type SourcePacket;
+    typedef typename StagePackets<SourcePacket, Ss...>::type Packets;
+
+    /** The packet type of edge I: 0 is the sensor's, I the I-th stage's. */
+    template <size_t I>
+    using PacketAt = typename std::tuple_element<I, Packets>::type;
+
+    /** Number of stages. */
+    static const size_t NUM_STAGES = sizeof...(Ss);
+
+    private:
+    Interface* source;
+    std::tuple<Ss*...> stages;
+    Packets pkts; // Working packets of the update cycle
+    typename StaticEdgeCells<Packets>::type cells;
+    std::atomic<uint64_t> version;
+    FutexEvent publish_evt;
+    std::atomic<bool> bStop;
+    bool bStarted;
+    pthread_t thread;
+
+    StaticGraph(const StaticGraph&);
+    StaticGraph& operator=(const StaticGraph&);
+
+    /** Runs stage I and everything after it. */
+    template <size_t I>
+    void runFrom() {
+        if constexpr (I < NUM_STAGES) {
+            std::get<I + 1>(pkts) = std::get<I>(stages)->runProcess(
+                std::get<I>(pkts));
+            std::get<I>(cells).store(std::get<I>(pkts));
+            runFrom<I + 1>();
+        } else {
+            std::get<I>(cells).store(std::get<I>(pkts));
+        }
+    }
+
+    static void* threadMain(void* arg) {
+        StaticGraph* g = static_cast<StaticGraph*>(arg);
+        ThreadRegistration reg("static-graph");
+        while (!g->bStop.load(std::memory_order_relaxed)) {
+            g->runOnce();
+            // Cancellation point, just to be sure
+            sleep(0);
+        }
+        return NULL;
+    }
+
+    public:
+    /**
+     * @param source The sensor interface.
+     * @param stages The stages, in the order of the graph type.
+     */
+    StaticGraph(Interface* source, Ss*... stages) :
+                source(source), stages(stages...), pkts(), version(0),
+                bStop(false), bStarted(false) {}
+
+    ~StaticGraph() {
+        if (bStarted) {
+            bStop.store(true);
+            pthread_cancel(thread);
+            pthread_join(thread, NULL);
+        }
+    }
+
+    /**
+     * Runs the update cycle continuously on a thread of the graph's own.
+     * Call only once, and not together with runOnce().
+     */
+    void start() {
+        pthread_create(&thread, NULL, &StaticGraph::threadMain, this);
+        bStarted = true;
+    }
+
+    /**
+     * Runs one update cycle on the calling thread: acquires a packet, runs
+     * it through every stage and publishes the results.
+     */
+    void runOnce() {
+        std::get<0>(pkts) = source->getPacket();
+        runFrom<0>();
+        version.fetch_add(1, std::memory_order_release);
+        publish_evt.notifyAll();
+    }
+
+    /**
+     * The latest packet on edge I (see PacketAt).
+     */
+    template <size_t I>
+    PacketAt<I> get() {
+        PacketAt<I> pkt;
+        std::get<I>(cells).load(pkt);
+        return pkt;
+    }
+
+    /**
+     * The number of completed update cycles.
+     */
+    uint64_t getVersion() {
+        return version.load(std::memory_order_acquire);
+    }
+
+    /**
+     * Blocks until a cycle newer than the given version has completed.
+     */
+    uint64_t waitForVersion(uint64_t v) {
+        while (true) {
+            uint32_t key = publish_evt.prepareWait();
+            uint64_t current = getVersion();
+            if (current > v) {
+                return current;
+            }
+            publish_evt.wait(key);
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,167 @@
+#include "BufferThreadedP.h"
+#include <atomic>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <time.h>
+
+using namespace std;
+
+/**
+ * The status flag protocol BufferThread used to have: a bool read and
+ * written under a mutex. Kept here as the baseline for comparison.
+ */
+class MutexFlag {
+    pthread_mutex_t mtx;
+    bool flag;
+
+    public:
+    MutexFlag() : flag(false) {
+        pthread_mutex_init(&mtx, NULL);
+    }
+
+    ~MutexFlag() {
+        pthread_mutex_destroy(&mtx);
+    }
+
+    bool isUpdating() {
+        bool retval;
+        pthread_mutex_lock(&mtx);
+        retval = flag;
+        pthread_mutex_unlock(&mtx);
+        return retval;
+    }
+
+    void set(bool value) {
+        pthread_mutex_lock(&mtx);
+        flag = value;
+        pthread_mutex_unlock(&mtx);
+    }
+};
+
+/**
+ * Sensor stand-in that answers immediately, so that the buffer's status
+ * changes as often as possible.
+ */
+class InstantInterface {
+    public:
+    int getPacket() {
+        return 0;
+    }
+};
+
+typedef BufferThread<int, InstantInterface> IntBuffer;
+
+std::atomic<bool> stopFlag(false);
+
+/** Keeps a BufferThread cycling through request/update/publish. */
+void* triggerMain(void* arg) {
+    IntBuffer* buf = static_cast<IntBuffer*>(arg);
+    while (!stopFlag.load(std::memory_order_relaxed)) {
+        buf->readData();
+    }
+    return NULL;
+}
+
+/** Keeps the legacy flag toggling, like the old updater did. */
+void* toggleMain(void* arg) {
+    MutexFlag* flag = static_cast<MutexFlag*>(arg);
+    while (!stopFlag.load(std::memory_order_relaxed)) {
+        flag->set(true);
+        flag->set(false);
+    }
+    return NULL;
+}
+
+/**
+ * Arguments of one status-checking thread.
+ */
+template <class Flag>
+struct CheckerArgs {
+    Flag* flag;
+    long checks;
+    long hits;
+};
+
+template <class Flag>
+void* checkerMain(void* arg) {
+    CheckerArgs<Flag>* ca = static_cast<CheckerArgs<Flag>*>(arg);
+    while (!stopFlag.load(std::memory_order_relaxed)) {
+        // Unrolled a bit so the loop overhead doesn't dominate.
+        for (int i = 0; i < 16; i++) {
+            if (ca->flag->isUpdating()) {
+                ++ca->hits;
+            }
+        }
+        ca->checks += 16;
+    }
+    return NULL;
+}
+
+/**
+ * Runs numCheckers threads calling isUpdating() on flag for durationMs
+ * while background toggles the status. Returns the average nanoseconds
+ * per status check, per thread.
+ */
+template <class Flag>
+double runChecks(Flag* flag, void* (*background)(void*), int numCheckers,
+                 int durationMs) {
+    stopFlag.store(false);
+    pthread_t bgThread;
+    pthread_create(&bgThread, NULL, background, flag);
+
+    CheckerArgs<Flag>* args = new CheckerArgs<Flag>[numCheckers];
+    pthread_t* threads = new pthread_t[numCheckers];
+    for (int i = 0; i < numCheckers; i++) {
+        args[i].flag = flag;
+        args[i].checks = 0;
+        args[i].hits = 0;
+        pthread_create(&threads[i], NULL, &checkerMain<Flag>, &args[i]);
+    }
+
+    timespec ts;
+    ts.tv_sec = durationMs / 1000;
+    ts.tv_nsec = (durationMs % 1000) * 1000000L;
+    nanosleep(&ts, NULL);
+    stopFlag.store(true);
+
+    long checks = 0;
+    for (int i = 0; i < numCheckers; i++) {
+        pthread_join(threads[i], NULL);
+        checks += args[i].checks;
+    }
+    pthread_join(bgThread, NULL);
+    delete[] threads;
+    delete[] args;
+
+    return durationMs * 1e6 * numCheckers / checks;
+}
+
+/**
+ * Microbenchmark for the cost of a status check (isUpdating()) under
+ * contention from an updater, mutex-guarded flag vs. BufferStatus.
+ *
+ * Usage: StatusBench [durationMs]  (default 500 ms per run)
+ */
+int main(int argc, char** argv) {
+    int durationMs = 500;
+    if (argc > 1) {
+        durationMs = atoi(argv[1]);
+    }
+    long numCpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    InstantInterface iface;
+    IntBuffer buf(&iface);
+    buf.spawnThreads();
+    MutexFlag legacy;
+
+    cout << setw(10) << "checkers" << setw(16) << "mutex ns/check" <<
+        setw(16) << "atomic ns/check" << endl;
+    for (int n = 1; n <= numCpus; n *= 2) {
+        double tMutex = runChecks(&legacy, &toggleMain, n, durationMs);
+        double tAtomic = runChecks(&buf, &triggerMain, n, durationMs);
+        cout << fixed << setprecision(2) << setw(10) << n <<
+            setw(16) << tMutex << setw(16) << tAtomic << endl;
+    }
+    return 0;
+}
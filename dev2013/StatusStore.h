@@ -0,0 +1,406 @@
+#include <atomic>
+#include <cstring>
+#include <new>
+#include <type_traits>
+#include <vector>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sched.h>
+
+#include "SyncPolicy.h" // for cpuRelax() and CACHE_LINE_SIZE
+
+// Header guards -- this file may be included more than once.
+#ifndef STATUSSTORE_H_
+#define STATUSSTORE_H_
+
+/**
+ * Latest-value store for many small status values (motor temperatures,
+ * switch states, per-wheel currents): one table instead of one BufferThread
+ * per value.
+ *
+ * Values are identified by 64-bit keys (any value but UINT64_MAX; see
+ * keyOf() for named values) and kept in an open-addressing hash table with
+ * linear probing. Each slot is exactly one cache line and carries its own
+ * sequence lock, so:
+ *
+ *   - put() locks only the slot of its key, with a spinlock. Writers of
+ *     different keys never wait for each other; writers of the same key
+ *     take turns on the slot, spinning briefly and then yielding the CPU,
+ *     so a writer preempted inside put() does not starve the others.
+ *   - get() never blocks a writer. It retries if it overlapped a put(),
+ *     and yields too if the slot stays busy.
+ *   - Every put() is stamped with a global version, and changedSince(V)
+ *     returns every key updated after version V in one call. The table is
+ *     divided into blocks of 64 slots, and each block records the newest
+ *     version stored in it, so only blocks that changed are scanned.
+ *
+ * Values must be trivially copyable and at most 40 bytes, so that a slot
+ * fits in one cache line. The capacity is fixed at construction; keys are
+ * never removed.
+ *
+ * Usage:
+ *
+ *     StatusStore<double> temps(1000);
+ *     temps.put(StatusStore<double>::keyOf("motor.left.temp"), 41.5);
+ *
+ *     std::vector<StatusStore<double>::Entry> changed;
+ *     uint64_t seen = 0;
+ *     seen = temps.changedSince(seen, changed); // poll for changes
+ */
+template <class Value>
+class StatusStore {
+
+    static_assert(std::is_trivially_copyable<Value>::value,
+                  "StatusStore requires a trivially copyable Value");
+    static_assert(sizeof(Value) <= 40,
+                  "StatusStore values must fit in 40 bytes");
+
+    public:
+    /**
+     * A key with its value, as returned by changedSince().
+     */
+    struct Entry {
+        uint64_t key;
+        uint64_t version;
+        Value value;
+    };
+
+    private:
+    /**
+     * One table slot, one cache line. The stored key is the user key plus
+     * one, so that zero can mark an empty slot.
+     */
+    struct alignas(CACHE_LINE_SIZE) Slot {
+        std::atomic<uint64_t> key;
+        std::atomic<unsigned> seq; // Odd while a put() is in progress
+        uint64_t version;          // Zero until the first put()
+        Value value;
+    };
+
+    /**
+     * Per-block summary for changedSince(). The writer count lets the
+     * reader find blocks whose newest version is not recorded yet.
+     */
+    struct alignas(CACHE_LINE_SIZE) Block {
+        std::atomic<uint64_t> maxVersion;
+        std::atomic<unsigned> writers;
+    };
+
+    static const int BLOCK_SHIFT = 6;
+    /** Spins on a busy slot before falling back to sched_yield(). */
+    static const int MAX_SPINS = 100;
+
+    Slot* slots;
+    Block* blocks;
+    size_t mask;
+    size_t numBlocks;
+    std::atomic<uint64_t> version;
+    std::atomic<size_t> numKeys;
+
+    StatusStore(const StatusStore&);
+    StatusStore& operator=(const StatusStore&);
+
+    /** Spreads the key bits over the table (MurmurHash3 finalizer). */
+    static uint64_t hash(uint64_t k) {
+        k ^= k >> 33;
+        k *= 0xff51afd7ed558ccdULL;
+        k ^= k >> 33;
+        k *= 0xc4ceb93fe53b8ce5ULL;
+        k ^= k >> 33;
+        return k;
+    }
+
+    /**
+     * Finds the slot of a key, or NULL if the key has never been stored.
+     */
+    Slot* find(uint64_t key) {
+        uint64_t stored = key + 1;
+        size_t i = hash(key) & mask;
+        for (size_t n = 0; n <= mask; n++) {
+            uint64_t k = slots[i].key.load(std::memory_order_acquire);
+            if (k == stored) {
+                return &slots[i];
+            }
+            if (k == 0) {
+                return NULL;
+            }
+            i = (i + 1) & mask;
+        }
+        return NULL;
+    }
+
+    /**
+     * Finds the slot of a key, claiming an empty one if necessary. Returns
+     * NULL if the table is full.
+     */
+    Slot* findOrInsert(uint64_t key) {
+        uint64_t stored = key + 1;
+        size_t i = hash(key) & mask;
+        for (size_t n = 0; n <= mask; n++) {
+            uint64_t k = slots[i].key.load(std::memory_order_acquire);
+            if (k == 0) {
+                if (slots[i].key.compare_exchange_strong(k, stored)) {
+                    numKeys.fetch_add(1, std::memory_order_relaxed);
+                    return &slots[i];
+                }
+                // Lost the race for this slot; k now holds the winner.
+            }
+            if (k == stored) {
+                return &slots[i];
+            }
+            i = (i + 1) & mask;
+        }
+        return NULL;
+    }
+
+    /**
+     * Waits a little for a busy slot: spins at first, then yields, in case
+     * the thread holding the slot was preempted.
+     */
+    static void backOff(int& spins) {
+        if (spins < MAX_SPINS) {
+            ++spins;
+            cpuRelax();
+        } else {
+            sched_yield();
+        }
+    }
+
+    /**
+     * Sequence-locked copy of a slot's version and value.
+     */
+    static void readSlot(Slot* s, uint64_t* ver, Value* out) {
+        int spins = 0;
+        while (true) {
+            unsigned s0 = s->seq.load(std::memory_order_acquire);
+            if (s0 & 1) {
+                backOff(spins);
+                continue;
+            }
+            *ver = s->version;
+            std::memcpy(static_cast<void*>(out), &s->value, sizeof(Value));
+            // Keep the copy from being reordered past the second read.
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (s->seq.load(std::memory_order_relaxed) == s0) {
+                return;
+            }
+        }
+    }
+
+    public:
+    /**
+     * @param maxKeys The largest number of keys that will be stored. The
+     *        table is sized to stay at most half full.
+     */
+    StatusStore(size_t maxKeys) : version(0), numKeys(0) {
+        size_t size = size_t(1) << BLOCK_SHIFT;
+        while (size < 2 * maxKeys) {
+            size *= 2;
+        }
+        mask = size - 1;
+        numBlocks = size >> BLOCK_SHIFT;
+
+        void* mem = NULL;
+        if (posix_memalign(&mem, CACHE_LINE_SIZE, size * sizeof(Slot)) != 0) {
+            throw std::bad_alloc();
+        }
+        slots = static_cast<Slot*>(mem);
+        mem = NULL;
+        if (posix_memalign(&mem, CACHE_LINE_SIZE,
+                           numBlocks * sizeof(Block)) != 0) {
+            free(slots);
+            throw std::bad_alloc();
+        }
+        blocks = static_cast<Block*>(mem);
+
+        for (size_t i = 0; i < size; i++) {
+            new (&slots[i]) Slot();
+            slots[i].key.store(0, std::memory_order_relaxed);
+            slots[i].seq.store(0, std::memory_order_relaxed);
+            slots[i].version = 0;
+        }
+        for (size_t i = 0; i < numBlocks; i++) {
+            new (&blocks[i]) Block();
+            blocks[i].maxVersion.store(0, std::memory_order_relaxed);
+            blocks[i].writers.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    ~StatusStore() {
+        free(slots);
+        free(blocks);
+    }
+
+    /**
+     * Key of a named value (64-bit FNV-1a hash of the name).
+     */
+    static uint64_t keyOf(const char* name) {
+        uint64_t h = 0xcbf29ce484222325ULL;
+        for (; *name != '\0'; name++) {
+            h ^= (unsigned char) *name;
+            h *= 0x100000001b3ULL;
+        }
+        return h == ~uint64_t(0) ? 0 : h;
+    }
+
+    /**
+     * Stores the latest value of a key.
+     *
+     * @return The version stamped on the value, or 0 if the key is new and
+     *         the table is full, or is UINT64_MAX.
+     */
+    uint64_t put(uint64_t key, const Value& value) {
+        if (key == UINT64_MAX) {
+            return 0; // Would be stored as 0, the mark of an empty slot
+        }
+        Slot* s = findOrInsert(key);
+        if (s == NULL) {
+            return 0;
+        }
+        Block& b = blocks[(s - slots) >> BLOCK_SHIFT];
+
+        // Announce the write before taking a version, so that a reader that
+        // has already seen the version also sees this block as busy.
+        b.writers.fetch_add(1);
+        unsigned q = s->seq.load(std::memory_order_relaxed);
+        int spins = 0;
+        while ((q & 1) || !s->seq.compare_exchange_weak(
+                   q, q + 1, std::memory_order_acquire,
+                   std::memory_order_relaxed)) {
+            backOff(spins);
+            q = s->seq.load(std::memory_order_relaxed);
+        }
+        uint64_t v = version.fetch_add(1) + 1;
+        // The odd count must be visible before any byte of the value is.
+        std::atomic_thread_fence(std::memory_order_release);
+        s->version = v;
+        std::memcpy(static_cast<void*>(&s->value), &value, sizeof(Value));
+        uint64_t m = b.maxVersion.load(std::memory_order_relaxed);
+        while (v > m && !b.maxVersion.compare_exchange_weak(
+                   m, v, std::memory_order_release,
+                   std::memory_order_relaxed)) {
+        }
+        s->seq.store(q + 2, std::memory_order_release);
+        b.writers.fetch_sub(1);
+        return v;
+    }
+
+    /**
+     * Reads the latest value of a key.
+     *
+     * @param output Receives the value; left unchanged if there is none.
+     * @param ver If not NULL, receives the version of the value.
+     *
+     * @return Whether the key has a value; never for UINT64_MAX.
+     */
+    bool get(uint64_t key, Value* output, uint64_t* ver = NULL) {
+        if (key == UINT64_MAX) {
+            return false;
+        }
+        Slot* s = find(key);
+        if (s == NULL) {
+            return false;
+        }
+        Value v;
+        uint64_t vv;
+        readSlot(s, &vv, &v);
+        if (vv == 0) {
+            return false; // Claimed, but the first put() is still running
+        }
+        *output = v;
+        if (ver != NULL) {
+            *ver = vv;
+        }
+        return true;
+    }
+
+    /**
+     * Reads the latest values of a set of keys. Each value is consistent
+     * on its own; the set as a whole is not a snapshot.
+     *
+     * @param keys The keys to read.
+     * @param n The number of keys.
+     * @param output Receives the n values, in the order of the keys.
+     * @param found If not NULL, receives for each key whether it has a
+     *        value.
+     *
+     * @return The number of keys that have a value.
+     */
+    size_t getMany(const uint64_t* keys, size_t n, Value* output,
+                   bool* found = NULL) {
+        size_t count = 0;
+        for (size_t i = 0; i < n; i++) {
+            bool ok = get(keys[i], &output[i]);
+            if (found != NULL) {
+                found[i] = ok;
+            }
+            if (ok) {
+                ++count;
+            }
+        }
+        return count;
+    }
+
+    /**
+     * Collects every key updated after version since, with its latest value.
+     * Pass the returned version as since on the next call to poll for
+     * changes; no update is ever missed, though an update that raced with
+     * the call may be reported twice.
+     *
+     * @param since The version up to which the caller is up to date; 0 for
+     *        everything.
+     * @param changed Receives the changed entries (appended), in table
+     *        order.
+     *
+     * @return The version up to which the caller is now up to date.
+     */
+    uint64_t changedSince(uint64_t since, std::vector<Entry>& changed) {
+        uint64_t upTo = version.load();
+        for (size_t bi = 0; bi < numBlocks; bi++) {
+            // Writers first: once a writer has left, its maxVersion update
+            // is visible.
+            if (blocks[bi].writers.load() == 0 &&
+                    blocks[bi].maxVersion.load(std::memory_order_acquire) <=
+                    since) {
+                continue;
+            }
+            size_t end = (bi + 1) << BLOCK_SHIFT;
+            for (size_t i = bi << BLOCK_SHIFT; i < end; i++) {
+                uint64_t k = slots[i].key.load(std::memory_order_acquire);
+                if (k == 0) {
+                    continue;
+                }
+                Entry e;
+                readSlot(&slots[i], &e.version, &e.value);
+                if (e.version > since) {
+                    e.key = k - 1;
+                    changed.push_back(e);
+                }
+            }
+        }
+        return upTo;
+    }
+
+    /**
+     * The version of the latest put().
+     */
+    uint64_t getVersion() {
+        return version.load(std::memory_order_acquire);
+    }
+
+    /**
+     * The number of keys stored.
+     */
+    size_t size() {
+        return numKeys.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * The number of keys the table can hold.
+     */
+    size_t capacity() {
+        return mask + 1;
+    }
+};
+
+#endif
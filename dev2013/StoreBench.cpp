@@ -0,0 +1,166 @@
+#include "StatusStore.h"
+#include <atomic>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <pthread.h>
+
+#include "MonotonicClock.h"
+
+using namespace std;
+
+/**
+ * A typical small status value.
+ */
+struct MotorStatus {
+    double current;
+    double temperature;
+    int faults;
+};
+
+typedef StatusStore<MotorStatus> Store;
+
+std::atomic<bool> stopFlag(false);
+
+/**
+ * Arguments of one writer thread of the polling check.
+ */
+struct WriterArgs {
+    Store* store;
+    uint64_t firstKey;
+    uint64_t numKeys;
+    long puts;
+};
+
+/** Updates its own range of keys round-robin until stopped. */
+void* writerMain(void* arg) {
+    WriterArgs* wa = static_cast<WriterArgs*>(arg);
+    MotorStatus ms = MotorStatus();
+    while (!stopFlag.load(std::memory_order_relaxed)) {
+        ms.faults = wa->puts;
+        wa->store->put(wa->firstKey + wa->puts % wa->numKeys, ms);
+        ++wa->puts;
+    }
+    return NULL;
+}
+
+/**
+ * Times the single-threaded operations on a store of numKeys keys, then
+ * checks that a reader polling changedSince() while two writers update the
+ * store ends up with the latest value of every key.
+ *
+ * Usage: StoreBench [numKeys]  (default 100000)
+ */
+int main(int argc, char** argv) {
+    uint64_t numKeys = 100000;
+    if (argc > 1) {
+        numKeys = atol(argv[1]);
+    }
+    Store store(numKeys);
+    MotorStatus ms = MotorStatus();
+    cout << fixed << setprecision(1);
+
+    int64_t t0 = monotonicNs();
+    for (uint64_t k = 0; k < numKeys; k++) {
+        ms.temperature = k;
+        store.put(k, ms);
+    }
+    int64_t t1 = monotonicNs();
+    for (uint64_t k = 0; k < numKeys; k++) {
+        ms.current = k;
+        store.put(k, ms);
+    }
+    int64_t t2 = monotonicNs();
+    double sum = 0;
+    for (uint64_t k = 0; k < numKeys; k++) {
+        store.get(k, &ms);
+        sum += ms.current;
+    }
+    int64_t t3 = monotonicNs();
+    cout << numKeys << " keys in " << store.capacity() << " slots" << endl;
+    cout << "insert:       " << setw(8) << double(t1 - t0) / numKeys <<
+        " ns/key" << endl;
+    cout << "put:          " << setw(8) << double(t2 - t1) / numKeys <<
+        " ns/key" << endl;
+    cout << "get:          " << setw(8) << double(t3 - t2) / numKeys <<
+        " ns/key" << endl;
+
+    const int batch = 32;
+    uint64_t keys[batch];
+    MotorStatus values[batch];
+    for (int i = 0; i < batch; i++) {
+        keys[i] = (i * 7919) % numKeys;
+    }
+    int reps = 10000;
+    t0 = monotonicNs();
+    for (int r = 0; r < reps; r++) {
+        store.getMany(keys, batch, values);
+        sum += values[r % batch].current;
+    }
+    t1 = monotonicNs();
+    cout << "getMany(" << batch << "):  " << setw(8) <<
+        double(t1 - t0) / reps << " ns/call" << endl;
+
+    vector<Store::Entry> changed;
+    t0 = monotonicNs();
+    uint64_t seen = store.changedSince(0, changed);
+    t1 = monotonicNs();
+    cout << "changedSince, all keys:   " << setw(10) <<
+        (t1 - t0) / 1000.0 << " us (" << changed.size() << " entries)" <<
+        endl;
+    for (int i = 0; i < 100; i++) {
+        store.put((i * 104729) % numKeys, ms);
+    }
+    changed.clear();
+    t0 = monotonicNs();
+    seen = store.changedSince(seen, changed);
+    t1 = monotonicNs();
+    cout << "changedSince, 100 changed:" << setw(10) <<
+        (t1 - t0) / 1000.0 << " us (" << changed.size() << " entries)" <<
+        endl;
+
+    // Polling check: two writers, one reader mirroring the store.
+    vector<int> mirror(numKeys, -1);
+    WriterArgs args[2];
+    pthread_t threads[2];
+    for (int i = 0; i < 2; i++) {
+        args[i].store = &store;
+        args[i].firstKey = i * (numKeys / 2);
+        args[i].numKeys = numKeys / 2;
+        args[i].puts = 0;
+        pthread_create(&threads[i], NULL, &writerMain, &args[i]);
+    }
+    long polls = 0;
+    int64_t end = monotonicNs() + 500000000LL;
+    while (monotonicNs() < end) {
+        changed.clear();
+        seen = store.changedSince(seen, changed);
+        for (size_t i = 0; i < changed.size(); i++) {
+            mirror[changed[i].key] = changed[i].value.faults;
+        }
+        ++polls;
+    }
+    stopFlag.store(true);
+    for (int i = 0; i < 2; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    changed.clear();
+    store.changedSince(seen, changed);
+    for (size_t i = 0; i < changed.size(); i++) {
+        mirror[changed[i].key] = changed[i].value.faults;
+    }
+    long mismatches = 0;
+    for (uint64_t k = 0; k < numKeys; k++) {
+        if (store.get(k, &ms) && ms.faults != mirror[k]) {
+            ++mismatches;
+        }
+    }
+    cout << "polling check: " << args[0].puts + args[1].puts <<
+        " puts, " << polls << " polls, " << mismatches <<
+        " keys out of date" << endl;
+    // Keep the reads from being optimized away.
+    if (sum < 0) {
+        cout << sum;
+    }
+    return mismatches == 0 ? 0 : 1;
+}
@@ -0,0 +1,721 @@
+#include <pthread.h>
+#include <boost/function.hpp>
+#include <deque>
+#include <tuple>
+#include <utility>
+#include <vector>
+#include <stdint.h>
+#include <sys/time.h>
+
+#include "MonotonicClock.h"
+
+// Header guards -- this file may be included more than once.
+#ifndef STREAM_H_
+#define STREAM_H_
+
+/*
+ * Stream operators over buffer publications.
+ *
+ * A stream pipeline is a chain of operators ending in a sink, attached to a
+ * buffer as its publish hook (BufferThread::setPublishHook(),
+ * IOBuffer::setPublishHook()). Every packet the buffer publishes is pushed
+ * through the chain on the buffer's updater thread:
+ *
+ *     auto closeCalls = stream::chain()
+ *         | stream::map([](const Scan& s) { return minRange(s); })
+ *         | stream::filter([](float r) { return r < 0.5f; })
+ *         | stream::throttle(200 * 1000000LL)
+ *         | stream::sink([](float r) { warn(r); });
+ *     lidar.setPublishHook(stream::hook<Scan>(closeCalls));
+ *
+ * Each operator is a class template holding the next stage by value, so the
+ * whole chain is one object of a nested type, and pushing a packet through
+ * it is a sequence of inlined calls: no intermediate threads, buffers,
+ * queues or virtual calls, and no packet copies except where an operator
+ * has to keep a value (window, debounce, sample, zip). The only indirect
+ * call is the buffer's hook itself.
+ *
+ * Every value travels with a timestamp in nanoseconds, the publication time
+ * (monotonicNs()) unless stampBy() replaces it with, e.g., the packet's own
+ * time stamp. The time-based operators use it.
+ *
+ * Operators:
+ *
+ *     map(f)              f(x)
+ *     filter(p)           x, if p(x)
+ *     stampBy(f)          x, with the timestamp f(x)
+ *     throttle(ns)        x, if at least ns after the last value passed
+ *     debounce<T>(ns)     the last x of a burst, once ns passed without one
+ *     sample<T>(ns)       the latest x, at most once every ns
+ *     window<T>(n, ns)    the last n values (younger than ns, if ns > 0),
+ *                         as a SlidingWindow<T>
+ *     zip<A, B>(ns, ...)  pairs of values from two streams whose timestamps
+ *                         differ by at most ns; see ZipStage
+ *
+ * and the chain ends in sink(f), which calls f(x), or to(stage), which
+ * pushes into another pipeline (or a zip input).
+ *
+ * debounce and sample can only emit when something happens; call tick() on
+ * the pipeline periodically (from any thread) to let them emit without
+ * waiting for the next value.
+ */
+namespace stream {
+
+/**
+ * Converts a packet time stamp to nanoseconds, for stampBy().
+ */
+inline int64_t timevalNs(const timeval& tv) {
+    return tv.tv_sec * 1000000000LL + tv.tv_usec * 1000LL;
+}
+
+/**
+ * The last few values of a stream with their timestamps, oldest first; what
+ * window() passes downstream.
+ */
+template <class T>
+class SlidingWindow {
+
+    private:
+    std::vector<T> values;
+    std::vector<int64_t> stamps;
+    size_t first;
+    size_t count;
+
+    public:
+    SlidingWindow(size_t capacity) :
+                  values(capacity > 0 ? capacity : 1),
+                  stamps(capacity > 0 ? capacity : 1), first(0), count(0) {}
+
+    size_t size() const {
+        return count;
+    }
+
+    bool empty() const {
+        return count == 0;
+    }
+
+    /** The i-th value, oldest first. */
+    const T& operator[](size_t i) const {
+        return values[(first + i) % values.size()];
+    }
+
+    int64_t stampAt(size_t i) const {
+        return stamps[(first + i) % stamps.size()];
+    }
+
+    const T& back() const {
+        return (*this)[count - 1];
+    }
+
+    void add(const T& x, int64_t t) {
+        size_t pos = (first + count) % values.size();
+        values[pos] = x;
+        stamps[pos] = t;
+        if (count < values.size()) {
+            ++count;
+        } else {
+            first = (first + 1) % values.size();
+        }
+    }
+
+    /** Drops the values stamped before t. */
+    void expire(int64_t t) {
+        while (count > 0 && stamps[first] < t) {
+            first = (first + 1) % values.size();
+            --count;
+        }
+    }
+};
+
+/*
+ * Stages. Each one does its work in push(x, t) and hands the result to the
+ * next stage; tick(now) is passed down the chain.
+ */
+
+template <class F>
+class SinkStage {
+    F f;
+
+    public:
+    SinkStage(const F& f) : f(f) {}
+
+    template <class T>
+    void push(const T& x, int64_t) {
+        f(x);
+    }
+
+    void tick(int64_t) {}
+};
+
+template <class Target>
+class ToStage {
+    Target* target;
+
+    public:
+    ToStage(Target* target) : target(target) {}
+
+    template <class T>
+    void push(const T& x, int64_t t) {
+        target->push(x, t);
+    }
+
+    void tick(int64_t now) {
+        target->tick(now);
+    }
+};
+
+template <class F, class Next>
+class MapStage {
+    F f;
+    Next next;
+
+    public:
+    MapStage(const F& f, const Next& next) : f(f), next(next) {}
+
+    template <class T>
+    void push(const T& x, int64_t t) {
+        next.push(f(x), t);
+    }
+
+    void tick(int64_t now) {
+        next.tick(now);
+    }
+};
+
+template <class P, class Next>
+class FilterStage {
+    P p;
+    Next next;
+
+    public:
+    FilterStage(const P& p, const Next& next) : p(p), next(next) {}
+
+    template <class T>
+    void push(const T& x, int64_t t) {
+        if (p(x)) {
+            next.push(x, t);
+        }
+    }
+
+    void tick(int64_t now) {
+        next.tick(now);
+    }
+};
+
+template <class F, class Next>
+class StampStage {
+    F f;
+    Next next;
+
+    public:
+    StampStage(const F& f, const Next& next) : f(f), next(next) {}
+
+    template <class T>
+    void push(const T& x, int64_t) {
+        next.push(x, f(x));
+    }
+
+    void tick(int64_t now) {
+        next.tick(now);
+    }
+};
+
+template <class Next>
+class ThrottleStage {
+    int64_t intervalNs;
+    int64_t lastNs;
+    bool passed;
+    Next next;
+
+    public:
+    ThrottleStage(int64_t intervalNs, const Next& next) :
+                  intervalNs(intervalNs), lastNs(0), passed(false),
+                  next(next) {}
+
+    template <class T>
+    void push(const T& x, int64_t t) {
+        if (!passed || t - lastNs >= intervalNs) {
+            passed = true;
+            lastNs = t;
+            next.push(x, t);
+        }
+    }
+
+    void tick(int64_t now) {
+        next.tick(now);
+    }
+};
+
+/*
+ * debounce and sample may be pushed to by the updater thread and ticked by
+ * another one, so they keep their state under a mutex. They also hold it
+ * while emitting, so that the stages after them never run concurrently.
+ */
+
+template <class V, class Next>
+class DebounceStage {
+    pthread_mutex_t mtx;
+    int64_t quietNs;
+    V pending;
+    int64_t pendingNs;
+    bool hasPending;
+    Next next;
+
+    DebounceStage& operator=(const DebounceStage&);
+
+    void emit() {
+        hasPending = false;
+        next.push(pending, pendingNs);
+    }
+
+    public:
+    DebounceStage(int64_t quietNs, const Next& next) :
+                  quietNs(quietNs), pending(), pendingNs(0),
+                  hasPending(false), next(next) {
+        pthread_mutex_init(&mtx, NULL);
+    }
+
+    // Copied only while the chain is being built.
+    DebounceStage(const DebounceStage& other) :
+                  quietNs(other.quietNs), pending(), pendingNs(0),
+                  hasPending(false), next(other.next) {
+        pthread_mutex_init(&mtx, NULL);
+    }
+
+    ~DebounceStage() {
+        pthread_mutex_destroy(&mtx);
+    }
+
+    template <class T>
+    void push(const T& x, int64_t t) {
+        pthread_mutex_lock(&mtx);
+        if (hasPending && t - pendingNs >= quietNs) {
+            emit(); // The previous burst is over.
+        }
+        pending = x;
+        pendingNs = t;
+        hasPending = true;
+        pthread_mutex_unlock(&mtx);
+    }
+
+    void tick(int64_t now) {
+        pthread_mutex_lock(&mtx);
+        if (hasPending && now - pendingNs >= quietNs) {
+            emit();
+        }
+        next.tick(now);
+        pthread_mutex_unlock(&mtx);
+    }
+};
+
+template <class V, class Next>
+class SampleStage {
+    pthread_mutex_t mtx;
+    int64_t periodNs;
+    int64_t dueNs;
+    V latest;
+    bool hasLatest;
+    Next next;
+
+    SampleStage& operator=(const SampleStage&);
+
+    void emitIfDue(int64_t now) {
+        if (dueNs == 0) {
+            dueNs = now + periodNs;
+        }
+        if (hasLatest && now >= dueNs) {
+            hasLatest = false;
+            // Stay on the period grid, skipping the periods that are gone.
+            dueNs += periodNs * ((now - dueNs) / periodNs + 1);
+            next.push(latest, now);
+        }
+    }
+
+    public:
+    SampleStage(int64_t periodNs, const Next& next) :
+                periodNs(periodNs > 0 ? periodNs : 1), dueNs(0), latest(),
+                hasLatest(false), next(next) {
+        pthread_mutex_init(&mtx, NULL);
+    }
+
+    // Copied only while the chain is being built.
+    SampleStage(const SampleStage& other) :
+                periodNs(other.periodNs), dueNs(0), latest(),
+                hasLatest(false), next(other.next) {
+        pthread_mutex_init(&mtx, NULL);
+    }
+
+    ~SampleStage() {
+        pthread_mutex_destroy(&mtx);
+    }
+
+    template <class T>
+    void push(const T& x, int64_t t) {
+        pthread_mutex_lock(&mtx);
+        latest = x;
+        hasLatest = true;
+        emitIfDue(t);
+        pthread_mutex_unlock(&mtx);
+    }
+
+    void tick(int64_t now) {
+        pthread_mutex_lock(&mtx);
+        emitIfDue(now);
+        next.tick(now);
+        pthread_mutex_unlock(&mtx);
+    }
+};
+
+template <class V, class Next>
+class WindowStage {
+    SlidingWindow<V> win;
+    int64_t maxAgeNs;
+    Next next;
+
+    public:
+    WindowStage(size_t size, int64_t maxAgeNs, const Next& next) :
+                win(size), maxAgeNs(maxAgeNs), next(next) {}
+
+    template <class T>
+    void push(const T& x, int64_t t) {
+        win.add(x, t);
+        if (maxAgeNs > 0) {
+            win.expire(t - maxAgeNs);
+        }
+        next.push(win, t);
+    }
+
+    void tick(int64_t now) {
+        next.tick(now);
+    }
+};
+
+/**
+ * Joins two streams by timestamp: every value of the first stream is paired
+ * with the value of the second whose timestamp is within toleranceNs of its
+ * own, and the pair (a std::pair<A, B>, stamped with the later of the two
+ * timestamps) is pushed downstream. Values that find no partner are dropped.
+ * Each input must be in timestamp order.
+ *
+ * The two inputs are usually fed by different buffers, i.e. different
+ * updater threads, so the zip keeps its state under a mutex, and the stages
+ * after it run with the mutex held. Feed the inputs with to(z.first()) and
+ * to(z.second()). The zip must outlive the pipelines feeding it.
+ */
+template <class A, class B, class Next>
+class ZipStage {
+
+    public:
+    /** One of the inputs; push into it with to(). */
+    template <int Side>
+    class Port {
+        ZipStage* zip;
+
+        public:
+        Port(ZipStage* zip) : zip(zip) {}
+
+        template <class T>
+        void push(const T& x, int64_t t) {
+            zip->template pushSide<Side>(x, t);
+        }
+
+        void tick(int64_t now) {
+            zip->tick(now);
+        }
+    };
+
+    private:
+    pthread_mutex_t mtx;
+    int64_t toleranceNs;
+    size_t maxPending;
+    std::deque<std::pair<A, int64_t> > pendingA;
+    std::deque<std::pair<B, int64_t> > pendingB;
+    Port<0> portA;
+    Port<1> portB;
+    Next next;
+    uint64_t dropped;
+
+    ZipStage(const ZipStage&);
+    ZipStage& operator=(const ZipStage&);
+
+    void match() {
+        while (!pendingA.empty() && !pendingB.empty()) {
+            int64_t ta = pendingA.front().second;
+            int64_t tb = pendingB.front().second;
+            if (ta - tb <= toleranceNs && tb - ta <= toleranceNs) {
+                next.push(std::make_pair(pendingA.front().first,
+                                         pendingB.front().first),
+                          ta > tb ? ta : tb);
+                pendingA.pop_front();
+                pendingB.pop_front();
+            } else if (ta < tb) {
+                // Later values of B are even further away.
+                pendingA.pop_front();
+                ++dropped;
+            } else {
+                pendingB.pop_front();
+                ++dropped;
+            }
+        }
+    }
+
+    public:
+    ZipStage(int64_t toleranceNs, const Next& next,
+             size_t maxPending = 64) :
+             toleranceNs(toleranceNs), maxPending(maxPending), portA(this),
+             portB(this), next(next), dropped(0) {
+        pthread_mutex_init(&mtx, NULL);
+    }
+
+    ~ZipStage() {
+        pthread_mutex_destroy(&mtx);
+    }
+
+    Port<0>& first() {
+        return portA;
+    }
+
+    Port<1>& second() {
+        return portB;
+    }
+
+    template <int Side, class T>
+    void pushSide(const T& x, int64_t t) {
+        pthread_mutex_lock(&mtx);
+        if constexpr (Side == 0) {
+            pendingA.push_back(std::make_pair(A(x), t));
+            if (pendingA.size() > maxPending) {
+                pendingA.pop_front();
+                ++dropped;
+            }
+        } else {
+            pendingB.push_back(std::make_pair(B(x), t));
+            if (pendingB.size() > maxPending) {
+                pendingB.pop_front();
+                ++dropped;
+            }
+        }
+        match();
+        pthread_mutex_unlock(&mtx);
+    }
+
+    void tick(int64_t now) {
+        pthread_mutex_lock(&mtx);
+        next.tick(now);
+        pthread_mutex_unlock(&mtx);
+    }
+
+    /** The number of values dropped for lack of a partner. */
+    uint64_t getDropped() {
+        pthread_mutex_lock(&mtx);
+        uint64_t d = dropped;
+        pthread_mutex_unlock(&mtx);
+        return d;
+    }
+};
+
+/*
+ * Operators: what the functions below return, and what chain() collects.
+ * bind(next) makes the stage that feeds next.
+ */
+
+template <class F>
+struct MapOp {
+    F f;
+
+    template <class Next>
+    MapStage<F, Next> bind(const Next& next) const {
+        return MapStage<F, Next>(f, next);
+    }
+};
+
+template <class P>
+struct FilterOp {
+    P p;
+
+    template <class Next>
+    FilterStage<P, Next> bind(const Next& next) const {
+        return FilterStage<P, Next>(p, next);
+    }
+};
+
+template <class F>
+struct StampOp {
+    F f;
+
+    template <class Next>
+    StampStage<F, Next> bind(const Next& next) const {
+        return StampStage<F, Next>(f, next);
+    }
+};
+
+struct ThrottleOp {
+    int64_t intervalNs;
+
+    template <class Next>
+    ThrottleStage<Next> bind(const Next& next) const {
+        return ThrottleStage<Next>(intervalNs, next);
+    }
+};
+
+template <class V>
+struct DebounceOp {
+    int64_t quietNs;
+
+    template <class Next>
+    DebounceStage<V, Next> bind(const Next& next) const {
+        return DebounceStage<V, Next>(quietNs, next);
+    }
+};
+
+template <class V>
+struct SampleOp {
+    int64_t periodNs;
+
+    template <class Next>
+    SampleStage<V, Next> bind(const Next& next) const {
+        return SampleStage<V, Next>(periodNs, next);
+    }
+};
+
+template <class V>
+struct WindowOp {
+    size_t size;
+    int64_t maxAgeNs;
+
+    template <class Next>
+    WindowStage<V, Next> bind(const Next& next) const {
+        return WindowStage<V, Next>(size, maxAgeNs, next);
+    }
+};
+
+template <class F>
+struct SinkOp {
+    F f;
+};
+
+template <class Target>
+struct ToOp {
+    Target* target;
+};
+
+template <class F>
+MapOp<F> map(const F& f) {
+    MapOp<F> op = {f};
+    return op;
+}
+
+template <class P>
+FilterOp<P> filter(const P& p) {
+    FilterOp<P> op = {p};
+    return op;
+}
+
+template <class F>
+StampOp<F> stampBy(const F& f) {
+    StampOp<F> op = {f};
+    return op;
+}
+
+inline ThrottleOp throttle(int64_t intervalNs) {
+    ThrottleOp op = {intervalNs};
+    return op;
+}
+
+template <class V>
+DebounceOp<V> debounce(int64_t quietNs) {
+    DebounceOp<V> op = {quietNs};
+    return op;
+}
+
+template <class V>
+SampleOp<V> sample(int64_t periodNs) {
+    SampleOp<V> op = {periodNs};
+    return op;
+}
+
+template <class V>
+WindowOp<V> window(size_t size, int64_t maxAgeNs = 0) {
+    WindowOp<V> op = {size, maxAgeNs};
+    return op;
+}
+
+template <class F>
+SinkOp<F> sink(const F& f) {
+    SinkOp<F> op = {f};
+    return op;
+}
+
+template <class Target>
+ToOp<Target> to(Target& target) {
+    ToOp<Target> op = {&target};
+    return op;
+}
+
+/**
+ * A zip whose output goes through the given pipeline; see ZipStage.
+ */
+template <class A, class B, class Next>
+ZipStage<A, B, Next> zip(int64_t toleranceNs, const Next& next) {
+    return ZipStage<A, B, Next>(toleranceNs, next);
+}
+
+/**
+ * Operators collected so far; the stages are only built when the chain is
+ * ended with sink() or to(), since each one holds the next.
+ */
+template <class... Ops>
+struct Chain {
+    std::tuple<Ops...> ops;
+};
+
+/** Starts a pipeline. */
+inline Chain<> chain() {
+    return Chain<>();
+}
+
+template <size_t I, class Ops, class Last>
+auto bindFrom(const Ops& ops, const Last& last) {
+    if constexpr (I == std::tuple_size<Ops>::value) {
+        return last;
+    } else {
+        return std::get<I>(ops).bind(bindFrom<I + 1>(ops, last));
+    }
+}
+
+template <class... Ops, class Op>
+Chain<Ops..., Op> operator|(const Chain<Ops...>& c, const Op& op) {
+    Chain<Ops..., Op> longer = {std::tuple_cat(c.ops, std::make_tuple(op))};
+    return longer;
+}
+
+template <class... Ops, class F>
+auto operator|(const Chain<Ops...>& c, const SinkOp<F>& s) {
+    return bindFrom<0>(c.ops, SinkStage<F>(s.f));
+}
+
+template <class... Ops, class Target>
+auto operator|(const Chain<Ops...>& c, const ToOp<Target>& s) {
+    return bindFrom<0>(c.ops, ToStage<Target>(s.target));
+}
+
+/**
+ * Adapts a pipeline to the publish hook of a buffer of Packets. The
+ * pipeline must outlive the buffer (or the hook).
+ */
+template <class Packet, class Pipeline>
+boost::function<void(const Packet&, uint64_t)> hook(Pipeline& pipeline) {
+    struct Push {
+        Pipeline* p;
+
+        void operator()(const Packet& pkt, uint64_t) const {
+            p->push(pkt, monotonicNs());
+        }
+    };
+    Push push = {&pipeline};
+    return push;
+}
+
+} // namespace stream
+
+#endif
@@ -0,0 +1,155 @@
+#include "BufferThreadedP.h"
+#include "Stream.h"
+#include <cstdlib>
+#include <iostream>
+
+using namespace std;
+
+/**
+ * A laser scan with the time it was taken.
+ */
+struct Scan {
+    vector<float> ranges;
+    timeval stamp;
+};
+
+/**
+ * A heading reading with the time it was taken.
+ */
+struct Heading {
+    double degrees;
+    timeval stamp;
+};
+
+/**
+ * Simulated laser scanner, 100 scans per second, with something wandering
+ * in and out of range.
+ */
+class ScanInterface {
+    int n;
+
+    public:
+    ScanInterface() : n(0) {}
+
+    Scan getPacket() {
+        usleep(10000);
+        Scan s;
+        s.ranges.assign(360, 5.0f);
+        s.ranges[n % 360] = 0.3f + (n % 50) / 20.0f;
+        gettimeofday(&s.stamp, NULL);
+        ++n;
+        return s;
+    }
+};
+
+/**
+ * Simulated compass, 200 readings per second.
+ */
+class HeadingInterface {
+    double deg;
+
+    public:
+    HeadingInterface() : deg(0) {}
+
+    Heading getPacket() {
+        usleep(5000);
+        Heading h;
+        deg += 0.5;
+        h.degrees = deg;
+        gettimeofday(&h.stamp, NULL);
+        return h;
+    }
+};
+
+float minRange(const Scan& s) {
+    float m = s.ranges[0];
+    for (size_t i = 1; i < s.ranges.size(); i++) {
+        if (s.ranges[i] < m) {
+            m = s.ranges[i];
+        }
+    }
+    return m;
+}
+
+/**
+ * Three pipelines over two buffers: obstacle warnings (map, filter,
+ * throttle), a smoothed range report (window, sample), and ranges paired
+ * with the heading at the time of the scan (zip by packet time stamp).
+ */
+int main() {
+    const int64_t MS = 1000000LL;
+    ScanInterface scanIface;
+    HeadingInterface headingIface;
+    int warnings = 0;
+    auto obstacles = stream::chain()
+        | stream::map(&minRange)
+        | stream::filter([](float r) { return r < 0.5f; })
+        | stream::throttle(100 * MS)
+        | stream::sink([&warnings](float r) {
+              ++warnings;
+              cout << "obstacle at " << r << " m" << endl;
+          });
+
+    auto smoothed = stream::chain()
+        | stream::map(&minRange)
+        | stream::window<float>(10)
+        | stream::map([](const stream::SlidingWindow<float>& w) {
+              float sum = 0;
+              for (size_t i = 0; i < w.size(); i++) {
+                  sum += w[i];
+              }
+              return sum / w.size();
+          })
+        | stream::sample<float>(250 * MS)
+        | stream::sink([](float r) {
+              cout << "mean nearest range " << r << " m" << endl;
+          });
+
+    int pairs = 0;
+    double lastHeading = 0;
+    auto paired = stream::zip<float, double>(3 * MS, stream::chain()
+        | stream::sink([&](const pair<float, double>& p) {
+              ++pairs;
+              lastHeading = p.second;
+          }));
+    auto scanSide = stream::chain()
+        | stream::stampBy([](const Scan& s) {
+              return stream::timevalNs(s.stamp);
+          })
+        | stream::map(&minRange)
+        | stream::to(paired.first());
+    auto headingSide = stream::chain()
+        | stream::stampBy([](const Heading& h) {
+              return stream::timevalNs(h.stamp);
+          })
+        | stream::map([](const Heading& h) { return h.degrees; })
+        | stream::to(paired.second());
+
+    // Declared after the pipelines, so that they are destroyed (and stop
+    // publishing) first.
+    BufferThread<Scan, ScanInterface> lidar(&scanIface);
+    BufferThread<Heading, HeadingInterface> compass(&headingIface);
+
+    // One hook per buffer, so the scan pipelines are fanned out here.
+    auto scanFanout = [&](const Scan& s, uint64_t) {
+        int64_t now = monotonicNs();
+        obstacles.push(s, now);
+        smoothed.push(s, now);
+        scanSide.push(s, now);
+    };
+    lidar.setPublishHook(scanFanout);
+    compass.setPublishHook(stream::hook<Heading>(headingSide));
+    lidar.runContinuous();
+    compass.runContinuous();
+
+    int64_t end = monotonicNs() + 1000 * MS;
+    while (monotonicNs() < end) {
+        usleep(50000);
+        smoothed.tick(monotonicNs());
+    }
+
+    cout << warnings << " warnings, " << pairs << " range/heading pairs (" <<
+        paired.getDropped() << " unpaired), last heading " << lastHeading <<
+        endl;
+    return 0;
+}
@@ -0,0 +1,529 @@
+#include <pthread.h>
+#include <atomic>
+#include <memory>
+#include <utility>
+#include <cstring>
+#include <type_traits>
+#include <new>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sched.h>
+#include <unistd.h>
+
+// Header guards -- this file may be included more than once.
+#ifndef SYNCPOLICY_H_
+#define SYNCPOLICY_H_
+
+/*
+ * Synchronization policies for the buffer templates (BufferThread, IOBuffer).
+ *
+ * A policy is a class with a nested template `Cell<Packet>` that holds the
+ * buffer's cached packet and decides how the updater thread hands it over to
+ * the readers. The policy is a template parameter, so the choice is made at
+ * compile time and costs nothing at runtime. Every Cell provides:
+ *
+ *     void store(Packet& pkl)    // updater only; may move from pkl
+ *     void load(Packet& out)     // any thread; copies the latest packet
+ *     void consume(Packet& out)  // like load, but may move the packet out
+ *     std::shared_ptr<const Packet> pin()  // latest packet, held stable
+ *
+ * There is exactly one writer per cell (the buffer's updater thread) and any
+ * number of readers. Which policy works best depends mostly on the packet
+ * size and on the number of readers; see PolicyBench for numbers.
+ */
+
+/**
+ * Tell the CPU we are busy-waiting. Makes spin loops friendlier to the other
+ * hyperthread and cheaper on power.
+ */
+inline void cpuRelax() {
+#if defined(__i386__) || defined(__x86_64__)
+    __builtin_ia32_pause();
+#endif
+}
+
+/**
+ * Thin object wrapper around pthread_mutex_t, so that it can be used as the
+ * lock of a LockedCell.
+ */
+class PthreadMutex {
+
+    private:
+    pthread_mutex_t mtx;
+
+    PthreadMutex(const PthreadMutex&);
+    PthreadMutex& operator=(const PthreadMutex&);
+
+    public:
+    PthreadMutex() {
+        pthread_mutex_init(&mtx, NULL);
+    }
+
+    ~PthreadMutex() {
+        pthread_mutex_destroy(&mtx);
+    }
+
+    void lock() {
+        pthread_mutex_lock(&mtx);
+    }
+
+    void unlock() {
+        pthread_mutex_unlock(&mtx);
+    }
+};
+
+/**
+ * A mutex that spins for a while before parking the calling thread in the
+ * kernel. Critical sections in the buffers are short (a packet copy), so a
+ * waiting thread is usually better off spinning than sleeping.
+ *
+ * The spin budget adapts: it follows a running average of how long it
+ * actually took to get the lock, so a lock that is held for long stretches
+ * quickly stops wasting cycles on spinning.
+ */
+class AdaptiveMutex {
+
+    private:
+    pthread_mutex_t mtx;
+    // Running estimate of the spins needed; only a hint, so relaxed is fine
+    std::atomic<int> spinEstimate;
+
+    AdaptiveMutex(const AdaptiveMutex&);
+    AdaptiveMutex& operator=(const AdaptiveMutex&);
+
+    public:
+    /** Upper bound on the number of spins before parking. */
+    static const int MAX_SPINS = 200;
+
+    AdaptiveMutex() : spinEstimate(MAX_SPINS / 4) {
+        pthread_mutex_init(&mtx, NULL);
+    }
+
+    ~AdaptiveMutex() {
+        pthread_mutex_destroy(&mtx);
+    }
+
+    void lock() {
+        if (pthread_mutex_trylock(&mtx) == 0) {
+            return;
+        }
+        int estimate = spinEstimate.load(std::memory_order_relaxed);
+        int limit = 2 * estimate + 10;
+        if (limit > MAX_SPINS) {
+            limit = MAX_SPINS;
+        }
+        int spins;
+        for (spins = 1; spins <= limit; spins++) {
+            cpuRelax();
+            if (pthread_mutex_trylock(&mtx) == 0) {
+                break;
+            }
+        }
+        if (spins > limit) {
+            // Spinning did not pay off; park in the kernel.
+            pthread_mutex_lock(&mtx);
+        }
+        spinEstimate.store(estimate + (spins - estimate) / 8,
+                           std::memory_order_relaxed);
+    }
+
+    void unlock() {
+        pthread_mutex_unlock(&mtx);
+    }
+};
+
+/**
+ * Cell guarded by a lock object providing lock() and unlock(). Works with
+ * any copyable packet.
+ */
+template <class Packet, class Lock>
+class LockedCell {
+
+    private:
+    Lock lck;
+    Packet pkt;
+
+    public:
+    LockedCell() : pkt() {}
+
+    void store(Packet& pkl) {
+        lck.lock();
+        pkt = std::move(pkl);
+        lck.unlock();
+    }
+
+    void load(Packet& out) {
+        lck.lock();
+        out = pkt;
+        lck.unlock();
+    }
+
+    /**
+     * Moves the packet out of the cell. The cell's packet is no longer valid
+     * afterwards (until the next store()).
+     */
+    void consume(Packet& out) {
+        lck.lock();
+        out = std::move(pkt);
+        lck.unlock();
+    }
+
+    /**
+     * Returns a private copy of the packet that stays valid for as long as
+     * the caller holds it.
+     */
+    std::shared_ptr<const Packet> pin() {
+        lck.lock();
+        std::shared_ptr<const Packet> copy = std::make_shared<Packet>(pkt);
+        lck.unlock();
+        return copy;
+    }
+};
+
+/**
+ * Cell protected by a sequence lock. Readers never block the writer and
+ * never write to shared memory; instead they retry if the writer was active
+ * while they were copying. Ideal for small packets with many readers.
+ *
+ * Readers may copy a half-written packet before noticing they have to retry,
+ * so the Packet must be trivially copyable (no pointers to owned memory).
+ */
+template <class Packet>
+class SeqLockCell {
+
+    static_assert(std::is_trivially_copyable<Packet>::value,
+                  "SeqLockPolicy requires a trivially copyable Packet");
+
+    private:
+    std::atomic<unsigned> seq; // Odd while a store is in progress
+    Packet pkt;
+
+    public:
+    SeqLockCell() : seq(0), pkt() {}
+
+    void store(Packet& pkl) {
+        unsigned s = seq.load(std::memory_order_relaxed);
+        seq.store(s + 1, std::memory_order_relaxed);
+        // The odd count must be visible before any byte of the packet is.
+        std::atomic_thread_fence(std::memory_order_release);
+        std::memcpy(static_cast<void*>(&pkt), &pkl, sizeof(Packet));
+        seq.store(s + 2, std::memory_order_release);
+    }
+
+    void load(Packet& out) {
+        while (true) {
+            unsigned s0 = seq.load(std::memory_order_acquire);
+            if (s0 & 1) {
+                cpuRelax();
+                continue;
+            }
+            std::memcpy(static_cast<void*>(&out), &pkt, sizeof(Packet));
+            // Keep the copy from being reordered past the second read.
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (seq.load(std::memory_order_relaxed) == s0) {
+                return;
+            }
+        }
+    }
+
+    void consume(Packet& out) {
+        load(out);
+    }
+
+    std::shared_ptr<const Packet> pin() {
+        std::shared_ptr<Packet> copy = std::make_shared<Packet>();
+        load(*copy);
+        return copy;
+    }
+};
+
+/**
+ * Two packet slots and an atomic index naming the current one. The writer
+ * fills the other slot and flips the index, so readers only ever contend on
+ * a reader count, never on the packet itself.
+ *
+ * Before reusing a slot the writer waits for readers still copying out of it
+ * to finish, so very slow readers of large packets can delay the writer.
+ */
+template <class Packet>
+class DoubleBufferCell {
+
+    private:
+    Packet slots[2];
+    std::atomic<int> current;
+    std::atomic<int> readers[2];
+
+    public:
+    DoubleBufferCell() : slots(), current(0) {
+        readers[0].store(0);
+        readers[1].store(0);
+    }
+
+    void store(Packet& pkl) {
+        int next = 1 - current.load(std::memory_order_relaxed);
+        // seq_cst pairs with the readers' increment-then-recheck below.
+        while (readers[next].load() != 0) {
+            cpuRelax();
+        }
+        slots[next] = std::move(pkl);
+        current.store(next);
+    }
+
+    void load(Packet& out) {
+        while (true) {
+            int idx = current.load();
+            readers[idx].fetch_add(1);
+            // If the index moved on, the writer may already be refilling
+            // this slot; back off and try the new one.
+            if (current.load() == idx) {
+                out = slots[idx];
+                readers[idx].fetch_sub(1, std::memory_order_release);
+                return;
+            }
+            readers[idx].fetch_sub(1, std::memory_order_release);
+        }
+    }
+
+    void consume(Packet& out) {
+        load(out);
+    }
+
+    std::shared_ptr<const Packet> pin() {
+        std::shared_ptr<Packet> copy = std::make_shared<Packet>();
+        load(*copy);
+        return copy;
+    }
+};
+
+/**
+ * Read-copy-update cell: every store publishes a freshly allocated,
+ * immutable packet and swaps a pointer to it. Readers take a reference to
+ * whichever packet is current; old packets are reclaimed once the last
+ * reader lets go of them (the reference count acts as the grace period).
+ *
+ * The writer pays one allocation per update, readers never wait for the
+ * writer to finish copying. Note that the standard library implements the
+ * atomic shared_ptr operations with a small pool of spinlocks, so reader
+ * reference-taking is short but not strictly lock-free.
+ */
+template <class Packet>
+class RcuCell {
+
+    private:
+    std::shared_ptr<const Packet> current;
+
+    public:
+    RcuCell() : current(std::make_shared<const Packet>()) {}
+
+    void store(Packet& pkl) {
+        std::shared_ptr<const Packet> next =
+            std::make_shared<const Packet>(std::move(pkl));
+        std::atomic_store_explicit(&current, next, std::memory_order_release);
+    }
+
+    void load(Packet& out) {
+        out = *pin();
+    }
+
+    void consume(Packet& out) {
+        load(out);
+    }
+
+    /**
+     * Returns a reference to the current packet without copying it. The
+     * packet stays valid for as long as the reference is held.
+     */
+    std::shared_ptr<const Packet> pin() {
+        return std::atomic_load_explicit(&current,
+                                         std::memory_order_acquire);
+    }
+};
+
+/** Size of a cache line, for keeping per-core data apart. */
+const size_t CACHE_LINE_SIZE = 64;
+
+/**
+ * A set of replicated cells, one per CPU core (or per group of readers),
+ * each on its own cache lines. The writer stores every packet into all
+ * replicas; a reader only touches the replica of the core it runs on. With
+ * many readers of a small packet on many cores, this keeps even the lock or
+ * sequence word from bouncing between caches.
+ *
+ * The price is paid by the writer, which copies each packet once per
+ * replica, and in memory. Each replica is an ordinary cell of the Inner
+ * policy, so ReplicatedPolicy<SeqLockPolicy> gives per-core sequence locks.
+ *
+ * A reader that migrates to another core mid-read is still correct; it just
+ * reads a remote replica that one time. consume() does not move the packet
+ * out, since other readers still read the other replicas.
+ */
+template <class Packet, class Inner, int NumReplicas>
+class ReplicatedCell {
+
+    private:
+    struct alignas(CACHE_LINE_SIZE) Replica {
+        typename Inner::template Cell<Packet> cell;
+    };
+
+    Replica* replicas;
+    int numReplicas;
+
+    ReplicatedCell(const ReplicatedCell&);
+    ReplicatedCell& operator=(const ReplicatedCell&);
+
+    Replica& local() {
+        int cpu = sched_getcpu();
+        if (cpu < 0) {
+            cpu = 0;
+        }
+        return replicas[cpu % numReplicas];
+    }
+
+    public:
+    ReplicatedCell() {
+        numReplicas = NumReplicas;
+        if (numReplicas <= 0) {
+            numReplicas = sysconf(_SC_NPROCESSORS_CONF);
+        }
+        if (numReplicas <= 0) {
+            numReplicas = 1;
+        }
+        void* mem = NULL;
+        if (posix_memalign(&mem, CACHE_LINE_SIZE,
+                           numReplicas * sizeof(Replica)) != 0) {
+            throw std::bad_alloc();
+        }
+        replicas = static_cast<Replica*>(mem);
+        for (int i = 0; i < numReplicas; i++) {
+            new (&replicas[i]) Replica();
+        }
+    }
+
+    ~ReplicatedCell() {
+        for (int i = 0; i < numReplicas; i++) {
+            replicas[i].~Replica();
+        }
+        free(replicas);
+    }
+
+    void store(Packet& pkl) {
+        for (int i = 0; i < numReplicas - 1; i++) {
+            Packet copy(pkl);
+            replicas[i].cell.store(copy);
+        }
+        replicas[numReplicas - 1].cell.store(pkl);
+    }
+
+    void load(Packet& out) {
+        local().cell.load(out);
+    }
+
+    void consume(Packet& out) {
+        load(out);
+    }
+
+    std::shared_ptr<const Packet> pin() {
+        return local().cell.pin();
+    }
+
+    /** The number of replicas in use. */
+    int getNumReplicas() {
+        return numReplicas;
+    }
+};
+
+/**
+ * Plain pthreads mutex around the packet. The historical behaviour and the
+ * default; a good choice for large packets and few readers.
+ */
+struct MutexPolicy {
+    template <class Packet>
+    using Cell = LockedCell<Packet, PthreadMutex>;
+};
+
+/**
+ * Spin-then-park mutex around the packet. Cuts the wakeup latency of
+ * contended readers when copies are short.
+ */
+struct SpinParkPolicy {
+    template <class Packet>
+    using Cell = LockedCell<Packet, AdaptiveMutex>;
+};
+
+/** Sequence lock; small, trivially copyable packets with many readers. */
+struct SeqLockPolicy {
+    template <class Packet>
+    using Cell = SeqLockCell<Packet>;
+};
+
+/** Double buffer flipped with an atomic index. */
+struct DoubleBufferPolicy {
+    template <class Packet>
+    using Cell = DoubleBufferCell<Packet>;
+};
+
+/**
+ * Read-copy-update; large packets with many readers. The only policy whose
+ * leases (BufferThread::lease()) pin the published packet without copying.
+ */
+struct RcuPolicy {
+    template <class Packet>
+    using Cell = RcuCell<Packet>;
+};
+
+/**
+ * Per-core replicas of an Inner policy's cell, for packets that are read by
+ * very many threads very often (robot pose, system mode). NumReplicas is the
+ * number of replicas; zero means one per configured CPU.
+ */
+template <class Inner = SeqLockPolicy, int NumReplicas = 0>
+struct ReplicatedPolicy {
+    template <class Packet>
+    using Cell = ReplicatedCell<Packet, Inner, NumReplicas>;
+};
+
+/**
+ * A packet stamped with a version and a time, for handing packets over
+ * through a cell exactly once (see IOBuffer). Whoever reads the pair reads
+ * a consistent version and packet, whatever the policy.
+ *
+ * Moving a packet out of the pair resets its version to 0, so a reader
+ * that consumes a pair another reader has already moved out of the cell
+ * sees version 0 and knows the packet is gone. Trivially copyable packets
+ * are never invalidated by a move; their pairs stay trivially copyable
+ * (and so usable with SeqLockPolicy).
+ */
+template <class Packet,
+          bool Trivial = std::is_trivially_copyable<Packet>::value>
+struct VersionedPacket {
+    uint64_t version; /**< 0: no packet */
+    int64_t ns;
+    Packet pkt;
+};
+
+template <class Packet>
+struct VersionedPacket<Packet, false> {
+    uint64_t version;
+    int64_t ns;
+    Packet pkt;
+
+    VersionedPacket() : version(0), ns(0), pkt() {}
+
+    VersionedPacket(const VersionedPacket&) = default;
+    VersionedPacket& operator=(const VersionedPacket&) = default;
+
+    VersionedPacket(VersionedPacket&& other) : version(other.version),
+                    ns(other.ns), pkt(std::move(other.pkt)) {
+        other.version = 0;
+    }
+
+    VersionedPacket& operator=(VersionedPacket&& other) {
+        version = other.version;
+        ns = other.ns;
+        pkt = std::move(other.pkt);
+        other.version = 0;
+        return *this;
+    }
+};
+
+#endif
@@ -0,0 +1,103 @@
+#include <pthread.h>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+// Header guards -- this file may be included more than once.
+#ifndef THREADACCOUNTING_H_
+#define THREADACCOUNTING_H_
+
+/**
+ * A thread known to the ThreadRegistry.
+ */
+struct RegisteredThread {
+    std::string name;
+    pid_t tid;
+};
+
+/**
+ * The process-wide list of named threads. Buffer threads, graph workers and
+ * the like register themselves while they run (see ThreadRegistration), so
+ * that ThreadSampler (ThreadSampler.h) can tell whose CPU time it is
+ * looking at, and so can tools like top -H and gdb, through
+ * pthread_setname_np().
+ */
+class ThreadRegistry {
+
+    private:
+    pthread_mutex_t mtx;
+    std::vector<RegisteredThread> threads;
+
+    ThreadRegistry() {
+        pthread_mutex_init(&mtx, NULL);
+    }
+
+    ThreadRegistry(const ThreadRegistry&);
+    ThreadRegistry& operator=(const ThreadRegistry&);
+
+    public:
+    static ThreadRegistry& instance() {
+        static ThreadRegistry registry;
+        return registry;
+    }
+
+    /**
+     * Registers the calling thread and gives it the name, as far as the
+     * kernel's limit of 15 characters allows.
+     */
+    void add(const std::string& name) {
+        RegisteredThread t;
+        t.name = name;
+        t.tid = syscall(SYS_gettid);
+        pthread_setname_np(pthread_self(), name.substr(0, 15).c_str());
+        pthread_mutex_lock(&mtx);
+        threads.push_back(t);
+        pthread_mutex_unlock(&mtx);
+    }
+
+    /**
+     * Unregisters the calling thread.
+     */
+    void remove() {
+        pid_t tid = syscall(SYS_gettid);
+        pthread_mutex_lock(&mtx);
+        for (size_t i = 0; i < threads.size(); i++) {
+            if (threads[i].tid == tid) {
+                threads.erase(threads.begin() + i);
+                break;
+            }
+        }
+        pthread_mutex_unlock(&mtx);
+    }
+
+    std::vector<RegisteredThread> list() {
+        pthread_mutex_lock(&mtx);
+        std::vector<RegisteredThread> copy = threads;
+        pthread_mutex_unlock(&mtx);
+        return copy;
+    }
+};
+
+/**
+ * Registers the calling thread for as long as it is in scope; put one at
+ * the top of a thread function. Cancellation unwinds the stack, so a
+ * cancelled thread is unregistered as well.
+ */
+class ThreadRegistration {
+
+    private:
+    ThreadRegistration(const ThreadRegistration&);
+    ThreadRegistration& operator=(const ThreadRegistration&);
+
+    public:
+    ThreadRegistration(const std::string& name) {
+        ThreadRegistry::instance().add(name);
+    }
+
+    ~ThreadRegistration() {
+        ThreadRegistry::instance().remove();
+    }
+};
+
+#endif
@@ -0,0 +1,86 @@
+#include "BufferThreadedP.h"
+#include "IOBuffer.h"
+#include "ThreadSampler.h"
+#include <iostream>
+
+using namespace std;
+
+/** Simulated sensor: sleeps most of the time. */
+class SleepySensor {
+    int periodUs;
+    int n;
+
+    public:
+    SleepySensor(int periodUs) : periodUs(periodUs), n(0) {}
+
+    int getPacket() {
+        usleep(periodUs);
+        return ++n;
+    }
+};
+
+/** Simulated sensor that has to work hard for every reading. */
+class BusySensor {
+    int n;
+
+    public:
+    BusySensor() : n(0) {}
+
+    int getPacket() {
+        int64_t until = monotonicNs() + 2000000;
+        while (monotonicNs() < until) {}
+        return ++n;
+    }
+};
+
+/** A planning stage that takes about 5 ms of CPU per input. */
+class Planner {
+    public:
+    long runProcess(int& in) {
+        int64_t until = monotonicNs() + 5000000;
+        long x = in;
+        while (monotonicNs() < until) {
+            x = x * 31 + 7;
+        }
+        return x;
+    }
+};
+
+/**
+ * Runs a few named buffer threads with very different CPU appetites and
+ * prints what the sampler makes of them.
+ */
+int main(int argc, char** argv) {
+    ThreadRegistration self("main");
+
+    SleepySensor imu(2000);
+    SleepySensor gps(100000);
+    BusySensor camera;
+    Planner planner;
+
+    BufferThread<int, SleepySensor> imuBuf(&imu);
+    BufferThread<int, SleepySensor> gpsBuf(&gps);
+    BufferThread<int, BusySensor> cameraBuf(&camera);
+    IOBuffer<int, long, Planner> plannerBuf(&planner);
+    imuBuf.setThreadName("imu");
+    gpsBuf.setThreadName("gps");
+    cameraBuf.setThreadName("camera");
+    plannerBuf.setThreadName("planner");
+
+    imuBuf.runContinuous();
+    gpsBuf.runContinuous();
+    cameraBuf.runContinuous();
+    plannerBuf.runContinuous();
+
+    ThreadSampler sampler;
+    sampler.start(500);
+
+    int64_t end = monotonicNs() + 2000000000LL;
+    while (monotonicNs() < end) {
+        plannerBuf.providePacket(imuBuf.getPacket());
+        usleep(10000);
+    }
+
+    sampler.report(cout);
+    return 0;
+}
@@ -0,0 +1,266 @@
+#include <pthread.h>
+#include <boost/function.hpp>
+#include <boost/bind.hpp>
+#include <atomic>
+#include <cstdio>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#include "BufferThreadedP.h" // for pthreadWrapper
+#include "FutexEvent.h"
+#include "MonotonicClock.h"
+#include "ThreadAccounting.h"
+
+// Header guards -- this file may be included more than once.
+#ifndef THREADSAMPLER_H_
+#define THREADSAMPLER_H_
+
+/**
+ * CPU and scheduler figures of one thread, as sampled by ThreadSampler.
+ * Totals are since the thread started; rates are over the interval since
+ * the previous sample (zero in the first one).
+ */
+struct ThreadMetrics {
+    std::string name;
+    pid_t tid;
+    uint64_t cpuNs;          /**< Time on a CPU */
+    uint64_t runWaitNs;      /**< Runnable, but waiting for a CPU */
+    uint64_t timeslices;     /**< Times it was scheduled in */
+    uint64_t voluntary;      /**< Context switches it asked for (blocking) */
+    uint64_t involuntary;    /**< Times it was preempted */
+    double cpuPercent;       /**< Of one CPU */
+    double runWaitPercent;   /**< Of the interval */
+    double involuntaryPerSec;
+};
+
+/**
+ * A sample of all registered threads.
+ */
+struct ThreadMetricsSnapshot {
+    int64_t takenNs;   /**< See monotonicNs() */
+    int64_t intervalNs; /**< Since the previous sample; 0 for the first */
+    std::vector<ThreadMetrics> threads;
+};
+
+/**
+ * Collects per-thread CPU time, context switches and run-queue wait of the
+ * registered threads: from /proc/self/task/<tid>/schedstat (CPU time, run
+ * queue wait, timeslices) and /proc/self/task/<tid>/status (context
+ * switches). Where /proc is not available, the calling thread still gets
+ * its own figures from getrusage(RUSAGE_THREAD); other threads read zero.
+ *
+ *     ThreadSampler sampler;
+ *     sampler.start(1000); // A sample every second
+ *     ...
+ *     ThreadMetricsSnapshot snap = sampler.getSnapshot();
+ *     sampler.report(cout);
+ *
+ * Call sample() directly instead of start() to sample on your own schedule.
+ * A run-queue wait of a large fraction of the interval, or many
+ * involuntary switches, means that the thread is starved of CPU.
+ */
+class ThreadSampler {
+
+    private:
+    pthread_mutex_t mtx; // Guards last and prev
+    ThreadMetricsSnapshot last;
+    std::map<pid_t, ThreadMetrics> prev;
+    int64_t prevNs;
+
+    int intervalMs;
+    std::atomic<bool> bStop;
+    bool bStarted;
+    pthread_t sample_thread;
+    FutexEvent stop_evt;
+    boost::function<void*()>* tfPersistent;
+
+    ThreadSampler(const ThreadSampler&);
+    ThreadSampler& operator=(const ThreadSampler&);
+
+    static bool readSchedstat(pid_t tid, ThreadMetrics& m) {
+        char path[64];
+        snprintf(path, sizeof(path), "/proc/self/task/%d/schedstat",
+                 (int) tid);
+        FILE* f = fopen(path, "r");
+        if (f == NULL) {
+            return false;
+        }
+        unsigned long long cpu, wait, slices;
+        bool ok = fscanf(f, "%llu %llu %llu", &cpu, &wait, &slices) == 3;
+        fclose(f);
+        if (ok) {
+            m.cpuNs = cpu;
+            m.runWaitNs = wait;
+            m.timeslices = slices;
+        }
+        return ok;
+    }
+
+    static bool readStatus(pid_t tid, ThreadMetrics& m) {
+        char path[64];
+        snprintf(path, sizeof(path), "/proc/self/task/%d/status", (int) tid);
+        FILE* f = fopen(path, "r");
+        if (f == NULL) {
+            return false;
+        }
+        char line[256];
+        unsigned long long v;
+        while (fgets(line, sizeof(line), f) != NULL) {
+            if (sscanf(line, "voluntary_ctxt_switches: %llu", &v) == 1) {
+                m.voluntary = v;
+            } else if (sscanf(line, "nonvoluntary_ctxt_switches: %llu",
+                              &v) == 1) {
+                m.involuntary = v;
+            }
+        }
+        fclose(f);
+        return true;
+    }
+
+    /** The calling thread's own figures, without /proc. */
+    static void readRusage(ThreadMetrics& m) {
+        rusage ru;
+        if (getrusage(RUSAGE_THREAD, &ru) != 0) {
+            return;
+        }
+        m.cpuNs = (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000000ULL +
+            (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) * 1000ULL;
+        m.voluntary = ru.ru_nvcsw;
+        m.involuntary = ru.ru_nivcsw;
+    }
+
+    /**
+     * The sampler thread function.
+     *
+     * It is called from an external wrapper function.
+     */
+    void* samplerMeth() {
+        ThreadRegistration reg("thread-sampler");
+        while (true) {
+            uint32_t key = stop_evt.prepareWait();
+            if (bStop.load()) {
+                return NULL;
+            }
+            sample();
+            stop_evt.waitFor(key, intervalMs * 1000000LL);
+        }
+    }
+
+    public:
+    ThreadSampler() : prevNs(0), intervalMs(1000), bStop(false),
+                      bStarted(false), tfPersistent(NULL) {
+        pthread_mutex_init(&mtx, NULL);
+        last.takenNs = 0;
+        last.intervalNs = 0;
+    }
+
+    ~ThreadSampler() {
+        if (bStarted) {
+            bStop.store(true);
+            stop_evt.notifyAll();
+            pthread_join(sample_thread, NULL);
+        }
+        pthread_mutex_destroy(&mtx);
+        delete tfPersistent;
+    }
+
+    /**
+     * Samples every registered thread now.
+     */
+    ThreadMetricsSnapshot sample() {
+        std::vector<RegisteredThread> threads =
+            ThreadRegistry::instance().list();
+        pid_t self = syscall(SYS_gettid);
+        ThreadMetricsSnapshot snap;
+        snap.takenNs = monotonicNs();
+
+        std::vector<ThreadMetrics> current;
+        for (size_t i = 0; i < threads.size(); i++) {
+            ThreadMetrics m = ThreadMetrics();
+            m.name = threads[i].name;
+            m.tid = threads[i].tid;
+            bool ok = readSchedstat(m.tid, m);
+            ok = readStatus(m.tid, m) && ok;
+            if (!ok && m.tid == self) {
+                readRusage(m);
+            }
+            current.push_back(m);
+        }
+
+        pthread_mutex_lock(&mtx);
+        snap.intervalNs = prevNs > 0 ? snap.takenNs - prevNs : 0;
+        std::map<pid_t, ThreadMetrics> next;
+        for (size_t i = 0; i < current.size(); i++) {
+            ThreadMetrics& m = current[i];
+            std::map<pid_t, ThreadMetrics>::iterator it = prev.find(m.tid);
+            if (it != prev.end() && snap.intervalNs > 0) {
+                double dt = snap.intervalNs;
+                m.cpuPercent = 100.0 * (m.cpuNs - it->second.cpuNs) / dt;
+                m.runWaitPercent =
+                    100.0 * (m.runWaitNs - it->second.runWaitNs) / dt;
+                m.involuntaryPerSec =
+                    (m.involuntary - it->second.involuntary) * 1e9 / dt;
+            }
+            next[m.tid] = m;
+        }
+        prev.swap(next);
+        prevNs = snap.takenNs;
+        snap.threads = current;
+        last = snap;
+        pthread_mutex_unlock(&mtx);
+        return snap;
+    }
+
+    /**
+     * Samples every intervalMs on a thread of the sampler's own. Call only
+     * once.
+     */
+    void start(int intervalMs) {
+        this->intervalMs = intervalMs;
+        boost::function<void*()> thrFun =
+            bind(&ThreadSampler::samplerMeth, this);
+        tfPersistent = new boost::function<void*()>(thrFun);
+        pthread_create(&sample_thread, NULL, &pthreadWrapper, tfPersistent);
+        bStarted = true;
+    }
+
+    /**
+     * The latest sample.
+     */
+    ThreadMetricsSnapshot getSnapshot() {
+        pthread_mutex_lock(&mtx);
+        ThreadMetricsSnapshot snap = last;
+        pthread_mutex_unlock(&mtx);
+        return snap;
+    }
+
+    /**
+     * Prints the latest sample as a table.
+     */
+    void report(std::ostream& os) {
+        ThreadMetricsSnapshot snap = getSnapshot();
+        os << "thread                 tid    cpu(ms)   cpu%  runq-wait%"
+            "   vol-cs  invol-cs  invol/s" << std::endl;
+        for (size_t i = 0; i < snap.threads.size(); i++) {
+            const ThreadMetrics& m = snap.threads[i];
+            std::string name = m.name;
+            name.resize(20, ' ');
+            char line[160];
+            snprintf(line, sizeof(line), "%s %6d %10.1f %6.1f %11.1f %8llu "
+                     "%9llu %8.1f", name.c_str(), (int) m.tid,
+                     m.cpuNs / 1e6, m.cpuPercent, m.runWaitPercent,
+                     (unsigned long long) m.voluntary,
+                     (unsigned long long) m.involuntary,
+                     m.involuntaryPerSec);
+            os << line << std::endl;
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,203 @@
+#include "BufferThreadedP.h"
+#include <atomic>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <sys/resource.h>
+#include <time.h>
+
+using namespace std;
+
+/** Monotonic time in nanoseconds. */
+int64_t nowNs() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/** Voluntary context switches of the whole process so far. */
+long contextSwitches() {
+    rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_nvcsw;
+}
+
+/**
+ * The notification scheme the buffers used before: a flag guarded by a
+ * mutex and a condition variable.
+ */
+class CondEvent {
+    pthread_mutex_t mtx;
+    pthread_cond_t cond;
+    uint32_t seq;
+
+    public:
+    CondEvent() : seq(0) {
+        pthread_mutex_init(&mtx, NULL);
+        pthread_cond_init(&cond, NULL);
+    }
+
+    ~CondEvent() {
+        pthread_cond_destroy(&cond);
+        pthread_mutex_destroy(&mtx);
+    }
+
+    uint32_t prepareWait() {
+        pthread_mutex_lock(&mtx);
+        uint32_t key = seq;
+        pthread_mutex_unlock(&mtx);
+        return key;
+    }
+
+    void wait(uint32_t key) {
+        pthread_mutex_lock(&mtx);
+        while (seq == key) {
+            pthread_cond_wait(&cond, &mtx);
+        }
+        pthread_mutex_unlock(&mtx);
+    }
+
+    void notifyOne() {
+        pthread_mutex_lock(&mtx);
+        ++seq;
+        pthread_cond_signal(&cond);
+        pthread_mutex_unlock(&mtx);
+    }
+};
+
+/**
+ * Two events and a turn counter for bouncing control between two threads.
+ */
+template <class Event>
+struct PingPong {
+    Event ping;
+    Event pong;
+    std::atomic<long> turn;
+    long rounds;
+
+    PingPong(long rounds) : turn(0), rounds(rounds) {}
+};
+
+template <class Event>
+void* pongMain(void* arg) {
+    PingPong<Event>* pp = static_cast<PingPong<Event>*>(arg);
+    for (long i = 0; i < pp->rounds; i++) {
+        while (true) {
+            uint32_t key = pp->ping.prepareWait();
+            if (pp->turn.load() == 2 * i + 1) {
+                break;
+            }
+            pp->ping.wait(key);
+        }
+        pp->turn.store(2 * i + 2);
+        pp->pong.notifyOne();
+    }
+    return NULL;
+}
+
+/**
+ * Measures the round-trip time of waking another thread and being woken
+ * back, in nanoseconds.
+ */
+template <class Event>
+double pingPongNs(long rounds) {
+    PingPong<Event> pp(rounds);
+    pthread_t thr;
+    pthread_create(&thr, NULL, &pongMain<Event>, &pp);
+    int64_t t0 = nowNs();
+    for (long i = 0; i < rounds; i++) {
+        pp.turn.store(2 * i + 1);
+        pp.ping.notifyOne();
+        while (true) {
+            uint32_t key = pp.pong.prepareWait();
+            if (pp.turn.load() == 2 * i + 2) {
+                break;
+            }
+            pp.pong.wait(key);
+        }
+    }
+    int64_t t1 = nowNs();
+    pthread_join(thr, NULL);
+    return double(t1 - t0) / rounds;
+}
+
+/** Time per notification when nobody is waiting, in nanoseconds. */
+template <class Event>
+double idleNotifyNs(Event& evt, long count) {
+    int64_t t0 = nowNs();
+    for (long i = 0; i < count; i++) {
+        evt.notifyOne();
+    }
+    return double(nowNs() - t0) / count;
+}
+
+/**
+ * Sensor stand-in that answers immediately.
+ */
+class InstantInterface {
+    public:
+    int getPacket() {
+        return 0;
+    }
+};
+
+/**
+ * Wakeup latency and system call count benchmarks for FutexEvent, compared
+ * with the mutex + condition variable scheme it replaces.
+ *
+ * Usage: WakeupBench [rounds]  (default 20000)
+ */
+int main(int argc, char** argv) {
+    long rounds = 20000;
+    if (argc > 1) {
+        rounds = atol(argv[1]);
+    }
+
+    // Notifications nobody listens to, e.g. a publish with no waiters.
+    FutexEvent idleFutex;
+    CondEvent idleCond;
+    long idleCount = rounds * 50;
+    cout << "Notify with no waiters (" << idleCount << " notifications)" <<
+        endl;
+    cout << fixed << setprecision(1);
+    cout << "  condvar: " << idleNotifyNs(idleCond, idleCount) << " ns" <<
+        endl;
+    cout << "  futex:   " << idleNotifyNs(idleFutex, idleCount) << " ns, " <<
+        idleFutex.getWakeSyscalls() << " FUTEX_WAKE calls" << endl;
+
+    // Full round trips between two threads.
+    cout << "Ping-pong round trip (" << rounds << " rounds)" << endl;
+    long csw0 = contextSwitches();
+    double tCond = pingPongNs<CondEvent>(rounds);
+    long csw1 = contextSwitches();
+    double tFutex = pingPongNs<FutexEvent>(rounds);
+    long csw2 = contextSwitches();
+    cout << "  condvar: " << tCond << " ns, " <<
+        double(csw1 - csw0) / rounds << " context switches/round" << endl;
+    cout << "  futex:   " << tFutex << " ns, " <<
+        double(csw2 - csw1) / rounds << " context switches/round" << endl;
+
+    // The real thing: trigger a BufferThread and wait for the publish.
+    InstantInterface iface;
+    BufferThread<int, InstantInterface> buf(&iface);
+    buf.spawnThreads();
+    int64_t worst = 0;
+    int64_t total = 0;
+    long cycles = rounds / 10;
+    for (long i = 0; i < cycles; i++) {
+        uint64_t v = buf.getVersion();
+        int64_t t0 = nowNs();
+        buf.readData();
+        buf.waitForVersion(v);
+        int64_t dt = nowNs() - t0;
+        total += dt;
+        if (dt > worst) {
+            worst = dt;
+        }
+    }
+    cout << "BufferThread readData() -> publish (" << cycles <<
+        " cycles)" << endl;
+    cout << "  mean " << double(total) / cycles << " ns, max " << worst <<
+        " ns" << endl;
+    return 0;
+}
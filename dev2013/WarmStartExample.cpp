@@ -0,0 +1,122 @@
+#include "PacketSnapshot.h"
+#include <iostream>
+#include <signal.h>
+#include <sys/wait.h>
+
+using namespace std;
+
+/**
+ * Pose estimate. All fields are derived from the update count, so a torn
+ * packet is easy to spot.
+ */
+struct Pose {
+    long updates;
+    double x;
+    double y;
+    double heading;
+
+    bool isConsistent() const {
+        return x == updates * 0.5 && y == -x && heading == updates % 360;
+    }
+};
+
+/** Simulated localizer, starting from a given update count. */
+class Localizer {
+    long n;
+    int periodUs;
+
+    public:
+    Localizer(long start, int periodUs) : n(start), periodUs(periodUs) {}
+
+    Pose getPacket() {
+        usleep(periodUs);
+        ++n;
+        Pose p = {n, n * 0.5, -n * 0.5, (double) (n % 360)};
+        return p;
+    }
+};
+
+typedef BufferThread<Pose, Localizer> PoseBuffer;
+
+/**
+ * One run of the robot: restores the pose buffer, if possible, then
+ * persists it while the localizer runs.
+ */
+long runRobot(const char* path, long start, int periodUs, int runMs,
+              int intervalMs) {
+    Localizer loc(start, periodUs);
+    PoseBuffer buf(&loc);
+    PacketSnapshot snap(path, 1 << 16, intervalMs);
+    if (!snap.isOpen()) {
+        cout << snap.getError() << endl;
+        return -1;
+    }
+    bool restored = snap.restore("pose", &buf);
+    snap.persist("pose", &buf, sizeof(Pose));
+
+    Pose p = buf.getPacket();
+    if (restored) {
+        cout << "  restored pose of update " << p.updates << " (stale: "
+            << buf.isRestored() << ", consistent: " << p.isConsistent()
+            << ")" << endl;
+    } else {
+        cout << "  nothing to restore, starting from scratch" << endl;
+    }
+
+    buf.runContinuous();
+    snap.start();
+    buf.waitForVersion(0);
+    cout << "  first fresh pose, stale: " << buf.isRestored() << endl;
+    usleep(runMs * 1000);
+    p = buf.getPacket();
+    cout << "  stopping at update " << p.updates << ", "
+        << snap.getWriteCount() << " snapshot writes" << endl;
+    // Clean shutdown: the last pose goes to the file before buf goes away.
+    snap.stop();
+    return p.updates;
+}
+
+/**
+ * Runs the robot twice, shutting down cleanly in between, then kills it in
+ * the middle of snapshot writes a number of times and checks that what is
+ * restored is always an intact packet.
+ */
+int main(int argc, char** argv) {
+    const char* path = "/tmp/WarmStartExample.snap";
+    unlink(path);
+
+    cout << "First run:" << endl;
+    long last = runRobot(path, 0, 10000, 300, 50);
+    cout << "Second run:" << endl;
+    runRobot(path, last, 10000, 300, 50);
+
+    const int kills = 20;
+    int torn = 0;
+    for (int i = 0; i < kills; i++) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            // Write as fast as possible until killed.
+            Localizer loc(i * 1000000L, 0);
+            PoseBuffer buf(&loc);
+            PacketSnapshot snap(path, 1 << 16, 0);
+            snap.persist("pose", &buf, sizeof(Pose));
+            buf.runContinuous();
+            snap.start();
+            pause();
+            _exit(0);
+        }
+        usleep(20000 + 3000 * i);
+        kill(pid, SIGKILL);
+        waitpid(pid, NULL, 0);
+
+        PacketSnapshot snap(path);
+        Pose p;
+        if (!snap.load("pose", p) || !p.isConsistent()) {
+            ++torn;
+        }
+    }
+    cout << "Killed " << kills << " writers: " << torn
+        << " torn or missing snapshots" << endl;
+    unlink(path);
+    return torn == 0 ? 0 : 1;
+}
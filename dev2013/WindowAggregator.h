@@ -0,0 +1,352 @@
+#include <boost/function.hpp>
+#include <cmath>
+#include <vector>
+#include <stdint.h>
+
+#include "SyncPolicy.h" // for SeqLockCell
+
+// Header guards -- this file may be included more than once.
+#ifndef WINDOWAGGREGATOR_H_
+#define WINDOWAGGREGATOR_H_
+
+/** Most quantiles a WindowAggregator reports. */
+const int MAX_WINDOW_QUANTILES = 8;
+
+/**
+ * Statistics of the values in a window, as published by WindowAggregator.
+ */
+struct WindowStats {
+    uint64_t count;      /**< Values in the window */
+    uint64_t total;      /**< Values added since the start */
+    double mean;
+    double variance;     /**< Sample variance; 0 for fewer than 2 values */
+    double min;
+    double max;
+    int numQuantiles;
+    double probs[MAX_WINDOW_QUANTILES];     /**< As passed in, e.g. 0.99 */
+    double quantiles[MAX_WINDOW_QUANTILES]; /**< Approximate quantiles */
+};
+
+/**
+ * Sliding-window statistics (mean, variance, minimum, maximum and
+ * approximate quantiles) over the last N values of a stream, kept up to date
+ * incrementally instead of recomputed from a copy of the history:
+ *
+ *   - mean and variance by Welford's running sums, with the value leaving
+ *     the window subtracted out again; O(1). The sums are recomputed from
+ *     the window every 64 window lengths to keep rounding errors from
+ *     piling up, which is still O(1) amortized.
+ *   - minimum and maximum by monotonic deques; O(1) amortized.
+ *   - quantiles by a logarithmically bucketed histogram (a DDSketch), which
+ *     supports removal and is accurate to relativeAccuracy times the value.
+ *     Magnitudes below minMagnitude count as zero, those above maxMagnitude
+ *     as maxMagnitude.
+ *
+ * add() is called by a single writer, normally the buffer's updater thread
+ * through the publish hook, and publishes a WindowStats snapshot through a
+ * sequence lock, so getStats() never blocks the writer or takes a lock:
+ *
+ *     WindowAggregator currentStats(500);
+ *     motorBuf.setPublishHook(currentStats.hook<MotorPacket>(
+ *         [](const MotorPacket& p) { return p.getCurrent(); }));
+ *     ...
+ *     WindowStats st = currentStats.getStats();
+ *
+ * To aggregate several values of one buffer, call add() on each aggregator
+ * from one hook (or from stream::sink(), see Stream.h).
+ */
+class WindowAggregator {
+
+    private:
+    // The window itself: a ring of the last windowSize values.
+    std::vector<double> ring;
+    uint64_t total;
+    size_t count;
+
+    // Welford's running sums.
+    double mean;
+    double m2;
+    uint64_t sinceResync;
+
+    // Monotonic deques of positions (total counts) of candidate minima and
+    // maxima, as rings of windowSize entries.
+    std::vector<uint64_t> minQ;
+    std::vector<uint64_t> maxQ;
+    size_t minHead, minLen;
+    size_t maxHead, maxLen;
+
+    // Quantile sketch.
+    double lnGamma;
+    double gamma;
+    int minIndex;
+    int numBins;
+    std::vector<uint32_t> posBins;
+    std::vector<uint32_t> negBins;
+    uint64_t zeroCount;
+    double minMagnitude;
+    std::vector<double> probs;
+    std::vector<size_t> order; // Of probs, by increasing probability
+    int posLo, posHi;
+    int negLo, negHi;
+
+    SeqLockCell<WindowStats> published;
+
+    WindowAggregator(const WindowAggregator&);
+    WindowAggregator& operator=(const WindowAggregator&);
+
+    double valueAt(uint64_t pos) const {
+        return ring[pos % ring.size()];
+    }
+
+    int binOf(double magnitude) const {
+        int i = (int) std::ceil(std::log(magnitude) / lnGamma) - minIndex;
+        if (i < 0) {
+            return 0;
+        }
+        return i < numBins ? i : numBins - 1;
+    }
+
+    double binValue(int bin) const {
+        return 2 * std::pow(gamma, bin + minIndex) / (gamma + 1);
+    }
+
+    /**
+     * Adds delta to a bin, keeping [lo, hi] around the non-empty bins.
+     */
+    void binAdd(std::vector<uint32_t>& bins, int& lo, int& hi, int b,
+                int delta) {
+        bins[b] += delta;
+        if (delta > 0) {
+            if (b < lo) {
+                lo = b;
+            }
+            if (b > hi) {
+                hi = b;
+            }
+        } else if (bins[b] == 0) {
+            while (lo <= hi && bins[lo] == 0) {
+                ++lo;
+            }
+            while (hi >= lo && bins[hi] == 0) {
+                --hi;
+            }
+            if (lo > hi) {
+                lo = numBins;
+                hi = -1;
+            }
+        }
+    }
+
+    void sketchAdd(double x, int delta) {
+        if (x > minMagnitude) {
+            binAdd(posBins, posLo, posHi, binOf(x), delta);
+        } else if (x < -minMagnitude) {
+            binAdd(negBins, negLo, negHi, binOf(-x), delta);
+        } else {
+            zeroCount += delta;
+        }
+    }
+
+    /**
+     * Fills in the quantiles in one pass over the occupied bins, in order of
+     * increasing probability (see order).
+     */
+    void sketchQuantiles(WindowStats& st) {
+        size_t q = 0;
+        uint64_t seen = 0;
+        uint64_t rank = 0;
+        if (q < order.size()) {
+            rank = (uint64_t) (probs[order[q]] * (count - 1));
+        }
+        for (int b = negHi; b >= negLo && q < order.size(); b--) {
+            seen += negBins[b];
+            while (q < order.size() && seen > rank) {
+                st.quantiles[order[q++]] = -binValue(b);
+                if (q < order.size()) {
+                    rank = (uint64_t) (probs[order[q]] * (count - 1));
+                }
+            }
+        }
+        seen += zeroCount;
+        while (q < order.size() && seen > rank) {
+            st.quantiles[order[q++]] = 0;
+            if (q < order.size()) {
+                rank = (uint64_t) (probs[order[q]] * (count - 1));
+            }
+        }
+        for (int b = posLo; b <= posHi && q < order.size(); b++) {
+            seen += posBins[b];
+            while (q < order.size() && seen > rank) {
+                st.quantiles[order[q++]] = binValue(b);
+                if (q < order.size()) {
+                    rank = (uint64_t) (probs[order[q]] * (count - 1));
+                }
+            }
+        }
+    }
+
+    /** Recomputes the running sums from the window. */
+    void resync() {
+        mean = 0;
+        m2 = 0;
+        uint64_t n = 0;
+        for (uint64_t pos = total - count; pos < total; pos++) {
+            double x = valueAt(pos);
+            ++n;
+            double d = x - mean;
+            mean += d / n;
+            m2 += d * (x - mean);
+        }
+        sinceResync = 0;
+    }
+
+    public:
+    /**
+     * @param windowSize Number of values in the window.
+     * @param quantiles The quantiles to report (at most
+     *        MAX_WINDOW_QUANTILES), e.g. {0.5, 0.99}.
+     * @param relativeAccuracy Relative error of the quantiles.
+     * @param minMagnitude, maxMagnitude Range of magnitudes the quantile
+     *        sketch resolves.
+     */
+    WindowAggregator(size_t windowSize,
+                     const std::vector<double>& quantiles =
+                         std::vector<double>(),
+                     double relativeAccuracy = 0.01,
+                     double minMagnitude = 1e-3,
+                     double maxMagnitude = 1e6) :
+                     ring(windowSize > 0 ? windowSize : 1), total(0),
+                     count(0), mean(0), m2(0), sinceResync(0),
+                     minQ(ring.size()), maxQ(ring.size()), minHead(0),
+                     minLen(0), maxHead(0), maxLen(0), zeroCount(0),
+                     minMagnitude(minMagnitude), probs(quantiles) {
+        if (probs.size() > MAX_WINDOW_QUANTILES) {
+            probs.resize(MAX_WINDOW_QUANTILES);
+        }
+        gamma = (1 + relativeAccuracy) / (1 - relativeAccuracy);
+        lnGamma = std::log(gamma);
+        minIndex = (int) std::ceil(std::log(minMagnitude) / lnGamma);
+        numBins = (int) std::ceil(std::log(maxMagnitude) / lnGamma) -
+            minIndex + 1;
+        posBins.assign(numBins, 0);
+        negBins.assign(numBins, 0);
+        posLo = negLo = numBins;
+        posHi = negHi = -1;
+        for (size_t i = 0; i < probs.size(); i++) {
+            size_t j = order.size();
+            order.push_back(i);
+            while (j > 0 && probs[order[j - 1]] > probs[i]) {
+                order[j] = order[j - 1];
+                order[--j] = i;
+            }
+        }
+
+        WindowStats empty = WindowStats();
+        empty.numQuantiles = probs.size();
+        for (size_t i = 0; i < probs.size(); i++) {
+            empty.probs[i] = probs[i];
+        }
+        published.store(empty);
+    }
+
+    /**
+     * Adds a value to the window, dropping the oldest one if the window is
+     * full, and publishes the new statistics. Writer only.
+     */
+    void add(double x) {
+        size_t n = ring.size();
+        if (count == n) {
+            // The oldest value leaves the window.
+            double old = valueAt(total - n);
+            sketchAdd(old, -1);
+            --count;
+            if (count == 0) {
+                mean = 0;
+                m2 = 0;
+            } else {
+                double d = old - mean;
+                mean -= d / count;
+                m2 -= d * (old - mean);
+            }
+            if (minLen > 0 && minQ[minHead] == total - n) {
+                minHead = (minHead + 1) % n;
+                --minLen;
+            }
+            if (maxLen > 0 && maxQ[maxHead] == total - n) {
+                maxHead = (maxHead + 1) % n;
+                --maxLen;
+            }
+        }
+
+        ring[total % n] = x;
+        sketchAdd(x, 1);
+        ++count;
+        double d = x - mean;
+        mean += d / count;
+        m2 += d * (x - mean);
+
+        // Drop the candidates that can no longer be the minimum (maximum).
+        while (minLen > 0 &&
+               valueAt(minQ[(minHead + minLen - 1) % n]) >= x) {
+            --minLen;
+        }
+        minQ[(minHead + minLen) % n] = total;
+        ++minLen;
+        while (maxLen > 0 &&
+               valueAt(maxQ[(maxHead + maxLen - 1) % n]) <= x) {
+            --maxLen;
+        }
+        maxQ[(maxHead + maxLen) % n] = total;
+        ++maxLen;
+        ++total;
+
+        if (++sinceResync >= 64 * n) {
+            resync();
+        }
+
+        WindowStats st;
+        st.count = count;
+        st.total = total;
+        st.mean = mean;
+        st.variance = count > 1 ? (m2 > 0 ? m2 : 0) / (count - 1) : 0;
+        st.min = valueAt(minQ[minHead]);
+        st.max = valueAt(maxQ[maxHead]);
+        st.numQuantiles = probs.size();
+        for (size_t i = 0; i < probs.size(); i++) {
+            st.probs[i] = probs[i];
+            st.quantiles[i] = 0;
+        }
+        sketchQuantiles(st);
+        published.store(st);
+    }
+
+    /**
+     * The statistics as of the last add(). Lock-free; any thread.
+     */
+    WindowStats getStats() {
+        WindowStats st;
+        published.load(st);
+        return st;
+    }
+
+    /**
+     * A publish hook that adds extract(packet) for every published packet;
+     * see BufferThread::setPublishHook(). The aggregator must outlive the
+     * buffer.
+     */
+    template <class Packet, class Extract>
+    boost::function<void(const Packet&, uint64_t)> hook(Extract extract) {
+        struct Add {
+            WindowAggregator* agg;
+            Extract extract;
+
+            void operator()(const Packet& pkt, uint64_t) {
+                agg->add(extract(pkt));
+            }
+        };
+        Add add = {this, extract};
+        return add;
+    }
+};
+
+#endif
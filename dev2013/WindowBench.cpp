@@ -0,0 +1,122 @@
+#include "WindowAggregator.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+
+#include "MonotonicClock.h"
+
+using namespace std;
+
+/**
+ * Recomputes the statistics from a copy of the history, the way the
+ * health monitors used to.
+ */
+WindowStats recompute(const vector<double>& history, size_t window,
+                      const vector<double>& probs) {
+    size_t n = min(window, history.size());
+    vector<double> copy(history.end() - n, history.end());
+    WindowStats st = WindowStats();
+    st.count = n;
+    double sum = 0;
+    st.min = copy[0];
+    st.max = copy[0];
+    for (size_t i = 0; i < n; i++) {
+        sum += copy[i];
+        st.min = min(st.min, copy[i]);
+        st.max = max(st.max, copy[i]);
+    }
+    st.mean = sum / n;
+    double ss = 0;
+    for (size_t i = 0; i < n; i++) {
+        ss += (copy[i] - st.mean) * (copy[i] - st.mean);
+    }
+    st.variance = n > 1 ? ss / (n - 1) : 0;
+    st.numQuantiles = probs.size();
+    for (size_t i = 0; i < probs.size(); i++) {
+        size_t k = (size_t) (probs[i] * (n - 1));
+        nth_element(copy.begin(), copy.begin() + k, copy.end());
+        st.probs[i] = probs[i];
+        st.quantiles[i] = copy[k];
+    }
+    return st;
+}
+
+/** Motor-current-like samples: a noisy level with occasional spikes. */
+double sample(unsigned int* seed) {
+    double noise = (rand_r(seed) % 2000) / 1000.0 - 1.0;
+    double spike = rand_r(seed) % 100 == 0 ? 20.0 : 0.0;
+    return 5.0 + noise + spike;
+}
+
+/**
+ * Cost per update (add and read back) of WindowAggregator against
+ * recomputing from a copy of the history, at several window sizes, and the
+ * largest differences between the two.
+ *
+ * Usage: WindowBench [updates]  (default 200000)
+ */
+int main(int argc, char** argv) {
+    long updates = 200000;
+    if (argc > 1) {
+        updates = atol(argv[1]);
+    }
+    vector<double> probs;
+    probs.push_back(0.5);
+    probs.push_back(0.9);
+    probs.push_back(0.99);
+    size_t windows[] = {16, 256, 4096, 65536};
+
+    cout << setw(8) << "window" << setw(16) << "incremental" << setw(14) <<
+        "recompute" << "   (ns/update)" << setw(12) << "mean err" <<
+        setw(12) << "p99 err" << endl;
+    for (size_t w = 0; w < sizeof(windows) / sizeof(windows[0]); w++) {
+        size_t window = windows[w];
+        unsigned int seed = 1;
+        vector<double> history;
+        for (long i = 0; i < updates; i++) {
+            history.push_back(sample(&seed));
+        }
+
+        WindowAggregator agg(window, probs);
+        double sink = 0;
+        int64_t t0 = monotonicNs();
+        for (long i = 0; i < updates; i++) {
+            agg.add(history[i]);
+            sink += agg.getStats().max;
+        }
+        int64_t t1 = monotonicNs();
+        double incNs = double(t1 - t0) / updates;
+
+        // Recomputation is O(window), so time it on the last updates only.
+        long recUpdates = min(updates, max(100L, 20000000L / (long) window));
+        vector<double> prefix(history.begin(),
+                              history.end() - recUpdates);
+        WindowStats rec = WindowStats();
+        t0 = monotonicNs();
+        for (long i = updates - recUpdates; i < updates; i++) {
+            prefix.push_back(history[i]);
+            rec = recompute(prefix, window, probs);
+            sink += rec.max;
+        }
+        t1 = monotonicNs();
+        double recNs = double(t1 - t0) / recUpdates;
+
+        WindowStats inc = agg.getStats();
+        cout << setw(8) << window << fixed << setprecision(1) << setw(16) <<
+            incNs << setw(14) << recNs << "               " <<
+            scientific << setprecision(2) << setw(12) <<
+            fabs(inc.mean - rec.mean) << setw(12) <<
+            fabs(inc.quantiles[2] - rec.quantiles[2]) / rec.quantiles[2] <<
+            endl;
+        if (inc.min != rec.min || inc.max != rec.max) {
+            cout << "  min/max mismatch" << endl;
+        }
+        // Keep the reads from being optimized away.
+        if (sink < 0) {
+            cout << sink;
+        }
+    }
+    return 0;
+}